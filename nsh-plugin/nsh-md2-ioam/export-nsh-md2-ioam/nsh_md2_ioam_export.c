@@ -26,24 +26,82 @@
 #include <vlibmemory/api.h>
 
 #include <nsh/nsh.h>
+#include <nsh/nsh_numa.h>
 #include <nsh-md2-ioam/nsh_md2_ioam.h>
 
 
 ioam_export_main_t nsh_md2_ioam_export_main;
 
+/*
+ * Export only the NSH header and TLVs of each packet, with the path and
+ * flow key, see the node. The default; full copies carry neither.
+ */
+u8 nsh_md2_ioam_export_compact = 1;
+
+/* Set once the IPFIX header and per-thread buffers are in place */
+static u8 nsh_md2_ioam_export_running;
+
+#define IPFIX_NSH_MD2_IOAM_EXPORT_ID 274 // TODO: Move this to ioam/ioam_export.h
+#define IPFIX_NSH_MD2_IOAM_COMPACT_EXPORT_ID 276
+
 
 extern vlib_node_registration_t nsh_md2_ioam_export_node;
 extern void nsh_md2_set_next_ioam_export_override (uword next);
-/* Action function shared between message handler and debug CLI */
+
+/*
+ * MD2 decap on vxlan4-gpe-nsh-input takes the export next nsh-input
+ * has, so the export node goes in the same slot there. Should that slot
+ * be taken, MD2 packets are left to vxlan4-gpe-input and nsh-input.
+ */
+static void
+nsh_md2_ioam_export_hook_vxlan_gpe (vlib_main_t * vm, u32 node_index,
+				    u32 slot)
+{
+  vlib_node_t *n = vlib_get_node (vm, vxlan4_gpe_nsh_input_node.index);
+  nsh_main_t *nm = &nsh_main;
+
+  if (slot < vec_len (n->next_nodes) && n->next_nodes[slot] != ~0
+      && n->next_nodes[slot] != node_index)
+    {
+      nm->vxlan_gpe_nsh_md2_bypass = 1;
+      return;
+    }
+
+  if (vlib_node_add_next_with_slot (vm, vxlan4_gpe_nsh_input_node.index,
+				    node_index, slot) != slot)
+    nm->vxlan_gpe_nsh_md2_bypass = 1;
+}
+/*
+ * Action function shared between message handler and debug CLI.
+ * nsp_nsi ~0 applies to every service path, otherwise only the given
+ * mapping takes the export branch (or stops taking it). Disabling without
+ * a path tears export down for all of them. Returns -2 if the mapping
+ * does not exist, -3 if the IPFIX header cannot be built.
+ */
 int
 nsh_md2_ioam_export_enable_disable (ioam_export_main_t * em,
 				      u8 is_disable,
 				      ip4_address_t * collector_address,
-				      ip4_address_t * src_address)
+				      ip4_address_t * src_address,
+				      u8 compact, u32 nsp_nsi)
 {
   vlib_main_t *vm = em->vlib_main;
   u32 node_index = nsh_md2_ioam_export_node.index;
   vlib_node_t *nsh_input_node = NULL;
+  nsh_main_t *nm = &nsh_main;
+  nsh_map_t *map;
+  u32 key;
+
+  if (is_disable && nsp_nsi != ~0)
+    return nsh_md2_set_map_ioam_export_override (nsp_nsi, 0);
+
+  /* Nothing gets set up for a path that is not there */
+  if (nsp_nsi != ~0)
+    {
+      key = clib_host_to_net_u32 (nsp_nsi);
+      if (hash_get_mem (nm->nsh_mapping_by_key, &key) == 0)
+	return (-2);
+    }
 
   if (is_disable == 0)
     {
@@ -60,23 +118,40 @@ nsh_md2_ioam_export_enable_disable (ioam_export_main_t * em,
 	  em->my_hbh_slot =
 	    vlib_node_add_next (vm, nsh_input_node->index,
 				node_index);
+	  nsh_md2_ioam_export_hook_vxlan_gpe (vm, node_index,
+					      em->my_hbh_slot);
 	}
-      if (1 == ioam_export_header_create (em, collector_address, src_address))
+      if (nsh_md2_ioam_export_running == 0)
 	{
+	  /* Records differ in layout, so each mode has its own set */
+	  nsh_md2_ioam_export_compact = compact;
+	  em->set_id = compact ? IPFIX_NSH_MD2_IOAM_COMPACT_EXPORT_ID :
+	    IPFIX_NSH_MD2_IOAM_EXPORT_ID;
+	  if (1 != ioam_export_header_create (em, collector_address,
+					      src_address))
+	    return (-3);
+
 	  ioam_export_thread_buffer_init (em, vm);
-	  nsh_md2_set_next_ioam_export_override (em->my_hbh_slot);
 	  /* Turn on the export buffer check process */
 	  vlib_process_signal_event (vm, em->export_process_node_index, 1, 0);
-
-	}
-      else
-	{
-	  return (-2);
+	  nsh_md2_ioam_export_running = 1;
 	}
+
+      if (nsp_nsi != ~0)
+	return nsh_md2_set_map_ioam_export_override (nsp_nsi,
+						     em->my_hbh_slot);
+
+      nsh_md2_set_next_ioam_export_override (em->my_hbh_slot);
     }
   else
     {
       nsh_md2_set_next_ioam_export_override (0); // VXLAN_GPE_DECAP_IOAM_V4_NEXT_POP
+      pool_foreach (map, nm->nsh_mappings,
+      ({
+	map->export_next = 0;
+      }));
+      nsh_numa_replicas_update ();
+      nsh_md2_ioam_export_running = 0;
       ioam_export_header_cleanup (em, collector_address, src_address);
       ioam_export_thread_buffer_free (em);
       /* Turn off the export buffer check process */
@@ -97,6 +172,11 @@ set_nsh_md2_ioam_export_ipfix_command_fn (vlib_main_t * vm,
   ioam_export_main_t *em = &nsh_md2_ioam_export_main;
   ip4_address_t collector, src;
   u8 is_disable = 0;
+  u8 compact = 1;
+  u32 nsp, nsi;
+  int nsp_set = 0, nsi_set = 0;
+  u32 nsp_nsi = ~0;
+  int rv;
 
   collector.as_u32 = 0;
   src.as_u32 = 0;
@@ -107,12 +187,26 @@ set_nsh_md2_ioam_export_ipfix_command_fn (vlib_main_t * vm,
 	;
       else if (unformat (input, "src %U", unformat_ip4_address, &src))
 	;
+      else if (unformat (input, "compact"))
+	compact = 1;
+      else if (unformat (input, "full"))
+	compact = 0;
+      else if (unformat (input, "nsp %d", &nsp))
+	nsp_set = 1;
+      else if (unformat (input, "nsi %d", &nsi))
+	nsi_set = 1;
       else if (unformat (input, "disable"))
 	is_disable = 1;
       else
 	break;
     }
 
+  if (nsp_set != nsi_set)
+    return clib_error_return (0, "nsp and nsi must be given together");
+
+  if (nsp_set)
+    nsp_nsi = (nsp << NSH_NSP_SHIFT) | nsi;
+
   if (collector.as_u32 == 0)
     return clib_error_return (0, "collector address required");
 
@@ -129,9 +223,15 @@ set_nsh_md2_ioam_export_ipfix_command_fn (vlib_main_t * vm,
   /* Turn on the export timer process */
   // vlib_process_signal_event (vm, flow_report_process_node.index,
   //1, 0);
-  if (0 !=
-      nsh_md2_ioam_export_enable_disable (em, is_disable, &collector, &src))
+  rv = nsh_md2_ioam_export_enable_disable (em, is_disable, &collector, &src,
+					   compact, nsp_nsi);
+  switch (rv)
     {
+    case 0:
+      break;
+    case -2:
+      return clib_error_return (0, "mapping does not exist");
+    default:
       return clib_error_return (0, "Unable to set ioam nsh-md2 export");
     }
 
@@ -142,13 +242,83 @@ set_nsh_md2_ioam_export_ipfix_command_fn (vlib_main_t * vm,
 VLIB_CLI_COMMAND (set_nsh_md2_ioam_ipfix_command, static) =
 {
 .path = "set nsh-md2-ioam export ipfix",
-.short_help = "set nsh-md2-ioam export ipfix collector <ip4-address> src <ip4-address>",
+.short_help = "set nsh-md2-ioam export ipfix collector <ip4-address> src <ip4-address> [compact | full] [nsp <nn> nsi <nn>] [disable]",
 .function = set_nsh_md2_ioam_export_ipfix_command_fn,
 };
 /* *INDENT-ON* */
 
+static char *nsh_export_sample_strings[] = {
+#define _(sym,str) str,
+  foreach_nsh_export_sample
+#undef _
+};
+
+static clib_error_t *
+set_nsh_md2_ioam_export_sampling_command_fn (vlib_main_t * vm,
+					     unformat_input_t * input,
+					     vlib_cli_command_t * cmd)
+{
+  u32 rate = 0;
+  u8 by_flow = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "rate %u", &rate))
+	;
+      else if (unformat (input, "flow"))
+	by_flow = 1;
+      else
+	return clib_error_return (0, "parse error: '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (0 != nsh_md2_set_ioam_export_sampling (rate, by_flow))
+    return clib_error_return (0, "flow sampling needs a rate above 1");
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_nsh_md2_ioam_export_sampling_command, static) =
+{
+.path = "set nsh-md2-ioam export sampling",
+.short_help = "set nsh-md2-ioam export sampling rate <n> [flow]",
+.function = set_nsh_md2_ioam_export_sampling_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+show_nsh_md2_ioam_export_sampling_command_fn (vlib_main_t * vm,
+					      unformat_input_t * input,
+					      vlib_cli_command_t * cmd)
+{
+  nsh_main_t *nm = &nsh_main;
+  int i;
+
+  if (nm->export_sample_rate <= 1)
+    vlib_cli_output (vm, "sampling off, every packet is exported");
+  else
+    vlib_cli_output (vm, "sampling 1 in %u %s", nm->export_sample_rate,
+		     nm->export_sample_by_flow ? "flows" : "packets");
+
+  for (i = 0; i < NSH_EXPORT_N_SAMPLE; i++)
+    vlib_cli_output (vm, " %s - %llu", nsh_export_sample_strings[i],
+		     vlib_get_simple_counter (&nm->export_sample_counters[i],
+					      0));
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_nsh_md2_ioam_export_sampling_command, static) =
+{
+.path = "show nsh-md2-ioam export sampling",
+.short_help = "show nsh-md2-ioam export sampling",
+.function = show_nsh_md2_ioam_export_sampling_command_fn,
+};
+/* *INDENT-ON* */
+
 
-#define IPFIX_NSH_MD2_IOAM_EXPORT_ID 274 // TODO: Move this to ioam/ioam_export.h
 static clib_error_t *
 nsh_md2_ioam_export_init (vlib_main_t * vm)
 {
@@ -17,6 +17,8 @@
 #include <vnet/pg/pg.h>
 #include <vppinfra/error.h>
 #include <vnet/ip/ip.h>
+#include <vnet/ip/ip4.h>
+#include <vnet/ip/ip6.h>
 #include <nsh/nsh.h>
 #include <nsh/nsh_packet.h>
 #include <ioam/export-common/ioam_export.h>
@@ -28,6 +30,7 @@ typedef struct
 } export_trace_t;
 
 extern ioam_export_main_t nsh_md2_ioam_export_main;
+extern u8 nsh_md2_ioam_export_compact;
 vlib_node_registration_t export_node;
 /* packet trace format function */
 static u8 *
@@ -107,11 +110,167 @@ copy3cachelines (void *dst, const void *src, size_t n)
     }
 }
 
+/*
+ * Compact record: the path identity and flow key, followed by the NSH
+ * base header and MD2 TLVs of the packet at their real length.
+ */
+/* *INDENT-OFF* */
+typedef CLIB_PACKED(struct {
+  u32 nsp_nsi;
+  u32 flow_hash;
+  u16 length;			/* of the NSH header that follows */
+  u16 reserved;
+}) nsh_md2_ioam_export_record_t;
+/* *INDENT-ON* */
+
+/* Largest record: NSH length is 6 bits of 4-byte words */
+#define NSH_MD2_IOAM_EXPORT_RECORD_MAX \
+  (sizeof (nsh_md2_ioam_export_record_t) + (NSH_LEN_MASK << 2))
+
+/* Keep compact export packets as large as full-copy ones */
+#define NSH_MD2_IOAM_EXPORT_COMPACT_BYTES \
+  (DEFAULT_EXPORT_RECORDS * DEFAULT_EXPORT_SIZE)
+
+/* Flow key of the inner packet, 0 when it is neither IPv4 nor IPv6 */
+always_inline u32
+nsh_md2_ioam_export_flow_hash (vlib_buffer_t * b, nsh_base_header_t * nsh,
+			       u32 nsh_len)
+{
+  void *inner = (u8 *) nsh + nsh_len;
+
+  if (nsh_len + sizeof (ip6_header_t) > b->current_length)
+    return 0;
+
+  if (nsh->next_protocol == NSH_NEXT_PROTOCOL_IP4)
+    return ip4_compute_flow_hash (inner, IP_FLOW_HASH_DEFAULT);
+  if (nsh->next_protocol == NSH_NEXT_PROTOCOL_IP6)
+    return ip6_compute_flow_hash (inner, IP_FLOW_HASH_DEFAULT);
+
+  return 0;
+}
+
 static void
 nsh_md2_ioam_export_fixup_func (vlib_buffer_t * export_buf,
 			     vlib_buffer_t * pak_buf)
 {
-  /* Todo: on implementing analyse */
+  nsh_md2_ioam_export_record_t *rec =
+    (nsh_md2_ioam_export_record_t *) (export_buf->data +
+				      export_buf->current_length);
+  nsh_base_header_t *nsh = vlib_buffer_get_current (pak_buf);
+  u32 nsh_len = (nsh->length & NSH_LEN_MASK) << 2;
+
+  rec->nsp_nsi = nsh->nsp_nsi;
+  rec->flow_hash =
+    clib_host_to_net_u32 (nsh_md2_ioam_export_flow_hash (pak_buf, nsh,
+							 nsh_len));
+  rec->length = clib_host_to_net_u16 (nsh_len);
+  rec->reserved = 0;
+}
+
+static void
+nsh_md2_ioam_export_nop_fixup_func (vlib_buffer_t * export_buf,
+				    vlib_buffer_t * pak_buf)
+{
+}
+
+/*
+ * Compact export: append a record per packet carrying only its NSH header
+ * and TLVs, a few dozen bytes instead of DEFAULT_EXPORT_SIZE.
+ */
+static void
+nsh_md2_ioam_export_compact_node_fn (ioam_export_main_t * em,
+				     vlib_main_t * vm,
+				     vlib_node_runtime_t * node,
+				     vlib_frame_t * frame)
+{
+  u32 n_left_from, *from, *to_next;
+  u32 next_index, n_left_to_next;
+  u32 thread_index = vlib_get_thread_index ();
+  ioam_export_buffer_t *my_buf;
+  vlib_buffer_t *eb0 = 0;
+  u32 pkts_recorded = 0;
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+  next_index = node->cached_next_index;
+
+  while (__sync_lock_test_and_set (em->lockp[thread_index], 1))
+    ;
+  my_buf = ioam_export_get_my_buffer (em, thread_index);
+  my_buf->touched_at = vlib_time_now (vm);
+  /* A failed allocation on the last send left no buffer, retry */
+  if (my_buf->buffer_index == ~0
+      && ioam_export_init_buffer (em, vm, my_buf) != 1)
+    my_buf->buffer_index = ~0;
+  if (my_buf->buffer_index != ~0)
+    eb0 = vlib_get_buffer (vm, my_buf->buffer_index);
+
+  while (n_left_from > 0)
+    {
+      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+      while (n_left_from > 0 && n_left_to_next > 0)
+	{
+	  u32 bi0;
+	  vlib_buffer_t *p0;
+	  u32 next0 = EXPORT_NEXT_NSH_MD2_IOAM_INPUT;
+	  nsh_base_header_t *nsh0;
+	  nsh_md2_ioam_export_record_t *rec0;
+	  u32 nsh_len0;
+
+	  bi0 = from[0];
+	  to_next[0] = bi0;
+	  from += 1;
+	  to_next += 1;
+	  n_left_from -= 1;
+	  n_left_to_next -= 1;
+
+	  p0 = vlib_get_buffer (vm, bi0);
+	  nsh0 = vlib_buffer_get_current (p0);
+	  nsh_len0 = (nsh0->length & NSH_LEN_MASK) << 2;
+
+	  if (PREDICT_TRUE (eb0 != 0 && nsh_len0 <= p0->current_length))
+	    {
+	      rec0 = (nsh_md2_ioam_export_record_t *)
+		(eb0->data + eb0->current_length);
+	      nsh_md2_ioam_export_fixup_func (eb0, p0);
+	      clib_memcpy (rec0 + 1, nsh0, nsh_len0);
+	      eb0->current_length += sizeof (*rec0) + nsh_len0;
+	      my_buf->records_in_this_buffer++;
+	      pkts_recorded++;
+
+	      if (eb0->current_length + NSH_MD2_IOAM_EXPORT_RECORD_MAX >
+		  NSH_MD2_IOAM_EXPORT_COMPACT_BYTES)
+		{
+		  ioam_export_send_buffer (em, vm, my_buf);
+		  eb0 = 0;
+		  if (ioam_export_init_buffer (em, vm, my_buf) == 1)
+		    eb0 = vlib_get_buffer (vm, my_buf->buffer_index);
+		  else
+		    my_buf->buffer_index = ~0;
+		}
+	    }
+
+	  if (PREDICT_FALSE ((node->flags & VLIB_NODE_FLAG_TRACE)
+			     && (p0->flags & VLIB_BUFFER_IS_TRACED)))
+	    {
+	      export_trace_t *t = vlib_add_trace (vm, node, p0, sizeof (*t));
+	      t->flow_label =
+		nsh_md2_ioam_export_flow_hash (p0, nsh0, nsh_len0);
+	      t->next_index = next0;
+	    }
+
+	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+					   to_next, n_left_to_next,
+					   bi0, next0);
+	}
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+
+  vlib_node_increment_counter (vm, nsh_md2_ioam_export_node.index,
+			       EXPORT_ERROR_RECORDED, pkts_recorded);
+  *em->lockp[thread_index] = 0;
 }
 
 static uword
@@ -119,10 +278,17 @@ nsh_md2_ioam_export_node_fn (vlib_main_t * vm,
 			  vlib_node_runtime_t * node, vlib_frame_t * frame)
 {
   ioam_export_main_t *em = &nsh_md2_ioam_export_main;
+
+  if (nsh_md2_ioam_export_compact)
+    {
+      nsh_md2_ioam_export_compact_node_fn (em, vm, node, frame);
+      return frame->n_vectors;
+    }
+
   ioam_export_node_common (em, vm, node, frame, ip4_header_t, length,
 			   ip_version_and_header_length,
 			   EXPORT_NEXT_NSH_MD2_IOAM_INPUT,
-			   nsh_md2_ioam_export_fixup_func);
+			   nsh_md2_ioam_export_nop_fixup_func);
   return frame->n_vectors;
 }
 
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ *------------------------------------------------------------------
+ * nsh_path_stats_export.c - periodic IPFIX export of per service
+ * path counters, over the iOAM export transport
+ *------------------------------------------------------------------
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/plugin/plugin.h>
+#include <ioam/export-common/ioam_export.h>
+
+#include <nsh/nsh.h>
+
+#define IPFIX_NSH_PATH_STATS_EXPORT_ID 275 // TODO: Move this to ioam/ioam_export.h
+#define NSH_PATH_STATS_DEFAULT_INTERVAL 10.0
+/* Keep export packets well below a 1500 byte MTU */
+#define NSH_PATH_STATS_RECORDS_PER_BUFFER 20
+
+/* Record layout of set 275, all fields in network order */
+typedef CLIB_PACKED(struct {
+  u32 nsp_nsi;
+  u64 packets;
+  u64 bytes;
+  u64 drops[NSH_PATH_N_DROP];
+}) nsh_path_stats_record_t;
+
+typedef struct {
+  ioam_export_main_t export_main;
+  f64 interval;
+  u8 enabled;
+} nsh_path_stats_export_main_t;
+
+nsh_path_stats_export_main_t nsh_path_stats_export_main;
+
+static vlib_node_registration_t nsh_path_stats_export_process_node;
+
+/*
+ * Walk all maps on the main thread and emit one record per map. The data
+ * plane only bumps its own per-thread counters, so nothing is locked;
+ * vlib_get_*_counter sums over the threads.
+ */
+static void
+nsh_path_stats_export_send (vlib_main_t * vm)
+{
+  nsh_path_stats_export_main_t * pm = &nsh_path_stats_export_main;
+  ioam_export_main_t * em = &pm->export_main;
+  nsh_main_t * nm = &nsh_main;
+  ioam_export_buffer_t _eb, * eb = &_eb;
+  nsh_path_stats_record_t * r;
+  vlib_buffer_t * b0 = 0;
+  nsh_map_t * map;
+  vlib_counter_t c;
+  u32 map_index;
+  int i;
+
+  eb->buffer_index = ~0;
+
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    if (eb->buffer_index == ~0)
+      {
+        if (ioam_export_init_buffer (em, vm, eb) != 1)
+          return;
+        b0 = vlib_get_buffer (vm, eb->buffer_index);
+      }
+
+    map_index = map - nm->nsh_mappings;
+    r = vlib_buffer_get_current (b0) + b0->current_length;
+
+    r->nsp_nsi = clib_host_to_net_u32 (map->nsp_nsi);
+    vlib_get_combined_counter (&nm->path_counters, map_index, &c);
+    r->packets = clib_host_to_net_u64 (c.packets);
+    r->bytes = clib_host_to_net_u64 (c.bytes);
+    for (i = 0; i < NSH_PATH_N_DROP; i++)
+      r->drops[i] = clib_host_to_net_u64
+        (vlib_get_simple_counter (&nm->path_drop_counters[i], map_index));
+
+    b0->current_length += sizeof (*r);
+    eb->records_in_this_buffer++;
+
+    if (eb->records_in_this_buffer == NSH_PATH_STATS_RECORDS_PER_BUFFER)
+      {
+        ioam_export_send_buffer (em, vm, eb);
+        eb->buffer_index = ~0;
+      }
+  }));
+
+  if (eb->buffer_index != ~0)
+    ioam_export_send_buffer (em, vm, eb);
+}
+
+static uword
+nsh_path_stats_export_process (vlib_main_t * vm,
+                               vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  nsh_path_stats_export_main_t * pm = &nsh_path_stats_export_main;
+  uword event_type;
+  uword * event_data = 0;
+
+  while (1)
+    {
+      if (pm->enabled)
+        vlib_process_wait_for_event_or_clock (vm, pm->interval);
+      else
+        vlib_process_wait_for_event (vm);
+
+      event_type = vlib_process_get_events (vm, &event_data);
+
+      switch (event_type)
+        {
+        case 1:  /* enable */
+          pm->enabled = 1;
+          break;
+        case 2:  /* disable */
+          pm->enabled = 0;
+          break;
+        case ~0: /* timeout */
+          if (pm->enabled)
+            nsh_path_stats_export_send (vm);
+          break;
+        }
+
+      vec_reset_length (event_data);
+    }
+
+  return 0;			/* not so much */
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (nsh_path_stats_export_process_node, static) =
+{
+ .function = nsh_path_stats_export_process,
+ .type = VLIB_NODE_TYPE_PROCESS,
+ .name = "nsh-path-stats-export-process",
+};
+/* *INDENT-ON* */
+
+/* Action function shared between message handler and debug CLI */
+int
+nsh_path_stats_export_enable_disable (u8 is_disable,
+                                      ip4_address_t * collector_address,
+                                      ip4_address_t * src_address,
+                                      f64 interval)
+{
+  nsh_path_stats_export_main_t * pm = &nsh_path_stats_export_main;
+  ioam_export_main_t * em = &pm->export_main;
+  vlib_main_t * vm = em->vlib_main;
+  nsh_main_t * nm = &nsh_main;
+
+  if (is_disable == 0)
+    {
+      if (1 != ioam_export_header_create (em, collector_address, src_address))
+        return (-2);
+
+      pm->interval = interval;
+      nm->path_stats_enabled = 1;
+      vlib_process_signal_event (vm, nsh_path_stats_export_process_node.index,
+                                 1, 0);
+    }
+  else
+    {
+      nm->path_stats_enabled = 0;
+      vlib_process_signal_event (vm, nsh_path_stats_export_process_node.index,
+                                 2, 0);
+      ioam_export_header_cleanup (em, collector_address, src_address);
+    }
+
+  return 0;
+}
+
+static clib_error_t *
+set_nsh_path_stats_export_ipfix_command_fn (vlib_main_t * vm,
+                                            unformat_input_t * input,
+                                            vlib_cli_command_t * cmd)
+{
+  ioam_export_main_t * em = &nsh_path_stats_export_main.export_main;
+  ip4_address_t collector, src;
+  f64 interval = NSH_PATH_STATS_DEFAULT_INTERVAL;
+  u8 is_disable = 0;
+
+  collector.as_u32 = 0;
+  src.as_u32 = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "collector %U", unformat_ip4_address, &collector))
+	;
+      else if (unformat (input, "src %U", unformat_ip4_address, &src))
+	;
+      else if (unformat (input, "interval %f", &interval))
+	;
+      else if (unformat (input, "disable"))
+	is_disable = 1;
+      else
+	return clib_error_return (0, "parse error: '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (collector.as_u32 == 0)
+    return clib_error_return (0, "collector address required");
+
+  if (src.as_u32 == 0)
+    return clib_error_return (0, "src address required");
+
+  if (interval < 1.0)
+    return clib_error_return (0, "interval must be at least 1 second");
+
+  em->ipfix_collector.as_u32 = collector.as_u32;
+  em->src_address.as_u32 = src.as_u32;
+
+  vlib_cli_output (vm, "Collector %U, src address %U, interval %.1fs",
+		   format_ip4_address, &em->ipfix_collector,
+		   format_ip4_address, &em->src_address, interval);
+
+  if (0 != nsh_path_stats_export_enable_disable (is_disable, &collector,
+                                                 &src, interval))
+    return clib_error_return (0, "Unable to set nsh path-stats export");
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_nsh_path_stats_export_ipfix_command, static) =
+{
+.path = "set nsh path-stats export ipfix",
+.short_help = "set nsh path-stats export ipfix collector <ip4-address> src <ip4-address> [interval <seconds>] [disable]",
+.function = set_nsh_path_stats_export_ipfix_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+nsh_path_stats_export_init (vlib_main_t * vm)
+{
+  ioam_export_main_t * em = &nsh_path_stats_export_main.export_main;
+
+  em->set_id = IPFIX_NSH_PATH_STATS_EXPORT_ID;
+  em->unix_time_0 = (u32) time (0);	/* Store starting time */
+  em->vlib_time_0 = vlib_time_now (vm);
+
+  em->my_hbh_slot = ~0;
+  em->vlib_main = vm;
+  em->vnet_main = vnet_get_main ();
+  ioam_export_reset_next_node (em);
+
+  nsh_path_stats_export_main.interval = NSH_PATH_STATS_DEFAULT_INTERVAL;
+
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (nsh_path_stats_export_init);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
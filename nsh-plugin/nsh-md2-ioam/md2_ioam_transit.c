@@ -61,14 +61,105 @@ VNET_FEATURE_INIT (nsh_md2_ioam_encap_transit, static) =
   .node_name = "nsh-md2-ioam-encap-transit",
   .runs_before = VNET_FEATURES ("adj-midchain-tx"),
 };
+
+VNET_FEATURE_INIT (nsh_md2_ioam_encap_transit6, static) =
+{
+  .arc_name = "ip6-output",
+  .node_name = "nsh-md2-ioam-encap-transit6",
+  .runs_before = VNET_FEATURES ("adj-midchain-tx"),
+};
 /* *INDENT-ON* */
 
 
-static uword
-nsh_md2_ioam_encap_transit (vlib_main_t * vm,
-			vlib_node_runtime_t * node, vlib_frame_t * from_frame)
+/*
+ * Cheap header checks first, so that the destination lookup only runs for
+ * NSH MD2 over LISP-GPE. Returns the IPv4 header offset, or ~0 when the
+ * packet is not a candidate for transit iOAM.
+ */
+always_inline u32
+nsh_md2_ioam_transit_classify_v4 (nsh_md2_ioam_main_t * hm,
+				  vlib_buffer_t * b0)
+{
+  u32 iph_offset = vnet_buffer (b0)->ip.save_rewrite_length;
+  ip4_header_t *ip0 = (ip4_header_t *) ((u8 *) vlib_buffer_get_current (b0)
+					+ iph_offset);
+  udp_header_t *udp_hdr0 = (udp_header_t *) (ip0 + 1);
+  lisp_gpe_header_t *lisp_gpe_hdr0 = (lisp_gpe_header_t *) (udp_hdr0 + 1);
+  nsh_base_header_t *nsh_hdr = (nsh_base_header_t *) (lisp_gpe_hdr0 + 1);
+
+  if (PREDICT_TRUE ((ip0->ip_version_and_header_length != 0x45) |
+		    (ip0->protocol != IP_PROTOCOL_UDP) |
+		    (udp_hdr0->dst_port !=
+		     clib_host_to_net_u16 (UDP_DST_PORT_lisp_gpe))))
+    return ~0;
+
+  if ((lisp_gpe_hdr0->next_protocol != LISP_GPE_NEXT_PROTO_NSH) |
+      (nsh_hdr->md_type != 2))
+    return ~0;
+
+  if (hash_get (hm->dst_by_ip4, ip0->dst_address.as_u32) == 0)
+    return ~0;
+
+  return iph_offset;
+}
+
+always_inline void
+nsh_md2_ioam_transit_one_v4 (vlib_main_t * vm, vlib_node_runtime_t * node,
+			     vlib_buffer_t * b0, u32 iph_offset, u32 * next0)
+{
+  vlib_buffer_advance (b0, (word) iph_offset);
+  nsh_md2_ioam_encap_decap_ioam_v4_one_inline (vm, node, b0, next0,
+					       NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_NEXT_DROP,
+					       1 /* use_adj */ );
+  vlib_buffer_advance (b0, -(word) iph_offset);
+}
+
+/* IPv6 variant of nsh_md2_ioam_transit_classify_v4 */
+always_inline u32
+nsh_md2_ioam_transit_classify_v6 (nsh_md2_ioam_main_t * hm,
+				  vlib_buffer_t * b0)
 {
+  u32 iph_offset = vnet_buffer (b0)->ip.save_rewrite_length;
+  ip6_header_t *ip0 = (ip6_header_t *) ((u8 *) vlib_buffer_get_current (b0)
+					+ iph_offset);
+  udp_header_t *udp_hdr0 = (udp_header_t *) (ip0 + 1);
+  lisp_gpe_header_t *lisp_gpe_hdr0 = (lisp_gpe_header_t *) (udp_hdr0 + 1);
+  nsh_base_header_t *nsh_hdr = (nsh_base_header_t *) (lisp_gpe_hdr0 + 1);
+
+  if (PREDICT_TRUE ((ip0->protocol != IP_PROTOCOL_UDP) |
+		    (udp_hdr0->dst_port !=
+		     clib_host_to_net_u16 (UDP_DST_PORT_lisp_gpe6))))
+    return ~0;
+
+  if ((lisp_gpe_hdr0->next_protocol != LISP_GPE_NEXT_PROTO_NSH) |
+      (nsh_hdr->md_type != 2))
+    return ~0;
+
+  if (hash_get_mem (hm->dst_by_ip6, &ip0->dst_address) == 0)
+    return ~0;
+
+  return iph_offset;
+}
+
+always_inline void
+nsh_md2_ioam_transit_one_v6 (vlib_main_t * vm, vlib_node_runtime_t * node,
+			     vlib_buffer_t * b0, u32 iph_offset, u32 * next0)
+{
+  vlib_buffer_advance (b0, (word) iph_offset);
+  nsh_md2_ioam_encap_decap_ioam_v6_one_inline (vm, node, b0, next0,
+					       NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_NEXT_DROP,
+					       1 /* use_adj */ );
+  vlib_buffer_advance (b0, -(word) iph_offset);
+}
+
+always_inline uword
+nsh_md2_ioam_encap_transit_inline (vlib_main_t * vm,
+				   vlib_node_runtime_t * node,
+				   vlib_frame_t * from_frame, u8 is_ip6)
+{
+  nsh_md2_ioam_main_t *hm = &nsh_md2_ioam_main;
   u32 n_left_from, next_index, *from, *to_next;
+  u32 n_encapsulated = 0;
 
   from = vlib_frame_vector_args (from_frame);
   n_left_from = from_frame->n_vectors;
@@ -81,12 +172,79 @@ nsh_md2_ioam_encap_transit (vlib_main_t * vm,
 
       vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
 
+      while (n_left_from >= 4 && n_left_to_next >= 2)
+	{
+	  u32 bi0, bi1;
+	  vlib_buffer_t *b0, *b1;
+	  u32 next0 = NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_NEXT_OUTPUT;
+	  u32 next1 = NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_NEXT_OUTPUT;
+	  u32 iph_offset0, iph_offset1;
+
+	  /* Prefetch next iteration. */
+	  {
+	    vlib_buffer_t *p2, *p3;
+
+	    p2 = vlib_get_buffer (vm, from[2]);
+	    p3 = vlib_get_buffer (vm, from[3]);
+
+	    vlib_prefetch_buffer_header (p2, LOAD);
+	    vlib_prefetch_buffer_header (p3, LOAD);
+
+	    CLIB_PREFETCH (p2->data, 2 * CLIB_CACHE_LINE_BYTES, LOAD);
+	    CLIB_PREFETCH (p3->data, 2 * CLIB_CACHE_LINE_BYTES, LOAD);
+	  }
+
+	  bi0 = from[0];
+	  bi1 = from[1];
+	  to_next[0] = bi0;
+	  to_next[1] = bi1;
+	  from += 2;
+	  to_next += 2;
+	  n_left_from -= 2;
+	  n_left_to_next -= 2;
+
+	  b0 = vlib_get_buffer (vm, bi0);
+	  b1 = vlib_get_buffer (vm, bi1);
+
+	  iph_offset0 = is_ip6 ?
+	    nsh_md2_ioam_transit_classify_v6 (hm, b0) :
+	    nsh_md2_ioam_transit_classify_v4 (hm, b0);
+	  iph_offset1 = is_ip6 ?
+	    nsh_md2_ioam_transit_classify_v6 (hm, b1) :
+	    nsh_md2_ioam_transit_classify_v4 (hm, b1);
+
+	  if (PREDICT_FALSE (iph_offset0 != ~0))
+	    {
+	      if (is_ip6)
+		nsh_md2_ioam_transit_one_v6 (vm, node, b0, iph_offset0,
+					     &next0);
+	      else
+		nsh_md2_ioam_transit_one_v4 (vm, node, b0, iph_offset0,
+					     &next0);
+	      n_encapsulated++;
+	    }
+	  if (PREDICT_FALSE (iph_offset1 != ~0))
+	    {
+	      if (is_ip6)
+		nsh_md2_ioam_transit_one_v6 (vm, node, b1, iph_offset1,
+					     &next1);
+	      else
+		nsh_md2_ioam_transit_one_v4 (vm, node, b1, iph_offset1,
+					     &next1);
+	      n_encapsulated++;
+	    }
+
+	  vlib_validate_buffer_enqueue_x2 (vm, node, next_index, to_next,
+					   n_left_to_next, bi0, bi1, next0,
+					   next1);
+	}
 
       while (n_left_from > 0 && n_left_to_next > 0)
 	{
 	  u32 bi0;
 	  vlib_buffer_t *b0;
 	  u32 next0 = NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_NEXT_OUTPUT;
+	  u32 iph_offset0;
 
 	  bi0 = from[0];
 	  to_next[0] = bi0;
@@ -94,59 +252,21 @@ nsh_md2_ioam_encap_transit (vlib_main_t * vm,
 	  to_next += 1;
 	  n_left_from -= 1;
 	  n_left_to_next -= 1;
-	  ip4_header_t *ip0;
-	  u32 iph_offset = 0;
 
 	  b0 = vlib_get_buffer (vm, bi0);
-	  iph_offset = vnet_buffer (b0)->ip.save_rewrite_length;
-	  ip0 = (ip4_header_t *) ((u8 *) vlib_buffer_get_current (b0)
-				  + iph_offset);
 
-	  /* just forward non ipv4 packets */
-	  if (PREDICT_FALSE
-	      ((ip0->ip_version_and_header_length & 0xF0) == 0x40))
+	  iph_offset0 = is_ip6 ?
+	    nsh_md2_ioam_transit_classify_v6 (hm, b0) :
+	    nsh_md2_ioam_transit_classify_v4 (hm, b0);
+	  if (PREDICT_FALSE (iph_offset0 != ~0))
 	    {
-	      /* ipv4 packets */
-	      udp_header_t *udp_hdr0 = (udp_header_t *) (ip0 + 1);
-	      if (PREDICT_FALSE
-		  ((ip0->protocol == IP_PROTOCOL_UDP) &&
-		   (clib_net_to_host_u16 (udp_hdr0->dst_port) ==
-		    UDP_DST_PORT_lisp_gpe)))
-		{
-
-		  /* Check the iOAM header */
-		  lisp_gpe_header_t *lisp_gpe_hdr0 = (lisp_gpe_header_t *) (udp_hdr0 + 1);
-                  nsh_base_header_t *nsh_hdr = (nsh_base_header_t *)(lisp_gpe_hdr0 + 1);
-
-		  if (PREDICT_FALSE
-		      (lisp_gpe_hdr0->next_protocol == LISP_GPE_NEXT_PROTO_NSH) &&
-                      (nsh_hdr->md_type == 2 ))
-		    {
-		      uword *t = NULL;
-		      nsh_md2_ioam_main_t *hm = &nsh_md2_ioam_main;
-		      fib_prefix_t key4;
-		      memset (&key4, 0, sizeof (key4));
-		      key4.fp_proto = FIB_PROTOCOL_IP4;
-		      key4.fp_addr.ip4.as_u32 = ip0->dst_address.as_u32;
-		      t = hash_get_mem (hm->dst_by_ip4, &key4);
-		      if (t)
-			{
-			  vlib_buffer_advance (b0,
-					       (word) (sizeof
-						       (ethernet_header_t)));
-			  nsh_md2_ioam_encap_decap_ioam_v4_one_inline (vm, node,
-								    b0,
-								    &next0,
-								    NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_NEXT_DROP,
-								    1
-								    /* use_adj */
-			    );
-			  vlib_buffer_advance (b0,
-					       -(word) (sizeof
-							(ethernet_header_t)));
-			}
-		    }
-		}
+	      if (is_ip6)
+		nsh_md2_ioam_transit_one_v6 (vm, node, b0, iph_offset0,
+					     &next0);
+	      else
+		nsh_md2_ioam_transit_one_v4 (vm, node, b0, iph_offset0,
+					     &next0);
+	      n_encapsulated++;
 	    }
 
 	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index, to_next,
@@ -156,9 +276,30 @@ nsh_md2_ioam_encap_transit (vlib_main_t * vm,
       vlib_put_next_frame (vm, node, next_index, n_left_to_next);
     }
 
+  vlib_node_increment_counter (vm, node->node_index,
+			       NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_ERROR_ENCAPSULATED,
+			       n_encapsulated);
+
   return from_frame->n_vectors;
 }
 
+static uword
+nsh_md2_ioam_encap_transit (vlib_main_t * vm,
+			vlib_node_runtime_t * node, vlib_frame_t * from_frame)
+{
+  return nsh_md2_ioam_encap_transit_inline (vm, node, from_frame,
+					    0 /* is_ip6 */ );
+}
+
+static uword
+nsh_md2_ioam_encap_transit6 (vlib_main_t * vm,
+			     vlib_node_runtime_t * node,
+			     vlib_frame_t * from_frame)
+{
+  return nsh_md2_ioam_encap_transit_inline (vm, node, from_frame,
+					    1 /* is_ip6 */ );
+}
+
 extern u8 * format_nsh_node_map_trace (u8 * s, va_list * args);
 /* *INDENT-OFF* */
 VLIB_REGISTER_NODE (nsh_md2_ioam_encap_transit_node) = {
@@ -178,6 +319,25 @@ VLIB_REGISTER_NODE (nsh_md2_ioam_encap_transit_node) = {
         [NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_NEXT_DROP] = "error-drop",
   },
 
+};
+
+VLIB_REGISTER_NODE (nsh_md2_ioam_encap_transit6_node) = {
+  .function = nsh_md2_ioam_encap_transit6,
+  .name = "nsh-md2-ioam-encap-transit6",
+  .vector_size = sizeof (u32),
+  .format_trace = format_nsh_node_map_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(nsh_md2_ioam_encap_transit_error_strings),
+  .error_strings = nsh_md2_ioam_encap_transit_error_strings,
+
+  .n_next_nodes = NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_N_NEXT,
+
+  .next_nodes = {
+        [NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_NEXT_OUTPUT] = "interface-output",
+        [NSH_MD2_IOAM_ENCAP_TRANSIT_IOAM_NEXT_DROP] = "error-drop",
+  },
+
 };
 /* *INDENT-ON* */
 
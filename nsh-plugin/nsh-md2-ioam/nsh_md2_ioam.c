@@ -49,14 +49,16 @@ nsh_md2_ioam_set_clear_output_feature_on_intf (vlib_main_t * vm,
 						    u32 sw_if_index0,
 						    u8 is_add)
 {
-
-
-
   vnet_feature_enable_disable ("ip4-output",
 			       "nsh-md2-ioam-encap-transit",
 			       sw_if_index0, is_add,
 			       0 /* void *feature_config */ ,
 			       0 /* u32 n_feature_config_bytes */ );
+  vnet_feature_enable_disable ("ip6-output",
+			       "nsh-md2-ioam-encap-transit6",
+			       sw_if_index0, is_add,
+			       0 /* void *feature_config */ ,
+			       0 /* u32 n_feature_config_bytes */ );
   return;
 }
 
@@ -79,6 +81,26 @@ nsh_md2_ioam_clear_output_feature_on_all_intfs (vlib_main_t * vm)
 extern fib_forward_chain_type_t
 fib_entry_get_default_chain_type (const fib_entry_t * fib_entry);
 
+/*
+ * Let go of the FIB entry of a destination, both the child link and the
+ * RR source added with it, before the destination goes back to the pool.
+ */
+static void
+nsh_md2_ioam_dest_tunnel_free (nsh_md2_ioam_main_t * hm,
+			       nsh_md2_ioam_dest_tunnels_t * t1)
+{
+  fib_prefix_t tun_dst_pfx = {
+    .fp_proto = t1->fp_proto,
+    .fp_len = (t1->fp_proto == FIB_PROTOCOL_IP4) ? 32 : 128,
+    .fp_addr = t1->dst_addr,
+  };
+
+  fib_entry_child_remove (t1->fib_entry_index, t1->sibling_index);
+  fib_table_entry_special_remove (t1->outer_fib_index, &tun_dst_pfx,
+				  FIB_SOURCE_RR);
+  pool_put (hm->dst_tunnels, t1);
+}
+
 int
 nsh_md2_ioam_enable_disable_for_dest (vlib_main_t * vm,
 					   ip46_address_t dst_addr,
@@ -86,10 +108,8 @@ nsh_md2_ioam_enable_disable_for_dest (vlib_main_t * vm,
 					   u8 is_ipv4, u8 is_add)
 {
   nsh_md2_ioam_main_t *hm = &nsh_md2_ioam_main;
-  u32 fib_index0 = 0;
-
   fib_node_index_t fei = ~0;
-  u32 *sw_if_index0 = NULL;
+  u32 sw_if_index0;
 #if 0
   fib_entry_t *fib_entry;
   u32 adj_index0;
@@ -98,27 +118,28 @@ nsh_md2_ioam_enable_disable_for_dest (vlib_main_t * vm,
   const dpo_id_t *dpo0, *dpo1;
   u32 i, j, k;
 #endif
-  u32 *intf_list = NULL;
   fib_prefix_t fib_prefix;
+  char *arc_name, *node_name;
 
+  memset (&fib_prefix, 0, sizeof (fib_prefix_t));
+  fib_prefix.fp_addr = dst_addr;
   if (is_ipv4)
     {
-      memset (&fib_prefix, 0, sizeof (fib_prefix_t));
       fib_prefix.fp_len = 32;
       fib_prefix.fp_proto = FIB_PROTOCOL_IP4;
-#define  TRANSIT_UNIT_TEST_HACK 1
-#ifdef TRANSIT_UNIT_TEST_HACK
-      memset(&dst_addr, 0, sizeof(dst_addr));
-      dst_addr.ip4.as_u32 = clib_net_to_host_u32(0x14020102);
-#endif
-      fib_prefix.fp_addr = dst_addr;
+      arc_name = "ip4-output";
+      node_name = "nsh-md2-ioam-encap-transit";
     }
   else
     {
-      return 0;
+      fib_prefix.fp_len = 128;
+      fib_prefix.fp_proto = FIB_PROTOCOL_IP6;
+      arc_name = "ip6-output";
+      node_name = "nsh-md2-ioam-encap-transit6";
     }
 
-  fei = fib_table_lookup (fib_index0, &fib_prefix);
+  /* Resolve the tunnel destination in the outer table to its egress */
+  fei = fib_table_lookup (outer_fib_index, &fib_prefix);
 #if 0
   fib_entry = fib_entry_get (fei);
 
@@ -200,26 +221,26 @@ nsh_md2_ioam_enable_disable_for_dest (vlib_main_t * vm,
     }
 #else
 
-u32 fib_path_get_resolving_interface (fib_node_index_t path_index);
-    vec_add1(intf_list, fib_path_get_resolving_interface(fei));
-    vec_foreach(sw_if_index0, intf_list)
-    if (is_add)
-      {
-        vnet_feature_enable_disable ("ip4-output",
-                         "nsh-md2-ioam-encap-transit",
-                         *sw_if_index0, is_add, 0,
-                         /* void *feature_config */
-                         0    /* u32 n_feature_config_bytes */
-          );
-
-        vec_validate_init_empty (hm->bool_ref_by_sw_if_index,
-                         *sw_if_index0, ~0);
-        hm->bool_ref_by_sw_if_index[*sw_if_index0] = 1;
-      }
-    else
-      {
-        hm->bool_ref_by_sw_if_index[*sw_if_index0] = ~0;
-      }
+  sw_if_index0 = fib_entry_get_resolving_interface (fei);
+  if (~0 != sw_if_index0)
+    {
+      if (is_add)
+	{
+	  vnet_feature_enable_disable (arc_name, node_name,
+				       sw_if_index0, is_add, 0,
+				       /* void *feature_config */
+				       0	/* u32 n_feature_config_bytes */
+	    );
+
+	  vec_validate_init_empty (hm->bool_ref_by_sw_if_index,
+				   sw_if_index0, ~0);
+	  hm->bool_ref_by_sw_if_index[sw_if_index0] = 1;
+	}
+      else if (sw_if_index0 < vec_len (hm->bool_ref_by_sw_if_index))
+	{
+	  hm->bool_ref_by_sw_if_index[sw_if_index0] = ~0;
+	}
+    }
 
 #endif
 
@@ -227,12 +248,9 @@ u32 fib_path_get_resolving_interface (fib_node_index_t path_index);
     {
       uword *t = NULL;
       nsh_md2_ioam_dest_tunnels_t *t1;
-      fib_prefix_t key4, *key4_copy;
-      hash_pair_t *hp;
-      memset (&key4, 0, sizeof (key4));
-      key4.fp_proto = FIB_PROTOCOL_IP4;
-      key4.fp_addr.ip4.as_u32 = fib_prefix.fp_addr.ip4.as_u32;
-      t = hash_get_mem (hm->dst_by_ip4, &key4);
+      u32 key4 = fib_prefix.fp_addr.ip4.as_u32;
+
+      t = hash_get (hm->dst_by_ip4, key4);
       if (is_add)
 	{
 	  if (t)
@@ -243,10 +261,7 @@ u32 fib_path_get_resolving_interface (fib_node_index_t path_index);
 	  memset (t1, 0, sizeof (*t1));
 	  t1->fp_proto = FIB_PROTOCOL_IP4;
 	  t1->dst_addr.ip4.as_u32 = fib_prefix.fp_addr.ip4.as_u32;
-	  key4_copy = clib_mem_alloc (sizeof (*key4_copy));
-          memset(key4_copy, 0, sizeof(*key4_copy));
-	  clib_memcpy (key4_copy, &key4, sizeof (*key4_copy));
-	  hash_set_mem (hm->dst_by_ip4, key4_copy, t1 - hm->dst_tunnels);
+	  hash_set (hm->dst_by_ip4, key4, t1 - hm->dst_tunnels);
 	  /*
 	   * Attach to the FIB entry for the VxLAN-GPE destination
 	   * and become its child. The dest route will invoke a callback
@@ -278,16 +293,62 @@ u32 fib_path_get_resolving_interface (fib_node_index_t path_index);
 	      return 0;
 	    }
 	  t1 = pool_elt_at_index (hm->dst_tunnels, t[0]);
-	  hp = hash_get_pair (hm->dst_by_ip4, &key4);
-	  key4_copy = (void *) (hp->key);
-	  hash_unset_mem (hm->dst_by_ip4, &key4);
-	  clib_mem_free (key4_copy);
-	  pool_put (hm->dst_tunnels, t1);
+	  hash_unset (hm->dst_by_ip4, key4);
+	  nsh_md2_ioam_dest_tunnel_free (hm, t1);
 	}
     }
   else
     {
-      // TBD for IPv6
+      uword *t = NULL;
+      nsh_md2_ioam_dest_tunnels_t *t1;
+      ip6_address_t *key6_copy;
+      hash_pair_t *hp;
+
+      t = hash_get_mem (hm->dst_by_ip6, &fib_prefix.fp_addr.ip6);
+      if (is_add)
+	{
+	  if (t)
+	    {
+	      return 0;
+	    }
+	  pool_get_aligned (hm->dst_tunnels, t1, CLIB_CACHE_LINE_BYTES);
+	  memset (t1, 0, sizeof (*t1));
+	  t1->fp_proto = FIB_PROTOCOL_IP6;
+	  t1->dst_addr.ip6 = fib_prefix.fp_addr.ip6;
+	  key6_copy = clib_mem_alloc (sizeof (*key6_copy));
+	  clib_memcpy (key6_copy, &fib_prefix.fp_addr.ip6,
+		       sizeof (*key6_copy));
+	  hash_set_mem (hm->dst_by_ip6, key6_copy, t1 - hm->dst_tunnels);
+
+	  const fib_prefix_t tun_dst_pfx = {
+	    .fp_len = 128,
+	    .fp_proto = FIB_PROTOCOL_IP6,
+	    .fp_addr = {.ip6 = t1->dst_addr.ip6,}
+	  };
+
+	  t1->fib_entry_index =
+	    fib_table_entry_special_add (outer_fib_index,
+					 &tun_dst_pfx,
+					 FIB_SOURCE_RR,
+					 FIB_ENTRY_FLAG_NONE);
+	  t1->sibling_index =
+	    fib_entry_child_add (t1->fib_entry_index,
+				 hm->fib_entry_type, t1 - hm->dst_tunnels);
+	  t1->outer_fib_index = outer_fib_index;
+	}
+      else
+	{
+	  if (!t)
+	    {
+	      return 0;
+	    }
+	  t1 = pool_elt_at_index (hm->dst_tunnels, t[0]);
+	  hp = hash_get_pair (hm->dst_by_ip6, &fib_prefix.fp_addr.ip6);
+	  key6_copy = (void *) (hp->key);
+	  hash_unset_mem (hm->dst_by_ip6, &fib_prefix.fp_addr.ip6);
+	  clib_mem_free (key6_copy);
+	  nsh_md2_ioam_dest_tunnel_free (hm, t1);
+	}
     }
 
   return 0;
@@ -364,6 +425,16 @@ nsh_md2_ioam_enable_disable (int has_trace_option, int has_pot_option,
       nsh_md2_ioam_trace_profile_cleanup ();
     }
 
+  if (hm->has_pot_option)
+    {
+      if (nsh_md2_ioam_pot_profile_setup () < 0)
+	return clib_error_return (0, "no valid pot profile configured");
+    }
+  else
+    {
+      nsh_md2_ioam_pot_profile_cleanup ();
+    }
+
   return 0;
 }
 
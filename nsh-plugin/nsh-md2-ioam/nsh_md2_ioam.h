@@ -81,7 +81,9 @@ typedef struct nsh_md2_ioam_main_
 
   /* hash ip4/ip6 -> list of destinations for doing transit iOAM operation */
   nsh_md2_ioam_dest_tunnels_t *dst_tunnels;
+  /* keyed by the network order u32 address, one word hash per packet */
   uword *dst_by_ip4;
+  /* keyed by ip6_address_t */
   uword *dst_by_ip6;
 
   /** per sw_if_index, to maintain bitmap */
@@ -112,6 +114,10 @@ clib_error_t *nsh_md2_ioam_enable_disable (int has_trace_option,
 int nsh_md2_ioam_trace_profile_setup (void);
 
 int nsh_md2_ioam_trace_profile_cleanup (void);
+
+int nsh_md2_ioam_pot_profile_setup (void);
+
+int nsh_md2_ioam_pot_profile_cleanup (void);
 extern void nsh_md2_ioam_interface_init (void);
 
 
@@ -54,6 +54,7 @@
 #endif
 
 u8 *nsh_trace_main = NULL;
+u8 *nsh_pot_main = NULL;
 static clib_error_t *
 nsh_md2_ioam_init (vlib_main_t * vm)
 {
@@ -66,10 +67,13 @@ nsh_md2_ioam_init (vlib_main_t * vm)
   if (!nsh_trace_main)
     return error;
 
+  nsh_pot_main =
+    (u8 *) vlib_get_plugin_symbol ("ioam_plugin.so", "pot_main");
+
   vec_new (nsh_md2_ioam_sw_interface_t, pool_elts (sm->sw_interfaces));
-  sm->dst_by_ip4 = hash_create_mem (0, sizeof (fib_prefix_t), sizeof (uword));
+  sm->dst_by_ip4 = hash_create (0, sizeof (uword));
 
-  sm->dst_by_ip6 = hash_create_mem (0, sizeof (fib_prefix_t), sizeof (uword));
+  sm->dst_by_ip6 = hash_create_mem (0, sizeof (ip6_address_t), sizeof (uword));
 
   nsh_md2_ioam_interface_init ();
 
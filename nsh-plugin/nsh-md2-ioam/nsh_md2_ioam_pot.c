@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vppinfra/error.h>
+#include <vppinfra/random.h>
+
+#include <ioam/lib-pot/pot_util.h>
+#include <nsh-md2-ioam/nsh_md2_ioam.h>
+#include <nsh/nsh_packet.h>
+
+/* *INDENT-OFF* */
+typedef CLIB_PACKED(struct {
+  u16 class;
+  u8 type;
+  u8 length;
+  u8 pot_type;
+#define PROFILE_ID_MASK 0xF
+  u8 reserved_profile_id; /* 4 bits reserved, 4 bits to carry profile id */
+  u16 reserved;
+  u64 random;
+  u64 cumulative;
+}) nsh_md2_ioam_pot_option_t;
+/* *INDENT-ON* */
+
+#define foreach_nsh_md2_ioam_pot_stats				\
+  _(PROCESSED, "Pkts with POT option processed")		\
+  _(PROFILE_MISS, "Pkts with POT option but no profile set")	\
+  _(PASSED, "Pkts with POT option and validation passed")	\
+  _(FAILED, "Pkts with POT option and validation failed")
+
+static char *nsh_md2_ioam_pot_stats_strings[] = {
+#define _(sym,string) string,
+  foreach_nsh_md2_ioam_pot_stats
+#undef _
+};
+
+typedef enum
+{
+#define _(sym,str) NSH_MD2_IOAM_POT_##sym,
+  foreach_nsh_md2_ioam_pot_stats
+#undef _
+    NSH_MD2_IOAM_POT_N_STATS,
+} nsh_md2_ioam_pot_stats_t;
+
+/** Note:
+ * A node adds lpc * (poly_pre_eval + secret_share * random) to the
+ * cumulative. Both products with a per-profile operand are folded into
+ * constants when the profile is (re)loaded, so the data plane does a
+ * single modular multiply and two modular adds per packet. The multiply
+ * is a Montgomery reduction: random_mul is kept times 2^64 mod prime, so
+ * reducing random * random_mul gives the plain product, with two 64x64
+ * multiplies and no division.
+ */
+typedef struct
+{
+  u8 valid;
+  u8 validator;
+  u8 profile_id;
+  u64 prime;
+  u64 bit_mask;
+  u64 secret_key;
+  /* lpc * poly_pre_eval mod prime */
+  u64 pre_split_const;
+  /* lpc * secret_share * 2^64 mod prime, in Montgomery form */
+  u64 random_mul;
+  /* prime^-1 mod 2^64 */
+  u64 prime_inv;
+} nsh_md2_ioam_pot_profile_t;
+
+typedef struct
+{
+  /* one per thread, so workers never share a seed */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u32 seed;
+} nsh_md2_ioam_pot_per_thread_t;
+
+typedef struct
+{
+  nsh_md2_ioam_pot_profile_t profile;
+  nsh_md2_ioam_pot_per_thread_t *per_thread;
+
+  /* stats */
+  u64 counters[ARRAY_LEN (nsh_md2_ioam_pot_stats_strings)];
+
+  /* convenience */
+  vlib_main_t *vlib_main;
+  vnet_main_t *vnet_main;
+} nsh_md2_ioam_pot_main_t;
+
+nsh_md2_ioam_pot_main_t nsh_md2_ioam_pot_main;
+
+/*
+ * Find the active pot profile
+ */
+
+extern u8 *nsh_pot_main;
+always_inline pot_profile *
+nsh_pot_profile_find (void)
+{
+  pot_main_t *sm = (pot_main_t *) nsh_pot_main;
+
+  if (PREDICT_FALSE (!sm))
+    return NULL;
+
+  return (&(sm->profile_list[sm->active_profile_id]));
+}
+
+always_inline void
+nsh_md2_ioam_pot_stats_increment_counter (u32 counter_index, u64 increment)
+{
+  nsh_md2_ioam_pot_main_t *hm = &nsh_md2_ioam_pot_main;
+
+  hm->counters[counter_index] += increment;
+}
+
+/*
+ * a * b mod p, with a 128 bit division. Only used to derive the profile
+ * constants, the data plane goes through nsh_md2_ioam_pot_mont_mul.
+ */
+always_inline u64
+nsh_md2_ioam_pot_mul_mod (u64 a, u64 b, u64 p)
+{
+  return (u64) (((unsigned __int128) a * b) % p);
+}
+
+/*
+ * a * b * 2^-64 mod p for a, b < p and p odd. With m = t * p^-1 mod 2^64
+ * the low halves of t and m * p are equal, so (t - m * p) / 2^64 is the
+ * difference of the high halves, within (-p, p).
+ */
+always_inline u64
+nsh_md2_ioam_pot_mont_mul (u64 a, u64 b, u64 p, u64 p_inv)
+{
+  unsigned __int128 t = (unsigned __int128) a * b;
+  u64 m = (u64) t * p_inv;
+  u64 t_hi = (u64) (t >> 64);
+  u64 mp_hi = (u64) (((unsigned __int128) m * p) >> 64);
+
+  return (t_hi >= mp_hi) ? t_hi - mp_hi : t_hi - mp_hi + p;
+}
+
+/* p^-1 mod 2^64 for odd p, by Newton iteration from 3 good bits */
+static u64
+nsh_md2_ioam_pot_inverse (u64 p)
+{
+  u64 x = p;
+  int i;
+
+  for (i = 0; i < 5; i++)
+    x *= 2 - p * x;
+
+  return x;
+}
+
+always_inline u64
+nsh_md2_ioam_pot_add_mod (u64 a, u64 b, u64 p)
+{
+  u64 r = a + b;
+
+  /* a + b may wrap past 2^64, the wrapped value is then r - p too */
+  return (r < a || r >= p) ? r - p : r;
+}
+
+always_inline u64
+nsh_md2_ioam_pot_update_cumulative (nsh_md2_ioam_pot_profile_t * pp,
+				    u64 cumulative, u64 random)
+{
+  u64 share;
+
+  share = nsh_md2_ioam_pot_mont_mul (random, pp->random_mul, pp->prime,
+				     pp->prime_inv);
+  share = nsh_md2_ioam_pot_add_mod (share, pp->pre_split_const, pp->prime);
+
+  return nsh_md2_ioam_pot_add_mod (cumulative, share, pp->prime);
+}
+
+always_inline u64
+nsh_md2_ioam_pot_generate_random (nsh_md2_ioam_pot_profile_t * pp)
+{
+  nsh_md2_ioam_pot_main_t *hm = &nsh_md2_ioam_pot_main;
+  nsh_md2_ioam_pot_per_thread_t *pt =
+    vec_elt_at_index (hm->per_thread, vlib_get_thread_index ());
+  u64 random;
+
+  random = ((u64) random_u32 (&pt->seed) << 32) | random_u32 (&pt->seed);
+  random &= pp->bit_mask;
+  if (random >= pp->prime)
+    random -= pp->prime;
+
+  return random;
+}
+
+/*
+ * Snapshot the active profile of the ioam plugin and derive the
+ * per-profile constants. Called whenever POT is (re)enabled.
+ */
+int
+nsh_md2_ioam_pot_profile_setup (void)
+{
+  nsh_md2_ioam_pot_profile_t *pp = &nsh_md2_ioam_pot_main.profile;
+  nsh_main_t *hm = &nsh_main;
+  pot_profile *profile = NULL;
+
+  profile = nsh_pot_profile_find ();
+
+  /* Montgomery reduction needs an odd modulus, which any prime but 2 is */
+  if (PREDICT_FALSE (!profile || !profile->valid || !(profile->prime & 1)))
+    {
+      pp->valid = 0;
+      return (-1);
+    }
+
+  pp->profile_id = profile->id;
+  pp->validator = profile->validator;
+  pp->prime = profile->prime;
+  pp->bit_mask = profile->bit_mask;
+  pp->secret_key = profile->secret_key;
+  pp->pre_split_const =
+    nsh_md2_ioam_pot_mul_mod (profile->lpc, profile->poly_pre_eval,
+			      pp->prime);
+  pp->random_mul =
+    nsh_md2_ioam_pot_mul_mod (profile->lpc, profile->secret_share,
+			      pp->prime);
+  pp->random_mul = (u64) (((unsigned __int128) pp->random_mul << 64)
+			  % pp->prime);
+  pp->prime_inv = nsh_md2_ioam_pot_inverse (pp->prime);
+  pp->valid = 1;
+
+  hm->options_size[NSH_MD2_IOAM_OPTION_TYPE_PROOF_OF_TRANSIT] =
+    sizeof (nsh_md2_ioam_pot_option_t);
+
+  return (0);
+}
+
+int
+nsh_md2_ioam_pot_profile_cleanup (void)
+{
+  nsh_main_t *hm = &nsh_main;
+
+  nsh_md2_ioam_pot_main.profile.valid = 0;
+  hm->options_size[NSH_MD2_IOAM_OPTION_TYPE_PROOF_OF_TRANSIT] = 0;
+
+  return 0;
+}
+
+int
+nsh_md2_ioam_pot_rewrite_handler (u8 * rewrite_string, u8 * rewrite_size)
+{
+  nsh_md2_ioam_pot_profile_t *pp = &nsh_md2_ioam_pot_main.profile;
+  nsh_md2_ioam_pot_option_t *pot_option;
+
+  if (PREDICT_FALSE (!rewrite_string))
+    return -1;
+
+  if (PREDICT_FALSE (!pp->valid) && nsh_md2_ioam_pot_profile_setup () < 0)
+    return -1;
+
+  pot_option = (nsh_md2_ioam_pot_option_t *) rewrite_string;
+  memset (pot_option, 0, sizeof (*pot_option));
+  pot_option->class = clib_host_to_net_u16 (NSH_MD2_IOAM_CLASS);
+  pot_option->type = NSH_MD2_IOAM_OPTION_TYPE_PROOF_OF_TRANSIT;
+  pot_option->length =
+    sizeof (nsh_md2_ioam_pot_option_t) - sizeof (nsh_tlv_header_t);
+  pot_option->reserved_profile_id = pp->profile_id & PROFILE_ID_MASK;
+
+  *rewrite_size = sizeof (nsh_md2_ioam_pot_option_t);
+
+  return 0;
+}
+
+/* Encap: pick the random for this packet and add our share */
+int
+nsh_md2_ioam_pot_encap_handler (vlib_buffer_t * b, nsh_tlv_header_t * opt)
+{
+  nsh_md2_ioam_pot_profile_t *pp = &nsh_md2_ioam_pot_main.profile;
+  nsh_md2_ioam_pot_option_t *pot0 = (nsh_md2_ioam_pot_option_t *) opt;
+  u64 random, cumulative;
+
+  if (PREDICT_FALSE (!pp->valid))
+    {
+      nsh_md2_ioam_pot_stats_increment_counter
+	(NSH_MD2_IOAM_POT_PROFILE_MISS, 1);
+      return (-1);
+    }
+
+  random = nsh_md2_ioam_pot_generate_random (pp);
+  cumulative = nsh_md2_ioam_pot_update_cumulative (pp, 0, random);
+  pot0->random = clib_host_to_net_u64 (random);
+  pot0->cumulative = clib_host_to_net_u64 (cumulative);
+
+  nsh_md2_ioam_pot_stats_increment_counter (NSH_MD2_IOAM_POT_PROCESSED, 1);
+  return (0);
+}
+
+always_inline int
+nsh_md2_ioam_pot_transit (nsh_md2_ioam_pot_option_t * pot0)
+{
+  nsh_md2_ioam_pot_profile_t *pp = &nsh_md2_ioam_pot_main.profile;
+  u64 random, cumulative;
+
+  if (PREDICT_FALSE (!pp->valid))
+    {
+      nsh_md2_ioam_pot_stats_increment_counter
+	(NSH_MD2_IOAM_POT_PROFILE_MISS, 1);
+      return (-1);
+    }
+
+  random = clib_net_to_host_u64 (pot0->random);
+  cumulative = clib_net_to_host_u64 (pot0->cumulative);
+  cumulative = nsh_md2_ioam_pot_update_cumulative (pp, cumulative, random);
+  pot0->cumulative = clib_host_to_net_u64 (cumulative);
+
+  nsh_md2_ioam_pot_stats_increment_counter (NSH_MD2_IOAM_POT_PROCESSED, 1);
+  return (0);
+}
+
+int
+nsh_md2_ioam_pot_swap_handler (vlib_buffer_t * b,
+			       nsh_tlv_header_t * old_opt,
+			       nsh_tlv_header_t * new_opt)
+{
+  clib_memcpy (new_opt, old_opt, sizeof (nsh_md2_ioam_pot_option_t));
+  return nsh_md2_ioam_pot_transit ((nsh_md2_ioam_pot_option_t *) new_opt);
+}
+
+/*
+ * Decap: add our share and, on the validator, check the cumulative.
+ * A failed check is counted rather than dropped, as for ip6 hop-by-hop
+ * POT, so verification can be rolled out without affecting traffic.
+ */
+int
+nsh_md2_ioam_pot_pop_handler (vlib_buffer_t * b, nsh_tlv_header_t * opt)
+{
+  nsh_md2_ioam_pot_profile_t *pp = &nsh_md2_ioam_pot_main.profile;
+  nsh_md2_ioam_pot_option_t *pot0 = (nsh_md2_ioam_pot_option_t *) opt;
+  u64 random, cumulative;
+
+  /* Counted as a profile miss, the packet is still decapped */
+  if (nsh_md2_ioam_pot_transit (pot0) < 0)
+    return (0);
+
+  if (pp->validator)
+    {
+      random = clib_net_to_host_u64 (pot0->random);
+      cumulative = clib_net_to_host_u64 (pot0->cumulative);
+      if (nsh_md2_ioam_pot_add_mod (cumulative, random, pp->prime)
+	  == pp->secret_key)
+	nsh_md2_ioam_pot_stats_increment_counter (NSH_MD2_IOAM_POT_PASSED,
+						  1);
+      else
+	nsh_md2_ioam_pot_stats_increment_counter (NSH_MD2_IOAM_POT_FAILED,
+						  1);
+    }
+
+  return (0);
+}
+
+u8 *
+nsh_md2_ioam_pot_trace_handler (u8 * s, nsh_tlv_header_t * opt)
+{
+  nsh_md2_ioam_pot_option_t *pot0 = (nsh_md2_ioam_pot_option_t *) opt;
+
+  s = format (s, "  POT opt present\n");
+  s = format (s, "         random = 0x%Lx, Cumulative = 0x%Lx, Index = 0x%x\n",
+	      clib_net_to_host_u64 (pot0->random),
+	      clib_net_to_host_u64 (pot0->cumulative),
+	      pot0->reserved_profile_id & PROFILE_ID_MASK);
+  return (s);
+}
+
+static clib_error_t *
+nsh_md2_ioam_show_ioam_pot_cmd_fn (vlib_main_t * vm,
+				   unformat_input_t * input,
+				   vlib_cli_command_t * cmd)
+{
+  nsh_md2_ioam_pot_main_t *hm = &nsh_md2_ioam_pot_main;
+  u8 *s = 0;
+  int i = 0;
+
+  for (i = 0; i < NSH_MD2_IOAM_POT_N_STATS; i++)
+    {
+      s = format (s, " %s - %lu\n", nsh_md2_ioam_pot_stats_strings[i],
+		  hm->counters[i]);
+    }
+
+  vlib_cli_output (vm, "%v", s);
+  vec_free (s);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (nsh_md2_ioam_show_ioam_pot_cmd, static) = {
+  .path = "show ioam nsh-lisp-gpe pot",
+  .short_help = "iOAM pot statistics",
+  .function = nsh_md2_ioam_show_ioam_pot_cmd_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+nsh_md2_ioam_pot_init (vlib_main_t * vm)
+{
+  nsh_md2_ioam_pot_main_t *hm = &nsh_md2_ioam_pot_main;
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  nsh_md2_ioam_pot_per_thread_t *pt;
+  clib_error_t *error;
+
+  if ((error = vlib_call_init_function (vm, nsh_init)))
+    return (error);
+
+  if ((error = vlib_call_init_function (vm, nsh_md2_ioam_init)))
+    return (error);
+
+  hm->vlib_main = vm;
+  hm->vnet_main = vnet_get_main ();
+
+  memset (hm->counters, 0, sizeof (hm->counters));
+
+  vec_validate_aligned (hm->per_thread, tm->n_vlib_mains - 1,
+			CLIB_CACHE_LINE_BYTES);
+  vec_foreach (pt, hm->per_thread)
+    pt->seed = (u32) clib_cpu_time_now () ^ (pt - hm->per_thread);
+
+  if (nsh_md2_register_option
+      (clib_host_to_net_u16 (NSH_MD2_IOAM_CLASS),
+       NSH_MD2_IOAM_OPTION_TYPE_PROOF_OF_TRANSIT,
+       sizeof (nsh_md2_ioam_pot_option_t),
+       nsh_md2_ioam_pot_rewrite_handler,
+       nsh_md2_ioam_pot_encap_handler,
+       nsh_md2_ioam_pot_swap_handler,
+       nsh_md2_ioam_pot_pop_handler,
+       nsh_md2_ioam_pot_trace_handler) < 0)
+    return (clib_error_create
+	    ("registration of NSH_MD2_IOAM_OPTION_TYPE_PROOF_OF_TRANSIT failed"));
+
+  return (0);
+}
+
+VLIB_INIT_FUNCTION (nsh_md2_ioam_pot_init);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -70,11 +70,30 @@ typedef enum
 } nsh_md2_ioam_trace_stats_t;
 
 
+/*
+ * Trace timestamps at every supported precision, filled once per node
+ * dispatch from the dispatch TSC reading and reused by every packet of
+ * the frame.
+ */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u64 cpu_time;			/* vm->cpu_time_last_node_dispatch */
+  u32 ts[ARRAY_LEN (trace_tsp_mul)];
+} nsh_md2_ioam_trace_ts_cache_t;
+
 typedef struct
 {
   /* stats */
   u64 counters[ARRAY_LEN (nsh_md2_ioam_trace_stats_strings)];
 
+  /* per-thread timestamp cache */
+  nsh_md2_ioam_trace_ts_cache_t *ts_cache;
+
+  /* TSC reading and clock rate taken with nsh_md2_ioam_main.unix_time_0 */
+  u64 cpu_time_0;
+  f64 seconds_per_clock;
+
   /* convenience */
   vlib_main_t *vlib_main;
   vnet_main_t *vnet_main;
@@ -106,6 +125,34 @@ nsh_md2_ioam_trace_stats_increment_counter (u32 counter_index,
 }
 
 
+/* Timestamp of the current dispatch in the given precision, low 32 bits */
+always_inline u32
+nsh_md2_ioam_trace_timestamp (u8 trace_tsp)
+{
+  nsh_md2_ioam_trace_main_t *tm = &nsh_md2_ioam_trace_main;
+  nsh_md2_ioam_main_t *hm = &nsh_md2_ioam_main;
+  vlib_main_t *vm = vlib_get_main ();
+  nsh_md2_ioam_trace_ts_cache_t *tc =
+    vec_elt_at_index (tm->ts_cache, vlib_get_thread_index ());
+  time_u64_t time_u64;
+  f64 time_f64;
+  int i;
+
+  if (PREDICT_FALSE (tc->cpu_time != vm->cpu_time_last_node_dispatch))
+    {
+      tc->cpu_time = vm->cpu_time_last_node_dispatch;
+      time_f64 = (f64) hm->unix_time_0 +
+	(f64) (tc->cpu_time - tm->cpu_time_0) * tm->seconds_per_clock;
+      for (i = 0; i < ARRAY_LEN (trace_tsp_mul); i++)
+	{
+	  time_u64.as_u64 = time_f64 * trace_tsp_mul[i];
+	  tc->ts[i] = time_u64.as_u32[0];
+	}
+    }
+
+  return tc->ts[trace_tsp];
+}
+
 static u8 *
 format_ioam_data_list_element (u8 * s, va_list * args)
 {
@@ -197,12 +244,9 @@ nsh_md2_ioam_trace_data_list_handler (vlib_buffer_t * b,
   u8 elt_index = 0;
   nsh_md2_ioam_trace_option_t *trace =
     (nsh_md2_ioam_trace_option_t *) ((u8 *)opt);
-  time_u64_t time_u64;
   u32 *elt;
   int rv = 0;
   trace_profile *profile = NULL;
-  nsh_md2_ioam_main_t *hm = &nsh_md2_ioam_main;
-  nsh_main_t *gm = &nsh_main;
   u16 ioam_trace_type = 0;
 
   profile = nsh_trace_profile_find ();
@@ -214,7 +258,6 @@ nsh_md2_ioam_trace_data_list_handler (vlib_buffer_t * b,
 
 
   ioam_trace_type = profile->trace_type & TRACE_TYPE_MASK;
-  time_u64.as_u64 = 0;
 
   if (PREDICT_TRUE (trace->data_list_elts_left))
     {
@@ -229,7 +272,11 @@ nsh_md2_ioam_trace_data_list_handler (vlib_buffer_t * b,
 	  if (ioam_trace_type & BIT_TTL_NODEID)
 	    {
 	      ip4_header_t *ip0 = vlib_buffer_get_current (b);
-	      *elt = clib_host_to_net_u32 (((ip0->ttl - 1) << 24) |
+	      u8 ttl0 = ip0->ttl;
+
+	      if ((ip0->ip_version_and_header_length & 0xF0) == 0x60)
+		ttl0 = ((ip6_header_t *) ip0)->hop_limit;
+	      *elt = clib_host_to_net_u32 (((ttl0 - 1) << 24) |
 					   profile->node_id);
 	      elt++;
 	    }
@@ -249,12 +296,8 @@ nsh_md2_ioam_trace_data_list_handler (vlib_buffer_t * b,
       if (ioam_trace_type & BIT_TIMESTAMP)
 	{
 	  /* Send least significant 32 bits */
-	  f64 time_f64 =
-	    (f64) (((f64) hm->unix_time_0) +
-		   (vlib_time_now (gm->vlib_main) - hm->vlib_time_0));
-
-	  time_u64.as_u64 = time_f64 * trace_tsp_mul[profile->trace_tsp];
-	  *elt = clib_host_to_net_u32 (time_u64.as_u32[0]);
+	  *elt = clib_host_to_net_u32
+	    (nsh_md2_ioam_trace_timestamp (profile->trace_tsp));
 	  elt++;
 	}
 
@@ -371,6 +414,11 @@ nsh_md2_ioam_trace_init (vlib_main_t * vm)
   hm->vnet_main = vnet_get_main ();
   gm->unix_time_0 = (u32) time (0);     /* Store starting time */
   gm->vlib_time_0 = vlib_time_now (vm);
+  hm->cpu_time_0 = clib_cpu_time_now ();
+  hm->seconds_per_clock = vm->clib_time.seconds_per_clock;
+
+  vec_validate_aligned (hm->ts_cache, vlib_get_thread_main ()->n_vlib_mains - 1,
+			CLIB_CACHE_LINE_BYTES);
 
   memset (hm->counters, 0, sizeof (hm->counters));
 
@@ -30,34 +30,30 @@ typedef struct {
    u8 trace_data[256];
 } nsh_transit_trace_t;
 
+/*
+ * Run the registered MD2 option handlers over one NSH header.
+ * ip_length is the length the outer IP header claims to carry.
+ */
 always_inline void
-nsh_md2_ioam_encap_decap_ioam_v4_one_inline (vlib_main_t * vm,
-					  vlib_node_runtime_t * node,
-					  vlib_buffer_t * b0,
-					  u32 * next0, u32 drop_node_val,
-					  u8 use_adj)
+nsh_md2_ioam_process_options_inline (vlib_main_t * vm,
+				     vlib_node_runtime_t * node,
+				     vlib_buffer_t * b0,
+				     nsh_base_header_t * nsh_hdr,
+				     u16 ip_length,
+				     u32 * next0, u32 drop_node_val)
 {
-  ip4_header_t *ip0;
-  udp_header_t *udp_hdr0;
-  lisp_gpe_header_t *lisp_gpe_hdr0;
-  nsh_base_header_t *nsh_hdr;
   nsh_tlv_header_t *opt0;
   nsh_tlv_header_t *limit0;
   nsh_main_t *hm = &nsh_main;
   nsh_option_map_t *nsh_option;
 
-  /* Populate the iOAM header */
-  ip0 = vlib_buffer_get_current (b0);
-  udp_hdr0 = (udp_header_t *) (ip0 + 1);
-  lisp_gpe_hdr0 = (lisp_gpe_header_t *) (udp_hdr0 + 1);
-  nsh_hdr = (nsh_base_header_t *)(lisp_gpe_hdr0 + 1);
   opt0 = (nsh_tlv_header_t *) (nsh_hdr + 1);
   limit0 = (nsh_tlv_header_t *) ((u8 *) opt0 + (nsh_hdr->length *4) - sizeof(nsh_base_header_t));
 
   /*
    * Basic validity checks
    */
-  if ((nsh_hdr->length*4) > clib_net_to_host_u16 (ip0->length))
+  if ((nsh_hdr->length*4) > ip_length)
     {
       *next0 = drop_node_val;
       return;
@@ -107,6 +103,53 @@ nsh_md2_ioam_encap_decap_ioam_v4_one_inline (vlib_main_t * vm,
   return;
 }
 
+always_inline void
+nsh_md2_ioam_encap_decap_ioam_v4_one_inline (vlib_main_t * vm,
+					  vlib_node_runtime_t * node,
+					  vlib_buffer_t * b0,
+					  u32 * next0, u32 drop_node_val,
+					  u8 use_adj)
+{
+  ip4_header_t *ip0;
+  udp_header_t *udp_hdr0;
+  lisp_gpe_header_t *lisp_gpe_hdr0;
+  nsh_base_header_t *nsh_hdr;
+
+  /* Populate the iOAM header */
+  ip0 = vlib_buffer_get_current (b0);
+  udp_hdr0 = (udp_header_t *) (ip0 + 1);
+  lisp_gpe_hdr0 = (lisp_gpe_header_t *) (udp_hdr0 + 1);
+  nsh_hdr = (nsh_base_header_t *)(lisp_gpe_hdr0 + 1);
+
+  nsh_md2_ioam_process_options_inline (vm, node, b0, nsh_hdr,
+				       clib_net_to_host_u16 (ip0->length),
+				       next0, drop_node_val);
+}
+
+always_inline void
+nsh_md2_ioam_encap_decap_ioam_v6_one_inline (vlib_main_t * vm,
+					  vlib_node_runtime_t * node,
+					  vlib_buffer_t * b0,
+					  u32 * next0, u32 drop_node_val,
+					  u8 use_adj)
+{
+  ip6_header_t *ip0;
+  udp_header_t *udp_hdr0;
+  lisp_gpe_header_t *lisp_gpe_hdr0;
+  nsh_base_header_t *nsh_hdr;
+
+  /* Populate the iOAM header */
+  ip0 = vlib_buffer_get_current (b0);
+  udp_hdr0 = (udp_header_t *) (ip0 + 1);
+  lisp_gpe_hdr0 = (lisp_gpe_header_t *) (udp_hdr0 + 1);
+  nsh_hdr = (nsh_base_header_t *)(lisp_gpe_hdr0 + 1);
+
+  nsh_md2_ioam_process_options_inline (vm, node, b0, nsh_hdr,
+				       clib_net_to_host_u16
+				       (ip0->payload_length),
+				       next0, drop_node_val);
+}
+
 
 #endif
 
@@ -16,13 +16,18 @@
  */
 
 #include <vnet/vnet.h>
+#include <vlib/threads.h>
 #include <vnet/plugin/plugin.h>
 #include <nsh/nsh.h>
+#include <nsh/nsh_numa.h>
 #include <vnet/gre/gre.h>
 #include <vnet/vxlan/vxlan.h>
 #include <vnet/vxlan-gpe/vxlan_gpe.h>
 #include <vnet/l2/l2_classify.h>
 #include <vnet/adj/adj.h>
+#include <vnet/fib/fib_entry.h>
+#include <vnet/udp/udp.h>
+#include <vppinfra/xxhash.h>
 
 #include <vlibapi/api.h>
 #include <vlibmemory/api.h>
@@ -106,7 +111,18 @@
   _(NSH_ADD_DEL_ENTRY, nsh_add_del_entry)	\
   _(NSH_ENTRY_DUMP, nsh_entry_dump)             \
   _(NSH_ADD_DEL_MAP, nsh_add_del_map)           \
-  _(NSH_MAP_DUMP, nsh_map_dump)
+  _(NSH_MAP_DUMP, nsh_map_dump)                 \
+  _(NSH_ENTRY_PAGE_DUMP, nsh_entry_page_dump)   \
+  _(NSH_MAP_PAGE_DUMP, nsh_map_page_dump)       \
+  _(NSH_MAP_POLICER, nsh_map_policer)           \
+  _(NSH_SF_POOL_ADD_DEL_MEMBER, nsh_sf_pool_add_del_member) \
+  _(NSH_MAP_SF_POOL, nsh_map_sf_pool)           \
+  _(NSH_SF_POOL_SYMMETRIC, nsh_sf_pool_symmetric) \
+  _(NSH_MAP_INTERFACE, nsh_map_interface)       \
+  _(NSH_ADD_DEL_NSP_HOP, nsh_add_del_nsp_hop)   \
+  _(NSH_CLASSIFY_ADD_DEL_SESSION, nsh_classify_add_del_session) \
+  _(NSH_CLASSIFY_ENABLE_DISABLE, nsh_classify_enable_disable) \
+  _(WANT_NSH_EVENTS, want_nsh_events)
 
 /* *INDENT-OFF* */
 VLIB_PLUGIN_REGISTER () = {
@@ -334,7 +350,9 @@ static u8 * format_nsh_action (u8 * s, va_list * args)
 
 u8 * format_nsh_map (u8 * s, va_list * args)
 {
+  nsh_main_t * nm = &nsh_main;
   nsh_map_t * map = va_arg (*args, nsh_map_t *);
+  vlib_counter_t too_big;
 
   s = format (s, "nsh entry nsp: %d nsi: %d ",
               (map->nsp_nsi>>NSH_NSP_SHIFT) & NSH_NSP_MASK,
@@ -385,12 +403,38 @@ u8 * format_nsh_map (u8 * s, va_list * args)
     case NSH_NODE_NEXT_ENCAP_ETHERNET:
       {
        s = format (s, "encapped by Ethernet intf: %d", map->sw_if_index);
+       if (map->adj_index != ~0)
+         {
+           vlib_get_combined_counter (&nm->too_big_counters, map->adj_index,
+                                      &too_big);
+           s = format (s, "\n  adjacency %d mtu exceeded: %lld packets %lld bytes",
+                       map->adj_index, too_big.packets, too_big.bytes);
+         }
        break;
       }
     default:
       s = format (s, "only GRE and VXLANGPE support in this rev");
     }
 
+  if (map->policer_index != ~0)
+    s = format (s, "\n  %U", format_nsh_policer, map);
+
+  if (map->fused_rewrite)
+    s = format (s, "\n  fused vxlan-gpe encap: %d byte rewrite via %U",
+                vec_len (map->fused_rewrite), format_dpo_id,
+                &map->fused_dpo, 0);
+
+  if (map->sf_pool_index != ~0)
+    s = format (s, "\n  via %U", format_nsh_sf_pool,
+                pool_elt_at_index (nm->sf_pools, map->sf_pool_index), 0);
+
+  if (map->export_next)
+    s = format (s, "\n  iOAM export enabled");
+
+  if (map->nsh_sw_if != ~0)
+    s = format (s, "\n  interface %U", format_vnet_sw_if_index_name,
+                nm->vnet_main, map->nsh_sw_if);
+
   return s;
 }
 
@@ -486,6 +530,375 @@ VNET_HW_INTERFACE_CLASS (nsh_hw_class) = {
  * Shared by both CLI and binary API
  **/
 
+/*
+ * Maps encapsulating over ethernet are FIB children of their adjacency,
+ * so a restack of the adjacency walks back to them and is reported as
+ * an NSH_EVENT_ADJ_RESTACK. Fused VXLAN-GPE maps are children of the
+ * FIB entry of their tunnel's remote, and restack their load balance.
+ */
+static fib_node_t *
+nsh_map_fib_node_get (fib_node_index_t index)
+{
+  nsh_map_t * map = pool_elt_at_index (nsh_main.nsh_mappings, index);
+
+  return (&map->node);
+}
+
+static nsh_map_t *
+nsh_map_from_fib_node (fib_node_t * node)
+{
+  return ((nsh_map_t *) (((char *) node) -
+                         STRUCT_OFFSET_OF (nsh_map_t, node)));
+}
+
+static void
+nsh_map_fib_node_last_lock_gone (fib_node_t * node)
+{
+  /* Maps are not locked through the FIB graph, nsh_add_del_map frees them */
+}
+
+static void
+nsh_map_fused_restack (nsh_map_t * map)
+{
+  dpo_id_t dpo = DPO_INVALID;
+
+  fib_entry_contribute_forwarding (map->fused_fib_entry,
+                                   (map->fused_is_ip6 ?
+                                    FIB_FORW_CHAIN_TYPE_UNICAST_IP6 :
+                                    FIB_FORW_CHAIN_TYPE_UNICAST_IP4),
+                                   &dpo);
+  dpo_copy (&map->fused_dpo, &dpo);
+  dpo_reset (&dpo);
+}
+
+/*
+ * Workers may be reading a fused rewrite the main thread just replaced.
+ * Replaced ones are only freed once they have all been through the
+ * barrier, once per configuration change rather than once per map.
+ */
+static void
+nsh_map_fused_reclaim (void)
+{
+  nsh_main_t * nm = &nsh_main;
+  u8 ** old;
+
+  if (vec_len (nm->fused_rewrites_to_free) == 0)
+    return;
+
+  vlib_worker_thread_barrier_sync (nm->vlib_main);
+  vlib_worker_thread_barrier_release (nm->vlib_main);
+
+  vec_foreach (old, nm->fused_rewrites_to_free)
+    vec_free (old[0]);
+  vec_reset_length (nm->fused_rewrites_to_free);
+}
+
+static void
+nsh_map_fused_clear (nsh_map_t * map)
+{
+  nsh_main_t * nm = &nsh_main;
+  u8 * old = map->fused_rewrite;
+
+  map->fused_rewrite = 0;
+  CLIB_MEMORY_BARRIER ();
+
+  if (map->fused_fib_entry != FIB_NODE_INDEX_INVALID)
+    {
+      fib_entry_child_remove (map->fused_fib_entry, map->fused_sibling);
+      map->fused_fib_entry = FIB_NODE_INDEX_INVALID;
+    }
+  dpo_reset (&map->fused_dpo);
+  if (old)
+    vec_add1 (nm->fused_rewrites_to_free, old);
+}
+
+/*
+ * Build, or drop, the fused rewrite of a map: the VXLAN-GPE tunnel's
+ * outer headers and the mapped entry's NSH header back to back, so that
+ * nsh_input_map writes both in one copy and goes straight to the load
+ * balance of the tunnel's remote, without vxlan-gpe-encap and its tunnel
+ * lookup. Only MD1 entries qualify, MD2 options are written per packet.
+ */
+static void
+nsh_map_fused_update (nsh_map_t * map)
+{
+  nsh_main_t * nm = &nsh_main;
+  vxlan_gpe_main_t * gm = &vxlan_gpe_main;
+  vxlan_gpe_tunnel_t * t;
+  nsh_entry_t * nsh_entry;
+  u8 * rewrite = 0;
+  uword * entry;
+
+  nsh_map_fused_clear (map);
+
+  if (!nm->vxlan_gpe_fused
+      || map->next_node != NSH_NODE_NEXT_ENCAP_VXLANGPE
+      || map->nsh_action == NSH_ACTION_POP)
+    return;
+
+  entry = hash_get_mem (nm->nsh_entry_by_key, &map->mapped_nsp_nsi);
+  if (entry == 0)
+    return;
+
+  nsh_entry = pool_elt_at_index (nm->nsh_entries, entry[0]);
+  if (nsh_entry->nsh_base.md_type != 1)
+    return;
+
+  if (map->sw_if_index >= vec_len (gm->tunnel_index_by_sw_if_index)
+      || gm->tunnel_index_by_sw_if_index[map->sw_if_index] == ~0)
+    return;
+
+  t = pool_elt_at_index (gm->tunnels,
+                         gm->tunnel_index_by_sw_if_index[map->sw_if_index]);
+  if (t->sw_if_index != map->sw_if_index
+      || t->protocol != VXLAN_GPE_PROTOCOL_NSH
+      || t->fib_entry_index == FIB_NODE_INDEX_INVALID)
+    return;
+
+  /* a tunnel going away is brought down first */
+  if (!vnet_sw_interface_is_admin_up (nm->vnet_main, map->sw_if_index))
+    return;
+
+  vec_add (rewrite, t->rewrite, vec_len (t->rewrite));
+  vec_add (rewrite, nsh_entry->rewrite, nsh_entry->rewrite_size);
+  map->fused_outer_size = vec_len (t->rewrite);
+  map->fused_is_ip6 = !(t->flags & VXLAN_GPE_TUNNEL_IS_IPV4);
+
+  map->fused_fib_entry = t->fib_entry_index;
+  map->fused_sibling = fib_entry_child_add (t->fib_entry_index,
+                                            nm->map_fib_node_type,
+                                            map - nm->nsh_mappings);
+  nsh_map_fused_restack (map);
+
+  CLIB_MEMORY_BARRIER ();
+  map->fused_rewrite = rewrite;
+}
+
+/* Refresh the fused rewrite of the maps pushing an entry */
+static void
+nsh_entry_maps_fused_update (u32 nsp_nsi)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_map_t * map;
+
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    if (map->mapped_nsp_nsi == nsp_nsi)
+      nsh_map_fused_update (map);
+  }));
+  nsh_map_fused_reclaim ();
+}
+
+static vlib_node_registration_t nsh_map_fused_process_node;
+
+/* Refresh the fused rewrite of the maps sending to an interface */
+static void
+nsh_sw_if_maps_fused_update (u32 sw_if_index)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_map_t * map;
+
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    if (map->sw_if_index == sw_if_index
+        && map->next_node == NSH_NODE_NEXT_ENCAP_VXLANGPE)
+      nsh_map_fused_update (map);
+  }));
+  nsh_map_fused_reclaim ();
+  nsh_numa_replicas_update ();
+}
+
+/*
+ * A VXLAN-GPE tunnel that goes down, or away, takes its outer header and
+ * FIB entry with it: the maps fused onto it let go at once. One that
+ * comes up only has its FIB entry once its creation is over, so the maps
+ * are fused again from nsh-map-fused-process.
+ */
+static void
+nsh_sw_if_fused_change (u32 sw_if_index, u8 is_up)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_map_t * map;
+  u8 cleared = 0;
+
+  if (pool_elts (nm->nsh_mappings) == 0)
+    return;
+
+  if (!is_up)
+    {
+      pool_foreach (map, nm->nsh_mappings,
+      ({
+        if (map->sw_if_index == sw_if_index
+            && map->fused_fib_entry != FIB_NODE_INDEX_INVALID)
+          {
+            nsh_map_fused_clear (map);
+            cleared = 1;
+          }
+      }));
+      if (cleared)
+        {
+          nsh_map_fused_reclaim ();
+          nsh_numa_replicas_update ();
+        }
+      return;
+    }
+
+  if (vec_len (nm->fused_sw_if_pending) == 0)
+    vlib_process_signal_event (nm->vlib_main,
+                               nsh_map_fused_process_node.index, 0, 0);
+  vec_add1 (nm->fused_sw_if_pending, sw_if_index);
+}
+
+static clib_error_t *
+nsh_map_fused_sw_interface_add_del (vnet_main_t * vnm, u32 sw_if_index,
+                                    u32 is_add)
+{
+  nsh_sw_if_fused_change (sw_if_index, is_add &&
+                          vnet_sw_interface_is_admin_up (vnm, sw_if_index));
+  return 0;
+}
+
+VNET_SW_INTERFACE_ADD_DEL_FUNCTION (nsh_map_fused_sw_interface_add_del);
+
+static clib_error_t *
+nsh_map_fused_sw_interface_admin_up_down (vnet_main_t * vnm,
+                                          u32 sw_if_index, u32 flags)
+{
+  nsh_sw_if_fused_change (sw_if_index,
+                          (flags & VNET_SW_INTERFACE_FLAG_ADMIN_UP) != 0);
+  return 0;
+}
+
+VNET_SW_INTERFACE_ADMIN_UP_DOWN_FUNCTION
+  (nsh_map_fused_sw_interface_admin_up_down);
+
+static uword
+nsh_map_fused_process (vlib_main_t * vm,
+                       vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  nsh_main_t * nm = &nsh_main;
+  uword * event_data = 0;
+  u32 * pending = 0, * sw_if_index;
+
+  while (1)
+    {
+      vlib_process_wait_for_event (vm);
+      vlib_process_get_events (vm, &event_data);
+      vec_reset_length (event_data);
+
+      /* swapped out, the hooks may queue more while maps are fused */
+      pending = nm->fused_sw_if_pending;
+      nm->fused_sw_if_pending = 0;
+      vec_foreach (sw_if_index, pending)
+        nsh_sw_if_maps_fused_update (sw_if_index[0]);
+      vec_free (pending);
+    }
+
+  return 0;			/* not so much */
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (nsh_map_fused_process_node, static) =
+{
+ .function = nsh_map_fused_process,
+ .type = VLIB_NODE_TYPE_PROCESS,
+ .name = "nsh-map-fused-process",
+};
+/* *INDENT-ON* */
+
+static fib_node_back_walk_rc_t
+nsh_map_fib_node_back_walk (fib_node_t * node,
+                            fib_node_back_walk_ctx_t * ctx)
+{
+  nsh_map_t * map = nsh_map_from_fib_node (node);
+
+  if (map->fused_fib_entry != FIB_NODE_INDEX_INVALID)
+    nsh_map_fused_restack (map);
+
+  nsh_event_post (NSH_EVENT_ADJ_RESTACK, map->nsp_nsi,
+                  map - nsh_main.nsh_mappings);
+
+  return (FIB_NODE_BACK_WALK_CONTINUE);
+}
+
+static const fib_node_vft_t nsh_map_fib_node_vft = {
+  .fnv_get = nsh_map_fib_node_get,
+  .fnv_last_lock = nsh_map_fib_node_last_lock_gone,
+  .fnv_back_walk = nsh_map_fib_node_back_walk,
+};
+
+/*
+ * Give a map the nsh_tunnel interface through which nsh-aware-vnf-proxy
+ * receives its traffic, recycling a freed one when there is any.
+ */
+static void
+nsh_map_interface_create (nsh_map_t * map)
+{
+  nsh_main_t * nm = &nsh_main;
+  vnet_main_t * vnm = nm->vnet_main;
+  vnet_hw_interface_t * hi;
+  u32 map_index = map - nm->nsh_mappings;
+  u32 nsh_hw_if;
+
+  if (vec_len (nm->free_nsh_tunnel_hw_if_indices) > 0)
+    {
+      nsh_hw_if = nm->free_nsh_tunnel_hw_if_indices
+        [vec_len (nm->free_nsh_tunnel_hw_if_indices)-1];
+      _vec_len (nm->free_nsh_tunnel_hw_if_indices) -= 1;
+
+      hi = vnet_get_hw_interface (vnm, nsh_hw_if);
+      hi->dev_instance = map_index;
+      hi->hw_instance = hi->dev_instance;
+    }
+  else
+    {
+      nsh_hw_if = vnet_register_interface
+        (vnm, nsh_device_class.index, map_index, nsh_hw_class.index, map_index);
+      hi = vnet_get_hw_interface (vnm, nsh_hw_if);
+      hi->output_node_index = nsh_aware_vnf_proxy_node.index;
+    }
+
+  map->nsh_hw_if = nsh_hw_if;
+  map->nsh_sw_if = hi->sw_if_index;
+  vec_validate_init_empty (nm->tunnel_index_by_sw_if_index, map->nsh_sw_if, ~0);
+  /* net order, as nsh-aware-vnf-proxy looks the map up with it */
+  nm->tunnel_index_by_sw_if_index[map->nsh_sw_if] =
+    clib_host_to_net_u32 (map->nsp_nsi);
+
+  vnet_sw_interface_set_flags (vnm, hi->sw_if_index,
+                               VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+}
+
+/**
+ * Action function returning the nsh_tunnel interface of a map, creating
+ * it for maps added while interfaces are made on demand.
+ * Returns -2 if the mapping does not exist.
+ */
+int
+nsh_map_interface_get (u32 nsp_nsi, u32 * sw_if_indexp)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_map_t * map;
+  uword * entry;
+  u32 key;
+
+  key = clib_host_to_net_u32 (nsp_nsi);
+  entry = hash_get_mem (nm->nsh_mapping_by_key, &key);
+  if (entry == 0)
+    return -2;
+
+  map = pool_elt_at_index (nm->nsh_mappings, entry[0]);
+  if (map->nsh_sw_if == ~0)
+    {
+      nsh_map_interface_create (map);
+      nsh_event_post (NSH_EVENT_MAP_MODIFY, nsp_nsi, entry[0]);
+    }
+
+  *sw_if_indexp = map->nsh_sw_if;
+
+  return 0;
+}
+
 int nsh_add_del_map (nsh_add_del_map_args_t *a, u32 * map_indexp)
 {
   nsh_main_t * nm = &nsh_main;
@@ -494,10 +907,8 @@ int nsh_add_del_map (nsh_add_del_map_args_t *a, u32 * map_indexp)
   u32 key, *key_copy;
   uword * entry;
   hash_pair_t *hp;
-  u32 map_index = ~0;
-  vnet_hw_interface_t * hi;
-  u32 nsh_hw_if = ~0;
-  u32 nsh_sw_if = ~0;
+  u32 map_index = ~0, policer_index, sf_pool_index;
+  int i;
 
   /* net order, so data plane could use nsh header to lookup directly */
   key = clib_host_to_net_u32(a->map.nsp_nsi);
@@ -521,7 +932,31 @@ int nsh_add_del_map (nsh_add_del_map_args_t *a, u32 * map_indexp)
       map->rx_sw_if_index = a->map.rx_sw_if_index;
       map->next_node = a->map.next_node;
       map->adj_index = a->map.adj_index;
+      map->policer_index = ~0;
+      map->sf_pool_index = ~0;
+      map->fused_fib_entry = FIB_NODE_INDEX_INVALID;
+      fib_node_init (&map->node, nm->map_fib_node_type);
 
+      map_index = map - nm->nsh_mappings;
+      vlib_validate_combined_counter (&nm->path_counters, map_index);
+      vlib_zero_combined_counter (&nm->path_counters, map_index);
+      for (i = 0; i < NSH_PATH_N_DROP; i++)
+        {
+          vlib_validate_simple_counter (&nm->path_drop_counters[i],
+                                        map_index);
+          vlib_zero_simple_counter (&nm->path_drop_counters[i], map_index);
+        }
+
+      if (map->adj_index != ~0)
+        {
+          /* Counted per adjacency, shared by every map using it: new
+           * slots come zeroed, a live one keeps its counts */
+          vlib_validate_combined_counter (&nm->too_big_counters,
+                                          map->adj_index);
+          map->adj_sibling = adj_child_add (map->adj_index,
+                                            nm->map_fib_node_type,
+                                            map_index);
+        }
 
       key_copy = clib_mem_alloc (sizeof (*key_copy));
       clib_memcpy (key_copy, &key, sizeof (*key_copy));
@@ -530,31 +965,14 @@ int nsh_add_del_map (nsh_add_del_map_args_t *a, u32 * map_indexp)
                     map - nm->nsh_mappings);
       map_index = map - nm->nsh_mappings;
 
-      if (vec_len (nm->free_nsh_tunnel_hw_if_indices) > 0)
-        {
-          nsh_hw_if = nm->free_nsh_tunnel_hw_if_indices
-            [vec_len (nm->free_nsh_tunnel_hw_if_indices)-1];
-          _vec_len (nm->free_nsh_tunnel_hw_if_indices) -= 1;
-
-          hi = vnet_get_hw_interface (vnm, nsh_hw_if);
-          hi->dev_instance = map_index;
-          hi->hw_instance = hi->dev_instance;
-        }
-      else
-        {
-          nsh_hw_if = vnet_register_interface
-            (vnm, nsh_device_class.index, map_index, nsh_hw_class.index, map_index);
-          hi = vnet_get_hw_interface (vnm, nsh_hw_if);
-          hi->output_node_index = nsh_aware_vnf_proxy_node.index;
-        }
+      map->nsh_hw_if = ~0;
+      map->nsh_sw_if = ~0;
+      if (!nm->map_interface_on_demand)
+        nsh_map_interface_create (map);
 
-      map->nsh_hw_if = nsh_hw_if;
-      map->nsh_sw_if = nsh_sw_if = hi->sw_if_index;
-      vec_validate_init_empty (nm->tunnel_index_by_sw_if_index, nsh_sw_if, ~0);
-      nm->tunnel_index_by_sw_if_index[nsh_sw_if] = key;
+      nsh_map_fused_update (map);
 
-      vnet_sw_interface_set_flags (vnm, hi->sw_if_index,
-                                   VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+      nsh_event_post (NSH_EVENT_MAP_ADD, map->nsp_nsi, map_index);
     }
   else
     {
@@ -563,10 +981,34 @@ int nsh_add_del_map (nsh_add_del_map_args_t *a, u32 * map_indexp)
 
       map = pool_elt_at_index (nm->nsh_mappings, entry[0]);
 
-      vnet_sw_interface_set_flags (vnm, map->nsh_sw_if,
-				   VNET_SW_INTERFACE_FLAG_ADMIN_DOWN);
-      vec_add1 (nm->free_nsh_tunnel_hw_if_indices, map->nsh_sw_if);
-      nm->tunnel_index_by_sw_if_index[map->nsh_sw_if] = ~0;
+      if (map->policer_index != ~0)
+        {
+          policer_index = map->policer_index;
+          map->policer_index = ~0;
+          nsh_policer_free (policer_index);
+        }
+
+      if (map->sf_pool_index != ~0)
+        {
+          sf_pool_index = map->sf_pool_index;
+          map->sf_pool_index = ~0;
+          nsh_sf_pool_unlock (sf_pool_index);
+        }
+
+      nsh_map_fused_clear (map);
+
+      if (map->adj_index != ~0)
+        adj_child_remove (map->adj_index, map->adj_sibling);
+
+      nsh_event_post (NSH_EVENT_MAP_DEL, map->nsp_nsi, entry[0]);
+
+      if (map->nsh_sw_if != ~0)
+        {
+          vnet_sw_interface_set_flags (vnm, map->nsh_sw_if,
+                                       VNET_SW_INTERFACE_FLAG_ADMIN_DOWN);
+          vec_add1 (nm->free_nsh_tunnel_hw_if_indices, map->nsh_hw_if);
+          nm->tunnel_index_by_sw_if_index[map->nsh_sw_if] = ~0;
+        }
 
       hp = hash_get_pair (nm->nsh_mapping_by_key, &key);
       key_copy = (void *)(hp->key);
@@ -576,6 +1018,8 @@ int nsh_add_del_map (nsh_add_del_map_args_t *a, u32 * map_indexp)
       pool_put (nm->nsh_mappings, map);
     }
 
+  nsh_map_fused_reclaim ();
+
   if (map_indexp)
       *map_indexp = map_index;
 
@@ -626,6 +1070,9 @@ int nsh_add_del_proxy_session (nsh_add_del_map_args_t *a)
 
       hash_set_mem (nm->nsh_proxy_session_by_key, key_copy,
 		    proxy - nm->nsh_proxy_sessions);
+
+      nsh_event_post (NSH_EVENT_PROXY_ADD, a->map.nsp_nsi,
+                      proxy - nm->nsh_proxy_sessions);
     }
   else
     {
@@ -638,12 +1085,87 @@ int nsh_add_del_proxy_session (nsh_add_del_map_args_t *a)
       hash_unset_mem (nm->nsh_proxy_session_by_key, &key);
       clib_mem_free (key_copy);
 
+      nsh_event_post (NSH_EVENT_PROXY_DEL, a->map.nsp_nsi, entry[0]);
       pool_put (nm->nsh_proxy_sessions, proxy);
     }
 
   return 0;
 }
 
+/**
+ * Action function to add, replace or del the hop of an NSP path.
+ * Shared by both CLI and binary API.
+ * Returns -1 for NSI 0 or a hop without next node,
+ * -2 when the hop to delete does not exist.
+ **/
+int
+nsh_add_del_nsp_hop (nsh_add_del_nsp_hop_args_t * a)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_nsp_path_t * path = 0;
+  nsh_nsp_hop_t * hop;
+  nsh_nsp_hop_t empty = {
+    .next_node = ~0,
+    .sw_if_index = ~0,
+    .adj_index = ~0,
+  };
+  u32 path_index;
+  uword * p;
+
+  /* NSI 0 has no next service index to decrement to */
+  if (a->nsi == 0)
+    return -1;
+
+  p = hash_get (nm->nsp_path_by_nsp, a->nsp);
+  if (p)
+    path = pool_elt_at_index (nm->nsp_paths, p[0]);
+
+  if (a->is_add)
+    {
+      if (a->hop.next_node == ~0)
+        return -1;
+
+      if (path == 0)
+        {
+          pool_get (nm->nsp_paths, path);
+          memset (path, 0, sizeof (*path));
+          path->nsp = a->nsp;
+          hash_set (nm->nsp_path_by_nsp, a->nsp, path - nm->nsp_paths);
+        }
+
+      vec_validate_init_empty (path->hops, a->nsi, empty);
+      hop = &path->hops[a->nsi];
+      if (hop->next_node == ~0)
+        path->n_hops++;
+      *hop = a->hop;
+
+      nsh_event_post (NSH_EVENT_NSP_HOP_ADD,
+                      (a->nsp << NSH_NSP_SHIFT) | a->nsi,
+                      path - nm->nsp_paths);
+    }
+  else
+    {
+      if (path == 0 || a->nsi >= vec_len (path->hops)
+          || path->hops[a->nsi].next_node == ~0)
+        return -2;
+
+      path->hops[a->nsi] = empty;
+      path_index = path - nm->nsp_paths;
+
+      nsh_event_post (NSH_EVENT_NSP_HOP_DEL,
+                      (a->nsp << NSH_NSP_SHIFT) | a->nsi, path_index);
+
+      if (--path->n_hops == 0)
+        {
+          vec_free (path->hops);
+          hash_unset (nm->nsp_path_by_nsp, a->nsp);
+          pool_put (nm->nsp_paths, path);
+        }
+    }
+
+  return 0;
+}
+
 /**
  * CLI command for NSH map
  */
@@ -667,7 +1189,7 @@ static uword unformat_nsh_action (unformat_input_t * input, va_list * args)
   return 1;
 }
 
-static adj_index_t
+adj_index_t
 nsh_get_adj_by_sw_if_index(u32 sw_if_index)
 {
   adj_index_t ai = ~0;
@@ -821,51 +1343,562 @@ VLIB_CLI_COMMAND (create_nsh_map_command, static) = {
   .function = nsh_add_del_map_command_fn,
 };
 
-/** API message handler */
-static void vl_api_nsh_add_del_map_t_handler
-(vl_api_nsh_add_del_map_t * mp)
-{
-  vl_api_nsh_add_del_map_reply_t * rmp;
-  nsh_main_t * nm = &nsh_main;
-  int rv;
-  nsh_add_del_map_args_t _a, *a = &_a;
-  u32 map_index = ~0;
-
-  a->is_add = mp->is_add;
-  a->map.nsp_nsi = ntohl(mp->nsp_nsi);
-  a->map.mapped_nsp_nsi = ntohl(mp->mapped_nsp_nsi);
-  a->map.nsh_action = ntohl(mp->nsh_action);
-  a->map.sw_if_index = ntohl(mp->sw_if_index);
-  a->map.rx_sw_if_index = ntohl(mp->rx_sw_if_index);
-  a->map.next_node = ntohl(mp->next_node);
-
-  rv = nsh_add_del_map (a, &map_index);
-
-  if((a->map.next_node == NSH_NODE_NEXT_ENCAP_VXLAN4)
-      | (a->map.next_node == NSH_NODE_NEXT_ENCAP_VXLAN6))
-    {
-      rv = nsh_add_del_proxy_session(a);
-    }
-
-  REPLY_MACRO2(VL_API_NSH_ADD_DEL_MAP_REPLY,
-  ({
-    rmp->map_index = htonl (map_index);
-  }));
-}
-
 /**
- * CLI command for showing the mapping between NSH entries
+ * CLI command for the hops of an NSP path
  */
 static clib_error_t *
-show_nsh_map_command_fn (vlib_main_t * vm,
-			 unformat_input_t * input,
-			 vlib_cli_command_t * cmd)
+nsh_add_del_nsp_hop_command_fn (vlib_main_t * vm,
+                                unformat_input_t * input,
+                                vlib_cli_command_t * cmd)
 {
-  nsh_main_t * nm = &nsh_main;
-  nsh_map_t * map;
+  unformat_input_t _line_input, * line_input = &_line_input;
+  nsh_add_del_nsp_hop_args_t _a, * a = &_a;
+  u32 nsp, nsi;
+  int nsp_set = 0, nsi_set = 0;
+  u32 next_node = ~0;
+  u32 adj_index = ~0;
+  u32 sw_if_index = ~0;
+  u8 is_add = 1;
+  int rv;
 
-  if (pool_elts (nm->nsh_mappings) == 0)
-    vlib_cli_output (vm, "No nsh maps configured.");
+  /* Get a line of input. */
+  if (! unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+    if (unformat (line_input, "del"))
+      is_add = 0;
+    else if (unformat (line_input, "nsp %d", &nsp))
+      nsp_set = 1;
+    else if (unformat (line_input, "nsi %d", &nsi))
+      nsi_set = 1;
+    else if (unformat (line_input, "encap-gre4-intf %d", &sw_if_index))
+      next_node = NSH_NODE_NEXT_ENCAP_GRE4;
+    else if (unformat (line_input, "encap-gre6-intf %d", &sw_if_index))
+      next_node = NSH_NODE_NEXT_ENCAP_GRE6;
+    else if (unformat (line_input, "encap-vxlan-gpe-intf %d", &sw_if_index))
+      next_node = NSH_NODE_NEXT_ENCAP_VXLANGPE;
+    else if (unformat (line_input, "encap-lisp-gpe-intf %d", &sw_if_index))
+      next_node = NSH_NODE_NEXT_ENCAP_LISP_GPE;
+    else if (unformat (line_input, "encap-eth-intf %d", &sw_if_index))
+      {
+        next_node = NSH_NODE_NEXT_ENCAP_ETHERNET;
+        adj_index = nsh_get_adj_by_sw_if_index(sw_if_index);
+      }
+    else
+      return clib_error_return (0, "parse error: '%U'",
+                                format_unformat_error, line_input);
+  }
+
+  unformat_free (line_input);
+
+  if (nsp_set == 0 || nsi_set == 0)
+    return clib_error_return (0, "nsp nsi pair required. Key: for NSP hop");
+
+  if (nsi == 0 || nsi > NSH_NSI_MASK)
+    return clib_error_return (0, "nsi must be within 1-255");
+
+  if (is_add && next_node == ~0)
+    return clib_error_return (0, "must specific action: [encap-gre4-intf <nn> | encap-gre6-intf <nn> | encap-vxlan-gpe-intf <nn> | encap-lisp-gpe-intf <nn> | encap-eth-intf <nn>]");
+
+  memset (a, 0, sizeof (*a));
+  a->is_add = is_add;
+  a->nsp = nsp & NSH_NSP_MASK;
+  a->nsi = nsi;
+  a->hop.next_node = next_node;
+  a->hop.sw_if_index = sw_if_index;
+  a->hop.adj_index = adj_index;
+
+  rv = nsh_add_del_nsp_hop (a);
+
+  switch(rv)
+    {
+    case 0:
+      break;
+    case -2: // TODO API_ERROR_NO_SUCH_ENTRY:
+      return clib_error_return (0, "nsp hop does not exist.");
+
+    default:
+      return clib_error_return
+        (0, "nsh_add_del_nsp_hop returned %d", rv);
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (create_nsh_nsp_hop_command, static) = {
+  .path = "create nsh nsp-hop",
+  .short_help =
+  "create nsh nsp-hop nsp <nn> nsi <nn> [del] "
+  "[encap-gre4-intf <nn> | encap-gre6-intf <nn> | encap-vxlan-gpe-intf <nn> "
+  "| encap-lisp-gpe-intf <nn> | encap-eth-intf <nn>]\n",
+  .function = nsh_add_del_nsp_hop_command_fn,
+};
+
+static char * nsh_node_next_names[] = {
+#define _(s,n) n,
+  foreach_nsh_node_next
+#undef _
+};
+
+static clib_error_t *
+show_nsh_nsp_hop_command_fn (vlib_main_t * vm,
+                             unformat_input_t * input,
+                             vlib_cli_command_t * cmd)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_nsp_path_t * path;
+  nsh_nsp_hop_t * hop;
+  u32 nsi;
+
+  if (pool_elts (nm->nsp_paths) == 0)
+    vlib_cli_output (vm, "No nsp paths configured.");
+
+  pool_foreach (path, nm->nsp_paths,
+  ({
+    vlib_cli_output (vm, "nsp: %d hops: %d", path->nsp, path->n_hops);
+    vec_foreach_index (nsi, path->hops)
+      {
+        hop = &path->hops[nsi];
+        if (hop->next_node == ~0)
+          continue;
+        vlib_cli_output (vm, "  nsi: %d -> %d via %s intf: %d",
+                         nsi, nsi - 1, nsh_node_next_names[hop->next_node],
+                         hop->sw_if_index);
+      }
+  }));
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (show_nsh_nsp_hop_command, static) = {
+  .path = "show nsh nsp-hops",
+  .function = show_nsh_nsp_hop_command_fn,
+};
+
+/** API message handler */
+static void vl_api_nsh_add_del_nsp_hop_t_handler
+(vl_api_nsh_add_del_nsp_hop_t * mp)
+{
+  vl_api_nsh_add_del_nsp_hop_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  nsh_add_del_nsp_hop_args_t _a, * a = &_a;
+  int rv;
+
+  memset (a, 0, sizeof (*a));
+  a->is_add = mp->is_add;
+  a->nsp = ntohl(mp->nsp) & NSH_NSP_MASK;
+  a->nsi = mp->nsi;
+  a->hop.next_node = ntohl(mp->next_node);
+  a->hop.sw_if_index = ntohl(mp->sw_if_index);
+  a->hop.adj_index = ~0;
+  if (a->hop.next_node == NSH_NODE_NEXT_ENCAP_ETHERNET)
+    a->hop.adj_index = nsh_get_adj_by_sw_if_index (a->hop.sw_if_index);
+
+  if (a->is_add && a->hop.next_node >= NSH_NODE_N_NEXT)
+    rv = -1;
+  else
+    rv = nsh_add_del_nsp_hop (a);
+
+  REPLY_MACRO(VL_API_NSH_ADD_DEL_NSP_HOP_REPLY);
+}
+
+/** API message handler */
+static void vl_api_nsh_classify_add_del_session_t_handler
+(vl_api_nsh_classify_add_del_session_t * mp)
+{
+  vl_api_nsh_classify_add_del_session_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  nsh_classify_session_args_t _a, * a = &_a;
+  int rv;
+
+  memset (a, 0, sizeof (*a));
+  a->is_add = mp->is_add;
+  a->is_ip6 = mp->is_ip6;
+  if (a->is_ip6)
+    {
+      clib_memcpy (&a->src.ip6, mp->src_address, sizeof (a->src.ip6));
+      clib_memcpy (&a->dst.ip6, mp->dst_address, sizeof (a->dst.ip6));
+    }
+  else
+    {
+      clib_memcpy (&a->src.ip4, mp->src_address, sizeof (a->src.ip4));
+      clib_memcpy (&a->dst.ip4, mp->dst_address, sizeof (a->dst.ip4));
+    }
+  a->src_len = mp->src_len;
+  a->dst_len = mp->dst_len;
+  a->match_ports = mp->match_ports;
+  a->protocol = mp->protocol;
+  a->src_port = ntohs(mp->src_port);
+  a->dst_port = ntohs(mp->dst_port);
+  a->nsp_nsi = ntohl(mp->nsp_nsi);
+
+  rv = nsh_classify_add_del_session (a);
+
+  REPLY_MACRO(VL_API_NSH_CLASSIFY_ADD_DEL_SESSION_REPLY);
+}
+
+/** API message handler */
+static void vl_api_nsh_classify_enable_disable_t_handler
+(vl_api_nsh_classify_enable_disable_t * mp)
+{
+  vl_api_nsh_classify_enable_disable_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  int rv;
+
+  rv = nsh_classify_enable_disable (ntohl(mp->sw_if_index), mp->is_ip6,
+                                    mp->enable_disable);
+
+  REPLY_MACRO(VL_API_NSH_CLASSIFY_ENABLE_DISABLE_REPLY);
+}
+
+/** API message handler */
+static void vl_api_nsh_add_del_map_t_handler
+(vl_api_nsh_add_del_map_t * mp)
+{
+  vl_api_nsh_add_del_map_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  int rv;
+  nsh_add_del_map_args_t _a, *a = &_a;
+  u32 map_index = ~0;
+
+  memset (a, 0, sizeof (*a));
+  a->is_add = mp->is_add;
+  a->map.nsp_nsi = ntohl(mp->nsp_nsi);
+  a->map.mapped_nsp_nsi = ntohl(mp->mapped_nsp_nsi);
+  a->map.nsh_action = ntohl(mp->nsh_action);
+  a->map.sw_if_index = ntohl(mp->sw_if_index);
+  a->map.rx_sw_if_index = ntohl(mp->rx_sw_if_index);
+  a->map.next_node = ntohl(mp->next_node);
+  a->map.adj_index = ~0;
+  if (a->map.next_node == NSH_NODE_NEXT_ENCAP_ETHERNET)
+    a->map.adj_index = nsh_get_adj_by_sw_if_index (a->map.sw_if_index);
+
+  rv = nsh_add_del_map (a, &map_index);
+
+  if((a->map.next_node == NSH_NODE_NEXT_ENCAP_VXLAN4)
+      | (a->map.next_node == NSH_NODE_NEXT_ENCAP_VXLAN6))
+    {
+      rv = nsh_add_del_proxy_session(a);
+    }
+
+  REPLY_MACRO2(VL_API_NSH_ADD_DEL_MAP_REPLY,
+  ({
+    rmp->map_index = htonl (map_index);
+  }));
+}
+
+/** API message handler */
+static void vl_api_nsh_map_policer_t_handler
+(vl_api_nsh_map_policer_t * mp)
+{
+  vl_api_nsh_map_policer_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  int rv;
+  nsh_map_policer_args_t _a, *a = &_a;
+
+  a->is_add = mp->is_add;
+  a->nsp_nsi = ntohl(mp->nsp_nsi);
+  a->type = mp->type;
+  a->rate_type = mp->rate_type;
+  a->exceed_action = mp->exceed_action;
+  a->cir = ntohl(mp->cir);
+  a->cb = ntohl(mp->cb);
+  a->pir = ntohl(mp->pir);
+  a->pb = ntohl(mp->pb);
+
+  rv = nsh_map_policer_add_del (a);
+
+  REPLY_MACRO(VL_API_NSH_MAP_POLICER_REPLY);
+}
+
+/** API message handler */
+static void vl_api_nsh_sf_pool_add_del_member_t_handler
+(vl_api_nsh_sf_pool_add_del_member_t * mp)
+{
+  vl_api_nsh_sf_pool_add_del_member_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  int rv;
+  nsh_sf_pool_member_args_t _a, *a = &_a;
+
+  memset (a, 0, sizeof (*a));
+  a->is_add = mp->is_add;
+  a->id = ntohl(mp->id);
+  a->member.next_node = ntohl(mp->next_node);
+  a->member.sw_if_index = ntohl(mp->sw_if_index);
+  a->member.adj_index = ~0;
+  if (a->member.next_node == NSH_NODE_NEXT_ENCAP_ETHERNET)
+    a->member.adj_index =
+      nsh_get_adj_by_sw_if_index (a->member.sw_if_index);
+
+  if (a->member.next_node >= NSH_NODE_N_NEXT)
+    rv = -1;
+  else
+    rv = nsh_sf_pool_add_del_member (a);
+
+  REPLY_MACRO(VL_API_NSH_SF_POOL_ADD_DEL_MEMBER_REPLY);
+}
+
+/** API message handler */
+static void vl_api_nsh_map_sf_pool_t_handler
+(vl_api_nsh_map_sf_pool_t * mp)
+{
+  vl_api_nsh_map_sf_pool_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  int rv;
+  nsh_map_sf_pool_args_t _a, *a = &_a;
+
+  a->is_add = mp->is_add;
+  a->nsp_nsi = ntohl(mp->nsp_nsi);
+  a->id = ntohl(mp->id);
+
+  rv = nsh_map_sf_pool_add_del (a);
+
+  REPLY_MACRO(VL_API_NSH_MAP_SF_POOL_REPLY);
+}
+
+/** API message handler */
+static void vl_api_nsh_sf_pool_symmetric_t_handler
+(vl_api_nsh_sf_pool_symmetric_t * mp)
+{
+  vl_api_nsh_sf_pool_symmetric_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  int rv;
+
+  rv = nsh_sf_pool_set_symmetric (ntohl(mp->id), mp->is_enable);
+
+  REPLY_MACRO(VL_API_NSH_SF_POOL_SYMMETRIC_REPLY);
+}
+
+/** API message handler */
+static void vl_api_nsh_map_interface_t_handler
+(vl_api_nsh_map_interface_t * mp)
+{
+  vl_api_nsh_map_interface_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  u32 sw_if_index = ~0;
+  int rv;
+
+  rv = nsh_map_interface_get (ntohl(mp->nsp_nsi), &sw_if_index);
+
+  REPLY_MACRO2(VL_API_NSH_MAP_INTERFACE_REPLY,
+  ({
+    rmp->sw_if_index = htonl (sw_if_index);
+  }));
+}
+
+static vlib_node_registration_t nsh_event_process_node;
+
+/**
+ * Queue a configuration change for the want_nsh_events registrants.
+ * Changes are sent by nsh-event-process, woken up by the first change
+ * of a main loop iteration, so a burst of API calls goes out in as few
+ * messages as possible.
+ */
+void
+nsh_event_post (nsh_event_type_t type, u32 nsp_nsi, u32 index)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_event_t * e;
+
+  /* Every change of the tables comes through here */
+  nsh_numa_replicas_update ();
+
+  if (pool_elts (nm->event_registrations) == 0)
+    return;
+
+  if (vec_len (nm->pending_events) == 0)
+    vlib_process_signal_event (nm->vlib_main, nsh_event_process_node.index,
+                               0, 0);
+
+  vec_add2 (nm->pending_events, e, 1);
+  e->type = type;
+  e->nsp_nsi = nsp_nsi;
+  e->index = index;
+}
+
+static void
+nsh_event_unregister (u32 client_index)
+{
+  nsh_main_t * nm = &nsh_main;
+  uword * p;
+
+  p = hash_get (nm->event_registration_by_client, client_index);
+  if (p == 0)
+    return;
+
+  pool_put_index (nm->event_registrations, p[0]);
+  hash_unset (nm->event_registration_by_client, client_index);
+}
+
+static vl_api_nsh_event_t *
+nsh_event_msg_alloc (nsh_event_registration_t * reg)
+{
+  nsh_main_t * nm = &nsh_main;
+  vl_api_nsh_event_t * mp;
+
+  mp = vl_msg_api_alloc (sizeof (*mp));
+  memset (mp, 0, sizeof (*mp));
+  mp->_vl_msg_id = ntohs (VL_API_NSH_EVENT + nm->msg_id_base);
+  mp->client_index = reg->client_index;
+  mp->pid = reg->client_pid;
+
+  return mp;
+}
+
+/*
+ * Send the pending changes to every registrant. A client whose queue is
+ * full loses the rest of the batch and gets an NSH_EVENT_RESYNC record
+ * carrying the number of lost changes once it drains, telling it to
+ * fall back to a dump.
+ */
+static void
+nsh_event_send_pending (void)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_event_registration_t * reg;
+  unix_shared_memory_queue_t * q;
+  vl_api_nsh_event_t * mp;
+  vl_api_nsh_event_record_t * r;
+  nsh_event_t * e;
+  u32 * stale = 0;
+  u32 i, n_sent;
+
+  /* *INDENT-OFF* */
+  pool_foreach (reg, nm->event_registrations,
+  ({
+    q = vl_api_client_index_to_input_queue (reg->client_index);
+    if (q == 0)
+      {
+        vec_add1 (stale, reg->client_index);
+        continue;
+      }
+
+    mp = 0;
+    n_sent = 0;
+    if (reg->n_lost && q->cursize < q->maxsize)
+      {
+        mp = nsh_event_msg_alloc (reg);
+        r = &mp->records[mp->count++];
+        r->type = NSH_EVENT_RESYNC;
+        r->nsp_nsi = ~0;
+        r->index = htonl (reg->n_lost);
+        reg->n_lost = 0;
+      }
+
+    vec_foreach (e, nm->pending_events)
+      {
+        if (mp == 0)
+          {
+            if (q->cursize >= q->maxsize)
+              break;
+            mp = nsh_event_msg_alloc (reg);
+          }
+
+        r = &mp->records[mp->count++];
+        r->type = e->type;
+        r->nsp_nsi = htonl (e->nsp_nsi);
+        r->index = htonl (e->index);
+        n_sent++;
+
+        if (mp->count == ARRAY_LEN (mp->records))
+          {
+            vl_msg_api_send_shmem (q, (u8 *)&mp);
+            mp = 0;
+          }
+      }
+
+    if (mp)
+      vl_msg_api_send_shmem (q, (u8 *)&mp);
+
+    reg->n_lost += vec_len (nm->pending_events) - n_sent;
+  }));
+  /* *INDENT-ON* */
+
+  for (i = 0; i < vec_len (stale); i++)
+    nsh_event_unregister (stale[i]);
+
+  vec_free (stale);
+  vec_reset_length (nm->pending_events);
+}
+
+static uword
+nsh_event_process (vlib_main_t * vm,
+                   vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  uword * event_data = 0;
+
+  while (1)
+    {
+      vlib_process_wait_for_event (vm);
+      vlib_process_get_events (vm, &event_data);
+      vec_reset_length (event_data);
+
+      nsh_event_send_pending ();
+    }
+
+  return 0;			/* not so much */
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (nsh_event_process_node, static) =
+{
+ .function = nsh_event_process,
+ .type = VLIB_NODE_TYPE_PROCESS,
+ .name = "nsh-event-process",
+};
+/* *INDENT-ON* */
+
+/** API message handler */
+static void vl_api_want_nsh_events_t_handler
+(vl_api_want_nsh_events_t * mp)
+{
+  vl_api_want_nsh_events_reply_t * rmp;
+  nsh_main_t * nm = &nsh_main;
+  nsh_event_registration_t * reg;
+  uword * p;
+  int rv = 0;
+
+  p = hash_get (nm->event_registration_by_client, mp->client_index);
+
+  if (ntohl (mp->enable_disable))
+    {
+      if (p)
+        rv = VNET_API_ERROR_INVALID_REGISTRATION;
+      else
+        {
+          pool_get (nm->event_registrations, reg);
+          memset (reg, 0, sizeof (*reg));
+          reg->client_index = mp->client_index;
+          reg->client_pid = mp->pid;
+          hash_set (nm->event_registration_by_client, mp->client_index,
+                    reg - nm->event_registrations);
+        }
+    }
+  else
+    {
+      if (p == 0)
+        rv = VNET_API_ERROR_INVALID_REGISTRATION;
+      else
+        nsh_event_unregister (mp->client_index);
+    }
+
+  REPLY_MACRO(VL_API_WANT_NSH_EVENTS_REPLY);
+}
+
+/**
+ * CLI command for showing the mapping between NSH entries
+ */
+static clib_error_t *
+show_nsh_map_command_fn (vlib_main_t * vm,
+			 unformat_input_t * input,
+			 vlib_cli_command_t * cmd)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_map_t * map;
+
+  if (pool_elts (nm->nsh_mappings) == 0)
+    vlib_cli_output (vm, "No nsh maps configured.");
 
   pool_foreach (map, nm->nsh_mappings,
 		({
@@ -880,6 +1913,146 @@ VLIB_CLI_COMMAND (show_nsh_map_command, static) = {
   .function = show_nsh_map_command_fn,
 };
 
+/**
+ * CLI command to choose whether new maps get their nsh_tunnel interface
+ * when added (always, the default) or only once asked for (on-demand),
+ * or to ask for the interface of one map, creating it if needed.
+ * Only traffic for nsh-aware-vnf-proxy goes through these interfaces.
+ */
+static clib_error_t *
+nsh_map_interface_command_fn (vlib_main_t * vm,
+                              unformat_input_t * input,
+                              vlib_cli_command_t * cmd)
+{
+  nsh_main_t * nm = &nsh_main;
+  u32 nsp, nsi, sw_if_index;
+  int nsp_set = 0, nsi_set = 0;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "on-demand"))
+        {
+          nm->map_interface_on_demand = 1;
+          return 0;
+        }
+      else if (unformat (input, "always"))
+        {
+          nm->map_interface_on_demand = 0;
+          return 0;
+        }
+      else if (unformat (input, "nsp %d", &nsp))
+        nsp_set = 1;
+      else if (unformat (input, "nsi %d", &nsi))
+        nsi_set = 1;
+      else
+        return clib_error_return (0, "parse error: '%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (nsp_set == 0 || nsi_set == 0)
+    return clib_error_return (0, "nsp nsi pair required. Key: for NSH map");
+
+  rv = nsh_map_interface_get ((nsp<< NSH_NSP_SHIFT) | nsi, &sw_if_index);
+  if (rv == -2)
+    return clib_error_return (0, "mapping does not exist.");
+
+  vlib_cli_output (vm, "%U", format_vnet_sw_if_index_name,
+                   nm->vnet_main, sw_if_index);
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (nsh_map_interface_command, static) = {
+  .path = "nsh map-interface",
+  .short_help = "nsh map-interface {on-demand | always | nsp <nn> nsi <nn>}",
+  .function = nsh_map_interface_command_fn,
+};
+
+/**
+ * CLI command to have VXLAN-GPE maps push their outer headers with the
+ * NSH header (the default), or to leave that to vxlan-gpe-encap, e.g.
+ * to get the tunnel's interface counters back.
+ */
+static clib_error_t *
+nsh_vxlan_gpe_fused_command_fn (vlib_main_t * vm,
+                                unformat_input_t * input,
+                                vlib_cli_command_t * cmd)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_map_t * map;
+  u8 fused = 1;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "enable"))
+        fused = 1;
+      else if (unformat (input, "disable"))
+        fused = 0;
+      else
+        return clib_error_return (0, "parse error: '%U'",
+                                  format_unformat_error, input);
+    }
+
+  nm->vxlan_gpe_fused = fused;
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    nsh_map_fused_update (map);
+  }));
+  nsh_map_fused_reclaim ();
+  nsh_numa_replicas_update ();
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (nsh_vxlan_gpe_fused_command, static) = {
+  .path = "set nsh vxlan-gpe fused-encap",
+  .short_help = "set nsh vxlan-gpe fused-encap [enable | disable]",
+  .function = nsh_vxlan_gpe_fused_command_fn,
+};
+
+/**
+ * CLI command to have IPv4 VXLAN-GPE packets decapped and mapped by
+ * vxlan4-gpe-nsh-input in one node, rather than crossing vxlan4-gpe-input
+ * and nsh-input.
+ */
+static clib_error_t *
+nsh_vxlan_gpe_nsh_input_command_fn (vlib_main_t * vm,
+                                    unformat_input_t * input,
+                                    vlib_cli_command_t * cmd)
+{
+  nsh_main_t * nm = &nsh_main;
+  u8 is_enable = 1;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "enable"))
+        is_enable = 1;
+      else if (unformat (input, "disable"))
+        is_enable = 0;
+      else
+        return clib_error_return (0, "parse error: '%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (is_enable == nm->vxlan_gpe_nsh_input)
+    return 0;
+
+  udp_register_dst_port (vm, UDP_DST_PORT_vxlan_gpe,
+                         is_enable ? vxlan4_gpe_nsh_input_node.index
+                                   : vxlan4_gpe_input_node.index,
+                         1 /* is_ip4 */);
+  nm->vxlan_gpe_nsh_input = is_enable;
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (nsh_vxlan_gpe_nsh_input_command, static) = {
+  .path = "set nsh vxlan-gpe nsh-input",
+  .short_help = "set nsh vxlan-gpe nsh-input [enable | disable]",
+  .function = nsh_vxlan_gpe_nsh_input_command_fn,
+};
+
 int nsh_header_rewrite(nsh_entry_t *nsh_entry)
 {
   u8 *rw = 0;
@@ -1037,6 +2210,8 @@ int nsh_add_del_entry (nsh_add_del_entry_args_t *a, u32 * entry_indexp)
       hash_set_mem (nm->nsh_entry_by_key, key_copy,
                     nsh_entry - nm->nsh_entries);
       entry_index = nsh_entry - nm->nsh_entries;
+
+      nsh_event_post (NSH_EVENT_ENTRY_ADD, key, entry_index);
     }
   else
     {
@@ -1049,11 +2224,16 @@ int nsh_add_del_entry (nsh_add_del_entry_args_t *a, u32 * entry_indexp)
       hash_unset_mem (nm->nsh_entry_by_key, &key);
       clib_mem_free (key_copy);
 
+      nsh_event_post (NSH_EVENT_ENTRY_DEL, key, entry_id[0]);
+
       vec_free (nsh_entry->tlvs_data);
       vec_free (nsh_entry->rewrite);
       pool_put (nm->nsh_entries, nsh_entry);
     }
 
+  /* Maps pushing the entry over VXLAN-GPE carry a copy of its rewrite */
+  nsh_entry_maps_fused_update (key);
+
   if (entry_indexp)
       *entry_indexp = entry_index;
 
@@ -1098,6 +2278,7 @@ nsh_add_del_entry_command_fn (vlib_main_t * vm,
   u32 entry_index;
   nsh_add_del_entry_args_t _a, * a = &_a;
   u8 has_ioam_trace_option = 0;
+  u8 has_ioam_pot_option = 0;
 
   /* Get a line of input. */
   if (! unformat_user (input, unformat_line_input, line_input))
@@ -1136,6 +2317,8 @@ nsh_add_del_entry_command_fn (vlib_main_t * vm,
       nsi_set = 1;
     else if (unformat (line_input, "tlv-ioam-trace"))
       has_ioam_trace_option = 1;
+    else if (unformat (line_input, "tlv-ioam-pot"))
+      has_ioam_pot_option = 1;
     else
       return clib_error_return (0, "parse error: '%U'",
                                 format_unformat_error, line_input);
@@ -1149,7 +2332,7 @@ nsh_add_del_entry_command_fn (vlib_main_t * vm,
   if (nsi_set == 0)
     return clib_error_return (0, "nsi not specified");
 
-  if (md_type == 1 && has_ioam_trace_option == 1)
+  if (md_type == 1 && (has_ioam_trace_option || has_ioam_pot_option))
     return clib_error_return (0, "Invalid MD Type");
 
   nsp_nsi = (nsp<<8) | nsi;
@@ -1169,27 +2352,53 @@ nsh_add_del_entry_command_fn (vlib_main_t * vm,
     {
       length = sizeof(nsh_base_header_t) >> 2;
 
-      vec_free(a->nsh_entry.tlvs_data);
-      tlvs_len = (MAX_METADATA_LEN << 2);
-      vec_validate_aligned (data, tlvs_len-1, CLIB_CACHE_LINE_BYTES);
-      a->nsh_entry.tlvs_data = data;
-      current = data;
+      vec_free(a->nsh_entry.tlvs_data);
+      tlvs_len = (MAX_METADATA_LEN << 2);
+      vec_validate_aligned (data, tlvs_len-1, CLIB_CACHE_LINE_BYTES);
+      a->nsh_entry.tlvs_data = data;
+      current = data;
+
+      if(has_ioam_trace_option)
+	{
+	  tlv_header.class = clib_host_to_net_u16(NSH_MD2_IOAM_CLASS);
+          tlv_header.type = NSH_MD2_IOAM_OPTION_TYPE_TRACE;
+          /* Uses network order's class and type to lookup */
+          nsh_option = nsh_md2_lookup_option(tlv_header.class, tlv_header.type);
+          if( nsh_option == NULL)
+              return clib_error_return (0, "iOAM Trace not registered");
+
+          if(nm->add_options[nsh_option->option_id] != NULL)
+            {
+              if (0 != nm->add_options[nsh_option->option_id] (
+        	  (u8 *)current, &option_size ))
+                {
+        	  return clib_error_return (0, "Invalid MD Type");
+                }
+            }
+
+          nm->options_size[nsh_option->option_id]=  option_size;
+          /* round to 4-byte */
+          option_size = ( ((option_size+3)>>2) << 2 );
 
-      if(has_ioam_trace_option)
+          cur_len += option_size;
+          current += option_size;
+	}
+
+      if(has_ioam_pot_option)
 	{
 	  tlv_header.class = clib_host_to_net_u16(NSH_MD2_IOAM_CLASS);
-          tlv_header.type = NSH_MD2_IOAM_OPTION_TYPE_TRACE;
+          tlv_header.type = NSH_MD2_IOAM_OPTION_TYPE_PROOF_OF_TRANSIT;
           /* Uses network order's class and type to lookup */
           nsh_option = nsh_md2_lookup_option(tlv_header.class, tlv_header.type);
           if( nsh_option == NULL)
-              return clib_error_return (0, "iOAM Trace not registered");
+              return clib_error_return (0, "iOAM POT not registered");
 
           if(nm->add_options[nsh_option->option_id] != NULL)
             {
               if (0 != nm->add_options[nsh_option->option_id] (
         	  (u8 *)current, &option_size ))
                 {
-        	  return clib_error_return (0, "Invalid MD Type");
+        	  return clib_error_return (0, "No valid iOAM POT profile");
                 }
             }
 
@@ -1198,7 +2407,7 @@ nsh_add_del_entry_command_fn (vlib_main_t * vm,
           option_size = ( ((option_size+3)>>2) << 2 );
 
           cur_len += option_size;
-          current = data + option_size;
+          current += option_size;
 	}
 
       /* Add more options' parsing */
@@ -1230,7 +2439,7 @@ VLIB_CLI_COMMAND (create_nsh_entry_command, static) = {
   .path = "create nsh entry",
   .short_help =
   "create nsh entry {nsp <nn> nsi <nn>} [ttl <nn>] [md-type <nn>]"
-  "  [c1 <nn> c2 <nn> c3 <nn> c4 <nn>] [tlv-ioam-trace] [del]\n",
+  "  [c1 <nn> c2 <nn> c3 <nn> c4 <nn>] [tlv-ioam-trace] [tlv-ioam-pot] [del]\n",
   .function = nsh_add_del_entry_command_fn,
 };
 
@@ -1287,6 +2496,7 @@ static void send_nsh_entry_details
     memset (rmp, 0, sizeof (*rmp));
 
     rmp->_vl_msg_id = ntohs((VL_API_NSH_ENTRY_DETAILS)+nm->msg_id_base);
+    rmp->entry_index = htonl(t - nm->nsh_entries);
     rmp->ver_o_c = t->nsh_base.ver_o_c;
     rmp->ttl = (t->nsh_base.ver_o_c & NSH_TTL_H4_MASK)<<2 |
                (t->nsh_base.length & NSH_TTL_L2_MASK)>>6;
@@ -1338,15 +2548,119 @@ static void vl_api_nsh_entry_dump_t_handler
       }
     else
       {
-        if (entry_index >= vec_len (nm->nsh_entries))
+        if (entry_index >= vec_len (nm->nsh_entries)
+            || pool_is_free_index (nm->nsh_entries, entry_index))
   	{
   	  return;
   	}
-        t = &nm->nsh_entries[entry_index];
+        t = pool_elt_at_index (nm->nsh_entries, entry_index);
         send_nsh_entry_details(t, q, mp->context);
       }
 }
 
+static void nsh_entry_fill_record
+(nsh_entry_t * t, vl_api_nsh_entry_record_t * r)
+{
+    nsh_main_t * nm = &nsh_main;
+
+    r->entry_index = htonl(t - nm->nsh_entries);
+    r->ver_o_c = t->nsh_base.ver_o_c;
+    r->ttl = (t->nsh_base.ver_o_c & NSH_TTL_H4_MASK)<<2 |
+             (t->nsh_base.length & NSH_TTL_L2_MASK)>>6;
+    r->length = t->nsh_base.length & NSH_LEN_MASK;
+    r->md_type = t->nsh_base.md_type;
+    r->next_protocol = t->nsh_base.next_protocol;
+    r->nsp_nsi = htonl(t->nsh_base.nsp_nsi);
+
+    if (t->nsh_base.md_type == 1)
+      {
+	r->tlv_length = 4;
+        r->c1 = htonl(t->md.md1_data.c1);
+        r->c2 = htonl(t->md.md1_data.c2);
+        r->c3 = htonl(t->md.md1_data.c3);
+        r->c4 = htonl(t->md.md1_data.c4);
+      }
+    else if (t->nsh_base.md_type == 2)
+      {
+	r->tlv_length = t->tlvs_len;
+	clib_memcpy(r->tlv, t->tlvs_data, t->tlvs_len);
+      }
+}
+
+/**
+ * Paged entry dump: at most max_count entries from cursor on, packed
+ * several to a details message, then a reply carrying the next cursor.
+ * A page is capped at NSH_DUMP_MAX_PAGE records and NSH_DUMP_MAX_SCAN
+ * pool slots, so a sparse filtered dump may return short pages.
+ * Free pool slots are skipped, so a cursor stays valid across deletes.
+ */
+static void vl_api_nsh_entry_page_dump_t_handler
+(vl_api_nsh_entry_page_dump_t * mp)
+{
+    vl_api_nsh_entry_page_dump_reply_t * rmp;
+    vl_api_nsh_entry_page_details_t * dmp = 0;
+    unix_shared_memory_queue_t * q;
+    nsh_main_t * nm = &nsh_main;
+    nsh_entry_t * t;
+    u32 cursor, max_count, nsp, end, n_records = 0;
+    int rv = 0;
+
+    q = vl_api_client_index_to_input_queue (mp->client_index);
+    if (q == 0) {
+        return;
+    }
+
+    cursor = ntohl (mp->cursor);
+    max_count = ntohl (mp->max_count);
+    if (max_count == 0)
+      max_count = NSH_DUMP_DEFAULT_PAGE;
+    max_count = clib_min (max_count, NSH_DUMP_MAX_PAGE);
+    /* a bogus cursor near ~0 wraps end below it, nothing is sent */
+    end = clib_min (vec_len (nm->nsh_entries), cursor + NSH_DUMP_MAX_SCAN);
+    nsp = ntohl (mp->nsp);
+
+    for (; cursor < end && n_records < max_count; cursor++)
+      {
+        if (pool_is_free_index (nm->nsh_entries, cursor))
+          continue;
+
+        t = pool_elt_at_index (nm->nsh_entries, cursor);
+        if ((mp->filter_flags & NSH_DUMP_FILTER_NSP)
+            && (t->nsh_base.nsp_nsi >> NSH_NSP_SHIFT) != nsp)
+          continue;
+        if ((mp->filter_flags & NSH_DUMP_FILTER_MD_TYPE)
+            && t->nsh_base.md_type != mp->md_type)
+          continue;
+
+        if (dmp == 0)
+          {
+            dmp = vl_msg_api_alloc (sizeof (*dmp));
+            memset (dmp, 0, sizeof (*dmp));
+            dmp->_vl_msg_id =
+              ntohs((VL_API_NSH_ENTRY_PAGE_DETAILS)+nm->msg_id_base);
+            dmp->context = mp->context;
+          }
+
+        nsh_entry_fill_record (t, &dmp->records[dmp->count++]);
+        n_records++;
+
+        if (dmp->count == ARRAY_LEN (dmp->records))
+          {
+            vl_msg_api_send_shmem (q, (u8 *)&dmp);
+            dmp = 0;
+          }
+      }
+
+    if (dmp)
+      vl_msg_api_send_shmem (q, (u8 *)&dmp);
+
+    REPLY_MACRO2(VL_API_NSH_ENTRY_PAGE_DUMP_REPLY,
+    ({
+      rmp->next_cursor =
+        htonl (cursor < vec_len (nm->nsh_entries) ? cursor : ~0);
+    }));
+}
+
 static void send_nsh_map_details
 (nsh_map_t * t, unix_shared_memory_queue_t * q, u32 context)
 {
@@ -1357,6 +2671,7 @@ static void send_nsh_map_details
     memset (rmp, 0, sizeof (*rmp));
 
     rmp->_vl_msg_id = ntohs((VL_API_NSH_MAP_DETAILS)+nm->msg_id_base);
+    rmp->map_index = htonl(t - nm->nsh_mappings);
     rmp->nsp_nsi = htonl(t->nsp_nsi);
     rmp->mapped_nsp_nsi = htonl(t->mapped_nsp_nsi);
     rmp->nsh_action = htonl(t->nsh_action);
@@ -1393,15 +2708,105 @@ static void vl_api_nsh_map_dump_t_handler
       }
     else
       {
-        if (map_index >= vec_len (nm->nsh_mappings))
+        if (map_index >= vec_len (nm->nsh_mappings)
+            || pool_is_free_index (nm->nsh_mappings, map_index))
   	{
   	  return;
   	}
-        t = &nm->nsh_mappings[map_index];
+        t = pool_elt_at_index (nm->nsh_mappings, map_index);
         send_nsh_map_details(t, q, mp->context);
       }
 }
 
+static void nsh_map_fill_record
+(nsh_map_t * t, vl_api_nsh_map_record_t * r)
+{
+    nsh_main_t * nm = &nsh_main;
+
+    r->map_index = htonl(t - nm->nsh_mappings);
+    r->nsp_nsi = htonl(t->nsp_nsi);
+    r->mapped_nsp_nsi = htonl(t->mapped_nsp_nsi);
+    r->nsh_action = htonl(t->nsh_action);
+    r->sw_if_index = htonl(t->sw_if_index);
+    r->rx_sw_if_index = htonl(t->rx_sw_if_index);
+    r->next_node = htonl(t->next_node);
+}
+
+/**
+ * Paged map dump, see vl_api_nsh_entry_page_dump_t_handler
+ */
+static void vl_api_nsh_map_page_dump_t_handler
+(vl_api_nsh_map_page_dump_t * mp)
+{
+    vl_api_nsh_map_page_dump_reply_t * rmp;
+    vl_api_nsh_map_page_details_t * dmp = 0;
+    unix_shared_memory_queue_t * q;
+    nsh_main_t * nm = &nsh_main;
+    nsh_map_t * t;
+    u32 cursor, max_count, nsp, nsh_action, next_node, end;
+    u32 n_records = 0;
+    int rv = 0;
+
+    q = vl_api_client_index_to_input_queue (mp->client_index);
+    if (q == 0) {
+        return;
+    }
+
+    cursor = ntohl (mp->cursor);
+    max_count = ntohl (mp->max_count);
+    if (max_count == 0)
+      max_count = NSH_DUMP_DEFAULT_PAGE;
+    max_count = clib_min (max_count, NSH_DUMP_MAX_PAGE);
+    end = clib_min (vec_len (nm->nsh_mappings), cursor + NSH_DUMP_MAX_SCAN);
+    nsp = ntohl (mp->nsp);
+    nsh_action = ntohl (mp->nsh_action);
+    next_node = ntohl (mp->next_node);
+
+    for (; cursor < end && n_records < max_count; cursor++)
+      {
+        if (pool_is_free_index (nm->nsh_mappings, cursor))
+          continue;
+
+        t = pool_elt_at_index (nm->nsh_mappings, cursor);
+        if ((mp->filter_flags & NSH_DUMP_FILTER_NSP)
+            && (t->nsp_nsi >> NSH_NSP_SHIFT) != nsp)
+          continue;
+        if ((mp->filter_flags & NSH_DUMP_FILTER_ACTION)
+            && t->nsh_action != nsh_action)
+          continue;
+        if ((mp->filter_flags & NSH_DUMP_FILTER_NEXT_NODE)
+            && t->next_node != next_node)
+          continue;
+
+        if (dmp == 0)
+          {
+            dmp = vl_msg_api_alloc (sizeof (*dmp));
+            memset (dmp, 0, sizeof (*dmp));
+            dmp->_vl_msg_id =
+              ntohs((VL_API_NSH_MAP_PAGE_DETAILS)+nm->msg_id_base);
+            dmp->context = mp->context;
+          }
+
+        nsh_map_fill_record (t, &dmp->records[dmp->count++]);
+        n_records++;
+
+        if (dmp->count == ARRAY_LEN (dmp->records))
+          {
+            vl_msg_api_send_shmem (q, (u8 *)&dmp);
+            dmp = 0;
+          }
+      }
+
+    if (dmp)
+      vl_msg_api_send_shmem (q, (u8 *)&dmp);
+
+    REPLY_MACRO2(VL_API_NSH_MAP_PAGE_DUMP_REPLY,
+    ({
+      rmp->next_cursor =
+        htonl (cursor < vec_len (nm->nsh_mappings) ? cursor : ~0);
+    }));
+}
+
 static clib_error_t *
 show_nsh_entry_command_fn (vlib_main_t * vm,
 			   unformat_input_t * input,
@@ -1547,93 +2952,475 @@ nsh_md2_swap (vlib_buffer_t * b,
   nsh_md2 = (nsh_tlv_header_t *)(nsh_entry->rewrite + sizeof(nsh_base_header_t));
   nsh_entry->rewrite_size = sizeof(nsh_base_header_t);
 
-  /* Scan the set of variable metadata, process ones that we understand */
-  while (opt0 < limit0)
+  /* Scan the set of variable metadata, process ones that we understand */
+  while (opt0 < limit0)
+    {
+      old_option_size = sizeof (nsh_tlv_header_t) + opt0->length;
+      /* round to 4-byte */
+      old_option_size = ( (old_option_size+3)>>2 ) << 2;
+
+      nsh_option = nsh_md2_lookup_option(opt0->class, opt0->type);
+      if( nsh_option == NULL)
+	{
+	  goto next_tlv_md2;
+	}
+
+      if (nm->swap_options[nsh_option->option_id])
+	{
+	  if ( (*nm->swap_options[nsh_option->option_id]) (b, opt0, nsh_md2) )
+	    {
+	      goto next_tlv_md2;
+	    }
+
+	  /* option length may be varied */
+	  new_option_size = sizeof (nsh_tlv_header_t) + nsh_md2->length;
+	  /* round to 4-byte */
+	  new_option_size = ( (new_option_size+3)>>2 ) << 2;
+	  nsh_entry->rewrite_size += new_option_size;
+	  nsh_md2 = (nsh_tlv_header_t *) (((u8 *) nsh_md2) + new_option_size);
+
+	  opt0 = (nsh_tlv_header_t *) (((u8 *) opt0) + old_option_size);
+
+	}
+      else
+	{
+next_tlv_md2:
+	  opt0 = (nsh_tlv_header_t *) (((u8 *) opt0) + old_option_size);
+	}
+    }
+
+  /* update nsh header's length */
+  nsh_base = (nsh_base_header_t *)nsh_entry->rewrite;
+  nsh_base->length = (nsh_base->length & NSH_TTL_L2_MASK) |
+                     ((nsh_entry->rewrite_size >> 2) & NSH_LEN_MASK);
+  return;
+}
+
+/*
+ * Decide whether a decapped MD2 packet takes the iOAM export branch.
+ * 1-in-N keeps a per-thread countdown. Flow mode selects on the inner
+ * flow hash, so all packets of a flow share the decision, on every node
+ * configured with the same rate.
+ */
+always_inline int
+nsh_md2_export_sample (vlib_buffer_t * b, nsh_base_header_t * hdr,
+		       u32 header_len)
+{
+  nsh_main_t *nm = &nsh_main;
+  u32 thread_index = vlib_get_thread_index ();
+  u32 rate = nm->export_sample_rate;
+  void *inner = (u8 *) hdr + header_len;
+  u32 hash = hdr->nsp_nsi;
+  u32 *countdown;
+  int sampled;
+
+  if (PREDICT_TRUE (rate <= 1))
+    sampled = 1;
+  else if (nm->export_sample_by_flow)
+    {
+      if (hdr->next_protocol == NSH_NEXT_PROTOCOL_IP4)
+	hash ^= ip4_compute_flow_hash (inner, IP_FLOW_HASH_DEFAULT);
+      else if (hdr->next_protocol == NSH_NEXT_PROTOCOL_IP6)
+	hash ^= ip6_compute_flow_hash (inner, IP_FLOW_HASH_DEFAULT);
+      sampled = (clib_xxhash (hash) % rate) == 0;
+    }
+  else
+    {
+      countdown = vec_elt_at_index (nm->export_sample_countdown,
+				    thread_index);
+      sampled = (--countdown[0] == 0);
+      if (sampled)
+	countdown[0] = rate;
+    }
+
+  vlib_increment_simple_counter
+    (&nm->export_sample_counters[sampled ? NSH_EXPORT_SAMPLE_SAMPLED :
+				 NSH_EXPORT_SAMPLE_SKIPPED],
+     thread_index, 0, 1);
+
+  return sampled;
+}
+
+always_inline void
+nsh_md2_decap (vlib_buffer_t * b,
+               nsh_base_header_t * hdr,
+	       nsh_map_t * map,
+	       u32 *header_len,
+	       u32 * next,
+	       u32 drop_node_val)
+{
+  nsh_main_t *nm = &nsh_main;
+  nsh_md2_data_t *opt0;
+  nsh_md2_data_t *limit0;
+  nsh_option_map_t *nsh_option;
+  u8 option_len = 0;
+  uword export_next;
+
+  /* Populate the NSH Header */
+  opt0 = (nsh_md2_data_t *)(hdr + 1);
+  limit0 = (nsh_md2_data_t *) ((u8 *) hdr + *header_len);
+
+  /* Scan the set of variable metadata, process ones that we understand */
+  while (opt0 < limit0)
+    {
+      nsh_option = nsh_md2_lookup_option(opt0->class, opt0->type);
+      if( nsh_option == NULL)
+	{
+	  *next = drop_node_val;
+	  return;
+	}
+
+	  if (nm->pop_options[nsh_option->option_id])
+	    {
+	      if ( (*nm->pop_options[nsh_option->option_id]) (b, opt0) )
+		{
+		  *next = drop_node_val;
+		  return;
+		}
+	    }
+      /* round to 4-byte */
+      option_len = ( (opt0->length+3)>>2 ) << 2;
+      opt0 = (nsh_md2_data_t *) (((u8 *) opt0) + sizeof (nsh_md2_data_t) + option_len);
+    }
+
+  /* Only packets carrying options are candidates for iOAM export */
+  export_next = map->export_next ? map->export_next :
+    nm->decap_v4_next_override;
+  if (PREDICT_FALSE (export_next != 0)
+      && *header_len > sizeof (nsh_base_header_t)
+      && nsh_md2_export_sample (b, hdr, *header_len))
+    {
+      *next = export_next;
+      *header_len = 0;
+    }
+
+  return;
+}
+
+/*
+ * Headroom the next node needs in front of the NSH header for its own
+ * transport encap. Ethernet + IPv6 + UDP + VXLAN-GPE is the largest.
+ */
+#define NSH_OUTER_HEADER_ROOM                                   \
+  (sizeof (ethernet_header_t) + sizeof (ip6_header_t) +         \
+   sizeof (udp_header_t) + sizeof (vxlan_gpe_header_t))
+
+/*
+ * Flags a chained header buffer takes over from the old head. Header
+ * offsets and checksum offload refer to the old head's data, so those
+ * stay behind; the encap nodes set them again for the outer headers.
+ */
+#define NSH_BUFFER_FLAGS_INHERITED                              \
+  (VLIB_BUFFER_IS_TRACED | VNET_BUFFER_F_LOCALLY_ORIGINATED)
+
+/**
+ * @brief Make room for an NSH header of len bytes in front of the packet
+ *
+ * The header normally goes into the buffer's pre-data. Should that not
+ * leave NSH_OUTER_HEADER_ROOM for the outer encap (long MD2 headers, or
+ * packets already carrying several headers) a fresh buffer holding the
+ * NSH header is chained in front of the packet instead.
+ *
+ * @param *b current head buffer
+ * @param *bi index of the head buffer, updated if a buffer is chained
+ * @param len NSH header length in bytes
+ * @param *n_chained incremented whenever a buffer is chained
+ *
+ * @return head buffer with current_data at the NSH header, 0 on
+ * buffer allocation failure
+ */
+always_inline vlib_buffer_t *
+nsh_push_header_room (vlib_main_t * vm, vlib_buffer_t * b, u32 * bi,
+                      u32 len, u32 * n_chained)
+{
+  vlib_buffer_t * hb;
+  u32 hbi;
+
+  if (PREDICT_TRUE((word) b->current_data + VLIB_BUFFER_PRE_DATA_SIZE >=
+                   (word) (len + NSH_OUTER_HEADER_ROOM)))
+    {
+      vlib_buffer_advance (b, -(word)len);
+      return b;
+    }
+
+  if (vlib_buffer_alloc (vm, &hbi, 1) != 1)
+    return 0;
+
+  hb = vlib_get_buffer (vm, hbi);
+  VLIB_BUFFER_TRACE_TRAJECTORY_INIT (hb);
+  clib_memcpy (hb->opaque, b->opaque, sizeof (b->opaque));
+  hb->current_data = 0;
+  hb->current_length = len;
+  hb->total_length_not_including_first_buffer =
+    vlib_buffer_length_in_chain (vm, b);
+  /* Keep what alloc set */
+  hb->flags |= VLIB_BUFFER_NEXT_PRESENT | VLIB_BUFFER_TOTAL_LENGTH_VALID |
+    (b->flags & NSH_BUFFER_FLAGS_INHERITED);
+  hb->next_buffer = *bi;
+  hb->trace_index = b->trace_index;
+  hb->current_config_index = b->current_config_index;
+  hb->error = b->error;
+
+  *bi = hbi;
+  *n_chained += 1;
+  return hb;
+}
+
+/*
+ * Push the fused rewrite of a VXLAN-GPE map: outer IP/UDP/VXLAN-GPE and
+ * NSH headers in one copy, then the outer length and checksum fixup.
+ * The packet leaves for the load balance of the tunnel's remote.
+ * Returns the pushed NSH header, 0 on buffer allocation failure.
+ */
+always_inline nsh_base_header_t *
+nsh_vxlan_gpe_fused_push (vlib_main_t * vm, nsh_map_t * map,
+                          vlib_buffer_t ** b, u32 * bi, u32 mark,
+                          u32 * next, u32 * n_chained)
+{
+  nsh_base_header_t * hdr;
+  vlib_buffer_t * hb;
+  u8 * outer;
+
+  hb = nsh_push_header_room (vm, *b, bi, vec_len (map->fused_rewrite),
+                             n_chained);
+  if (PREDICT_FALSE(hb == 0))
+    return 0;
+
+  outer = vlib_buffer_get_current (hb);
+  clib_memcpy (outer, map->fused_rewrite, vec_len (map->fused_rewrite));
+  ip_udp_fixup_one (vm, hb, !map->fused_is_ip6);
+
+  hdr = (nsh_base_header_t *) (outer + map->fused_outer_size);
+  hdr->ver_o_c |= mark;
+
+  *next = map->fused_is_ip6 ? NSH_NODE_NEXT_IP6_LOAD_BALANCE :
+    NSH_NODE_NEXT_IP4_LOAD_BALANCE;
+  vnet_buffer(hb)->ip.adj_index[VLIB_TX] = map->fused_dpo.dpoi_index;
+
+  *b = hb;
+  return hdr;
+}
+
+/*
+ * Run the service path policer of a mapping. Returns the base header
+ * bits to mark the packet with, or ~0 if the packet must be dropped.
+ */
+always_inline u32
+nsh_map_police (vlib_main_t * vm, nsh_fwd_tables_t * t, nsh_map_t * map,
+                vlib_buffer_t * b, u32 thread_index, u64 now, u32 * n_marked)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_policer_t * p = pool_elt_at_index (nm->policers, map->policer_index);
+  u32 len = vlib_buffer_length_in_chain (vm, b);
+  nsh_policer_result_t result;
+
+  result = nsh_policer_police (p, thread_index, now, len);
+  vlib_increment_combined_counter (&nm->policer_counters[result],
+                                   thread_index, map - t->maps, 1, len);
+
+  if (PREDICT_TRUE(result == NSH_POLICER_CONFORM))
+    return 0;
+
+  if (result == NSH_POLICER_VIOLATE
+      || p->exceed_action == NSH_POLICER_ACTION_DROP)
+    return ~0;
+
+  *n_marked += 1;
+  return (p->exceed_action == NSH_POLICER_ACTION_MARK_O_BIT) ?
+    NSH_O_BIT : NSH_C_BIT;
+}
+
+/*
+ * Account a packet to its service path. The TTL is checked before the
+ * map lookup, so expired packets need a lookup of their own here.
+ */
+always_inline void
+nsh_path_stats_count (vlib_main_t * vm, nsh_fwd_tables_t * t, nsh_map_t * map,
+                      vlib_buffer_t * b, u32 nsp_nsi, u32 error,
+                      u32 thread_index)
+{
+  nsh_main_t * nm = &nsh_main;
+  uword * p;
+  u32 map_index, reason;
+
+  if (PREDICT_FALSE(map == 0))
+    {
+      if (error != NSH_NODE_ERROR_INVALID_TTL)
+        return;
+      p = hash_get_mem (t->map_by_key, &nsp_nsi);
+      if (p == 0)
+        return;
+      map_index = p[0];
+    }
+  else
+    map_index = map - t->maps;
+
+  switch (error)
+    {
+    case 0:
+      vlib_increment_combined_counter (&nm->path_counters, thread_index,
+                                       map_index, 1,
+                                       vlib_buffer_length_in_chain (vm, b));
+      return;
+    case NSH_NODE_ERROR_INVALID_TTL:
+      reason = NSH_PATH_DROP_TTL_EXPIRED;
+      break;
+    case NSH_NODE_ERROR_NO_ENTRY:
+      reason = NSH_PATH_DROP_NO_ENTRY;
+      break;
+    case NSH_NODE_ERROR_INVALID_OPTIONS:
+      reason = NSH_PATH_DROP_INVALID_OPTIONS;
+      break;
+    case NSH_NODE_ERROR_POLICER_DROP:
+      reason = NSH_PATH_DROP_POLICER;
+      break;
+    case NSH_NODE_ERROR_NO_BUFFER:
+      reason = NSH_PATH_DROP_NO_BUFFER;
+      break;
+    default:
+      return;
+    }
+
+  vlib_increment_simple_counter (&nm->path_drop_counters[reason],
+                                 thread_index, map_index, 1);
+}
+
+/*
+ * Forward a packet without a map of its own on the hop its NSP path has
+ * for its NSI, if any: the NSH header is kept, with NSI and TTL
+ * decremented. A packet whose TTL runs out is left to the drop next
+ * with *error set, as on the map path.
+ * Returns 0 when there is no such hop.
+ */
+always_inline int
+nsh_nsp_hop_forward (vlib_buffer_t * b, nsh_base_header_t * hdr, u32 * next,
+                     u32 * error)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_nsp_path_t * path;
+  nsh_nsp_hop_t * hop;
+  u32 nsp_nsi, nsi, ttl;
+  uword * p;
+
+  if (PREDICT_TRUE(pool_elts (nm->nsp_paths) == 0))
+    return 0;
+
+  nsp_nsi = clib_net_to_host_u32 (hdr->nsp_nsi);
+  p = hash_get (nm->nsp_path_by_nsp, (nsp_nsi >> NSH_NSP_SHIFT) & NSH_NSP_MASK);
+  if (p == 0)
+    return 0;
+
+  path = pool_elt_at_index (nm->nsp_paths, p[0]);
+  nsi = nsp_nsi & NSH_NSI_MASK;
+  if (nsi >= vec_len (path->hops))
+    return 0;
+
+  hop = &path->hops[nsi];
+  if (hop->next_node == ~0)
+    return 0;
+
+  ttl = (hdr->ver_o_c & NSH_TTL_H4_MASK)<<2 |
+        (hdr->length & NSH_TTL_L2_MASK)>>6;
+  if (PREDICT_FALSE(ttl <= 1))
     {
-      old_option_size = sizeof (nsh_tlv_header_t) + opt0->length;
-      /* round to 4-byte */
-      old_option_size = ( (old_option_size+3)>>2 ) << 2;
+      *error = NSH_NODE_ERROR_INVALID_TTL;
+      return 1;
+    }
+  ttl--;
+  hdr->ver_o_c = (hdr->ver_o_c & ~NSH_TTL_H4_MASK) | (ttl >> 2);
+  hdr->length = (hdr->length & ~NSH_TTL_L2_MASK) | ((ttl & 0x3) << 6);
 
-      nsh_option = nsh_md2_lookup_option(opt0->class, opt0->type);
-      if( nsh_option == NULL)
-	{
-	  goto next_tlv_md2;
-	}
+  hdr->nsp_nsi = clib_host_to_net_u32 (nsp_nsi - 1);
+  *next = hop->next_node;
+  vnet_buffer(b)->sw_if_index[VLIB_TX] = hop->sw_if_index;
+  vnet_buffer(b)->ip.adj_index[VLIB_TX] = hop->adj_index;
 
-      if (nm->swap_options[nsh_option->option_id])
-	{
-	  if ( (*nm->swap_options[nsh_option->option_id]) (b, opt0, nsh_md2) )
-	    {
-	      goto next_tlv_md2;
-	    }
+  return 1;
+}
 
-	  /* option length may be varied */
-	  new_option_size = sizeof (nsh_tlv_header_t) + nsh_md2->length;
-	  /* round to 4-byte */
-	  new_option_size = ( (new_option_size+3)>>2 ) << 2;
-	  nsh_entry->rewrite_size += new_option_size;
-	  nsh_md2 = (nsh_tlv_header_t *) (((u8 *) nsh_md2) + new_option_size);
+/*
+ * Inner IP header of the packet an NSH header is, or is about to be,
+ * pushed on: hdr is the current NSH header on nsh-input, else the packet
+ * itself. Returns 0 for anything but IP.
+ */
+always_inline void *
+nsh_sf_pool_flow_ip (vlib_buffer_t * b, nsh_base_header_t * hdr,
+                     u32 header_len, u32 node_type, u8 * is_ip6)
+{
+  u8 * inner = vlib_buffer_get_current (b);
+  u8 version;
 
-	  opt0 = (nsh_tlv_header_t *) (((u8 *) opt0) + old_option_size);
+  if (node_type == NSH_INPUT_TYPE)
+    {
+      inner = (u8 *) hdr + header_len;
+      *is_ip6 = hdr->next_protocol == NSH_NEXT_PROTOCOL_IP6;
+      if (hdr->next_protocol == NSH_NEXT_PROTOCOL_IP4
+          || hdr->next_protocol == NSH_NEXT_PROTOCOL_IP6)
+        return inner;
+      if (hdr->next_protocol != NSH_NEXT_PROTOCOL_ETHERNET)
+        return 0;
+    }
 
-	}
-      else
-	{
-next_tlv_md2:
-	  opt0 = (nsh_tlv_header_t *) (((u8 *) opt0) + old_option_size);
-	}
+  /* Bare IP from ip4/ip6-classify, Ethernet otherwise */
+  version = inner[0] >> 4;
+  if ((version == 4 || version == 6) && node_type == NSH_CLASSIFIER_TYPE)
+    {
+      *is_ip6 = version == 6;
+      return inner;
     }
 
-  /* update nsh header's length */
-  nsh_base = (nsh_base_header_t *)nsh_entry->rewrite;
-  nsh_base->length = (nsh_base->length & NSH_TTL_L2_MASK) |
-                     ((nsh_entry->rewrite_size >> 2) & NSH_LEN_MASK);
-  return;
+  if (((ethernet_header_t *) inner)->type
+      == clib_host_to_net_u16 (ETHERNET_TYPE_IP4))
+    {
+      *is_ip6 = 0;
+      return inner + sizeof (ethernet_header_t);
+    }
+  if (((ethernet_header_t *) inner)->type
+      == clib_host_to_net_u16 (ETHERNET_TYPE_IP6))
+    {
+      *is_ip6 = 1;
+      return inner + sizeof (ethernet_header_t);
+    }
+
+  return 0;
 }
 
+/*
+ * Steer a packet to the SF instance its flow hashes to in the map's
+ * SF pool: one load of the Maglev table. A pool without members leaves
+ * the map's own next hop in place. Symmetric pools also keep both
+ * directions of a flow on one instance, see nsh_sf_pool.c.
+ */
 always_inline void
-nsh_md2_decap (vlib_buffer_t * b,
-               nsh_base_header_t * hdr,
-	       u32 *header_len,
-	       u32 * next,
-	       u32 drop_node_val)
+nsh_sf_pool_select (vlib_buffer_t * b, nsh_map_t * map,
+                    nsh_base_header_t * hdr, u32 header_len,
+                    u32 node_type, u32 * next)
 {
-  nsh_main_t *nm = &nsh_main;
-  nsh_md2_data_t *opt0;
-  nsh_md2_data_t *limit0;
-  nsh_option_map_t *nsh_option;
-  u8 option_len = 0;
-
-  /* Populate the NSH Header */
-  opt0 = (nsh_md2_data_t *)(hdr + 1);
-  limit0 = (nsh_md2_data_t *) ((u8 *) hdr + *header_len);
-
-  /* Scan the set of variable metadata, process ones that we understand */
-  while (opt0 < limit0)
+  nsh_sf_pool_t * pool = pool_elt_at_index (nsh_main.sf_pools,
+                                            map->sf_pool_index);
+  nsh_sf_member_t * lookup = pool->lookup, * m;
+  u32 hash = 0;
+  u8 is_ip6 = 0;
+  void * ip;
+
+  if (PREDICT_FALSE(lookup == 0))
+    return;
+
+  ip = nsh_sf_pool_flow_ip (b, hdr, header_len, node_type, &is_ip6);
+  if (PREDICT_FALSE(pool->symmetric))
+    m = nsh_sf_pool_symmetric_select (pool, lookup, ip, is_ip6);
+  else
     {
-      nsh_option = nsh_md2_lookup_option(opt0->class, opt0->type);
-      if( nsh_option == NULL)
-	{
-	  *next = drop_node_val;
-	  return;
-	}
-
-	  if (nm->pop_options[nsh_option->option_id])
-	    {
-	      if ( (*nm->pop_options[nsh_option->option_id]) (b, opt0) )
-		{
-		  *next = drop_node_val;
-		  return;
-		}
-	    }
-      /* round to 4-byte */
-      option_len = ( (opt0->length+3)>>2 ) << 2;
-      opt0 = (nsh_md2_data_t *) (((u8 *) opt0) + sizeof (nsh_md2_data_t) + option_len);
-      *next = (nm->decap_v4_next_override) ? (nm->decap_v4_next_override) : (*next);
-      *header_len = (nm->decap_v4_next_override) ? 0 : (*header_len);
+      if (ip)
+        hash = is_ip6
+          ? ip6_compute_flow_hash ((ip6_header_t *) ip, IP_FLOW_HASH_DEFAULT)
+          : ip4_compute_flow_hash ((ip4_header_t *) ip, IP_FLOW_HASH_DEFAULT);
+      m = &lookup[hash % NSH_SF_POOL_TABLE_SIZE];
     }
 
-  return;
+  *next = m->next_node;
+  vnet_buffer(b)->sw_if_index[VLIB_TX] = m->sw_if_index;
+  vnet_buffer(b)->ip.adj_index[VLIB_TX] = m->adj_index;
 }
 
 static uword
@@ -1644,6 +3431,10 @@ nsh_input_map (vlib_main_t * vm,
 {
   u32 n_left_from, next_index, *from, *to_next;
   nsh_main_t * nm = &nsh_main;
+  u32 n_chained = 0, n_marked = 0;
+  u32 thread_index = vlib_get_thread_index ();
+  u64 now = clib_cpu_time_now ();
+  nsh_fwd_tables_t _t, * t = nsh_fwd_tables_get (thread_index, &_t);
 
   from = vlib_frame_vector_args(from_frame);
   n_left_from = from_frame->n_vectors;
@@ -1660,12 +3451,14 @@ nsh_input_map (vlib_main_t * vm,
 	{
 	  u32 bi0, bi1;
 	  vlib_buffer_t * b0, *b1;
+	  vlib_buffer_t * hb0, *hb1;
 	  u32 next0 = NSH_NODE_NEXT_DROP, next1 = NSH_NODE_NEXT_DROP;
 	  uword * entry0, *entry1;
 	  nsh_base_header_t * hdr0 = 0, *hdr1 = 0;
 	  u32 header_len0 = 0, header_len1 = 0;
-	  u32 nsp_nsi0, nsp_nsi1;
+	  u32 nsp_nsi0 = 0, nsp_nsi1 = 0;
 	  u32 ttl0, ttl1;
+	  u32 mark0 = 0, mark1 = 0;
 	  u32 error0, error1;
 	  nsh_map_t * map0 = 0, *map1 = 0;
 	  nsh_entry_t * nsh_entry0 = 0, *nsh_entry1 = 0;
@@ -1718,6 +3511,11 @@ nsh_input_map (vlib_main_t * vm,
        		  error0 = NSH_NODE_ERROR_INVALID_TTL;
        		  goto trace0;
        		}
+              if (PREDICT_FALSE(header_len0 > b0->current_length))
+                {
+                  error0 = NSH_NODE_ERROR_HEADER_SPANS_BUFFERS;
+                  goto trace0;
+                }
             }
           else if(node_type == NSH_CLASSIFIER_TYPE)
             {
@@ -1773,6 +3571,11 @@ nsh_input_map (vlib_main_t * vm,
        		  error1 = NSH_NODE_ERROR_INVALID_TTL;
        		  goto trace1;
        		}
+              if (PREDICT_FALSE(header_len1 > b1->current_length))
+                {
+                  error1 = NSH_NODE_ERROR_HEADER_SPANS_BUFFERS;
+                  goto trace1;
+                }
 	    }
           else if(node_type == NSH_CLASSIFIER_TYPE)
             {
@@ -1816,32 +3619,76 @@ nsh_input_map (vlib_main_t * vm,
 	    }
 
 	  /* Process packet 0 */
-	  entry0 = hash_get_mem(nm->nsh_mapping_by_key, &nsp_nsi0);
+	  entry0 = hash_get_mem(t->map_by_key, &nsp_nsi0);
 	  if (PREDICT_FALSE(entry0 == 0))
 	    {
+	      if (node_type == NSH_INPUT_TYPE
+	          && nsh_nsp_hop_forward (b0, hdr0, &next0,
+	                                  &error0))
+	        goto trace0;
 	      error0 = NSH_NODE_ERROR_NO_MAPPING;
 	      goto trace0;
 	    }
 
 	  /* Entry should point to a mapping ...*/
-	  map0 = pool_elt_at_index(nm->nsh_mappings, entry0[0]);
+	  map0 = vec_elt_at_index(t->maps, entry0[0]);
 	  if (PREDICT_FALSE(map0 == 0))
 	    {
 	      error0 = NSH_NODE_ERROR_NO_MAPPING;
 	      goto trace0;
 	    }
 
+	  /* Police the service path before doing any work on the packet */
+	  if (PREDICT_FALSE(map0->policer_index != ~0))
+	    {
+	      mark0 = nsh_map_police (vm, t, map0, b0, thread_index, now,
+	                               &n_marked);
+	      if (PREDICT_FALSE(mark0 == ~0))
+	        {
+	          error0 = NSH_NODE_ERROR_POLICER_DROP;
+	          goto trace0;
+	        }
+	    }
+
 	  /* set up things for next node to transmit ie which node to handle it and where */
 	  next0 = map0->next_node;
 	  vnet_buffer(b0)->sw_if_index[VLIB_TX] = map0->sw_if_index;
 	  vnet_buffer(b0)->ip.adj_index[VLIB_TX] = map0->adj_index;
+	  if (PREDICT_FALSE(map0->sf_pool_index != ~0))
+	    nsh_sf_pool_select (b0, map0, hdr0, header_len0, node_type,
+	                        &next0);
+
+	  /* Fused VXLAN-GPE maps need neither the entry nor vxlan-gpe-encap */
+	  if (map0->fused_rewrite && map0->sf_pool_index == ~0
+	      && (map0->nsh_action == NSH_ACTION_PUSH
+	          || (map0->nsh_action == NSH_ACTION_SWAP
+	              && hdr0->md_type == 1)))
+	    {
+	      nsh_base_header_t * fused_hdr0;
+
+	      if (map0->nsh_action == NSH_ACTION_SWAP)
+	        vlib_buffer_advance(b0, (word)header_len0);
+
+	      fused_hdr0 = nsh_vxlan_gpe_fused_push (vm, map0, &b0, &bi0,
+	                                              mark0, &next0,
+	                                              &n_chained);
+	      if (PREDICT_FALSE(fused_hdr0 == 0))
+	        {
+	          error0 = NSH_NODE_ERROR_NO_BUFFER;
+	          next0 = NSH_NODE_NEXT_DROP;
+	          goto trace0;
+	        }
+	      to_next[-2] = bi0;
+	      hdr0 = fused_hdr0;
+	      goto trace0;
+	    }
 
 	  if(PREDICT_FALSE(map0->nsh_action == NSH_ACTION_POP))
 	    {
 	      /* Manipulate MD2 */
               if(PREDICT_FALSE(hdr0->md_type == 2))
         	{
-        	  nsh_md2_decap(b0, hdr0, &header_len0, &next0, NSH_NODE_NEXT_DROP);
+        	  nsh_md2_decap(b0, hdr0, map0, &header_len0, &next0, NSH_NODE_NEXT_DROP);
         	  if (PREDICT_FALSE(next0 == NSH_NODE_NEXT_DROP))
         	    {
         	      error0 = NSH_NODE_ERROR_INVALID_OPTIONS;
@@ -1855,14 +3702,14 @@ nsh_input_map (vlib_main_t * vm,
 	      goto trace0;
 	    }
 
-	  entry0 = hash_get_mem(nm->nsh_entry_by_key, &map0->mapped_nsp_nsi);
+	  entry0 = hash_get_mem(t->entry_by_key, &map0->mapped_nsp_nsi);
 	  if (PREDICT_FALSE(entry0 == 0))
 	    {
 	      error0 = NSH_NODE_ERROR_NO_ENTRY;
 	      goto trace0;
 	    }
 
-	  nsh_entry0 = (nsh_entry_t *)pool_elt_at_index(nm->nsh_entries, entry0[0]);
+	  nsh_entry0 = vec_elt_at_index(t->entries, entry0[0]);
 	  encap_hdr0 = (nsh_base_header_t *)(nsh_entry0->rewrite);
 	  /* rewrite_size should equal to (encap_hdr0->length * 4) */
 	  encap_hdr_len0 = nsh_entry0->rewrite_size;
@@ -1887,9 +3734,19 @@ nsh_input_map (vlib_main_t * vm,
               /* After processing, md2's length may be varied */
               encap_hdr_len0 = nsh_entry0->rewrite_size;
 	      /* Push new NSH header */
-	      vlib_buffer_advance(b0, -(word)encap_hdr_len0);
+	      hb0 = nsh_push_header_room (vm, b0, &bi0, encap_hdr_len0,
+	                                     &n_chained);
+	      if (PREDICT_FALSE(hb0 == 0))
+	        {
+	          error0 = NSH_NODE_ERROR_NO_BUFFER;
+	          next0 = NSH_NODE_NEXT_DROP;
+	          goto trace0;
+	        }
+	      b0 = hb0;
+	      to_next[-2] = bi0;
 	      hdr0 = vlib_buffer_get_current(b0);
 	      clib_memcpy(hdr0, encap_hdr0, (word)encap_hdr_len0);
+	      hdr0->ver_o_c |= mark0;
 
 	      goto trace0;
 	    }
@@ -1899,9 +3756,19 @@ nsh_input_map (vlib_main_t * vm,
               /* After processing, md2's length may be varied */
               encap_hdr_len0 = nsh_entry0->rewrite_size;
 	      /* Push new NSH header */
-	      vlib_buffer_advance(b0, -(word)encap_hdr_len0);
+	      hb0 = nsh_push_header_room (vm, b0, &bi0, encap_hdr_len0,
+	                                     &n_chained);
+	      if (PREDICT_FALSE(hb0 == 0))
+	        {
+	          error0 = NSH_NODE_ERROR_NO_BUFFER;
+	          next0 = NSH_NODE_NEXT_DROP;
+	          goto trace0;
+	        }
+	      b0 = hb0;
+	      to_next[-2] = bi0;
 	      hdr0 = vlib_buffer_get_current(b0);
 	      clib_memcpy(hdr0, encap_hdr0, (word)encap_hdr_len0);
+	      hdr0->ver_o_c |= mark0;
 
 	      /* Manipulate MD2 */
               if(PREDICT_FALSE(nsh_entry0->nsh_base.md_type == 2))
@@ -1913,6 +3780,10 @@ nsh_input_map (vlib_main_t * vm,
 
         trace0: b0->error = error0 ? node->errors[error0] : 0;
 
+	  if (PREDICT_FALSE(nm->path_stats_enabled))
+	    nsh_path_stats_count (vm, t, map0, b0, nsp_nsi0, error0,
+	                          thread_index);
+
           if (PREDICT_FALSE(b0->flags & VLIB_BUFFER_IS_TRACED))
             {
               nsh_input_trace_t *tr = vlib_add_trace(vm, node, b0, sizeof(*tr));
@@ -1920,32 +3791,76 @@ nsh_input_map (vlib_main_t * vm,
             }
 
 	  /* Process packet 1 */
-	  entry1 = hash_get_mem(nm->nsh_mapping_by_key, &nsp_nsi1);
+	  entry1 = hash_get_mem(t->map_by_key, &nsp_nsi1);
 	  if (PREDICT_FALSE(entry1 == 0))
 	    {
+	      if (node_type == NSH_INPUT_TYPE
+	          && nsh_nsp_hop_forward (b1, hdr1, &next1,
+	                                  &error1))
+	        goto trace1;
 	      error1 = NSH_NODE_ERROR_NO_MAPPING;
 	      goto trace1;
 	    }
 
 	  /* Entry should point to a mapping ...*/
-	  map1 = pool_elt_at_index(nm->nsh_mappings, entry1[0]);
+	  map1 = vec_elt_at_index(t->maps, entry1[0]);
 	  if (PREDICT_FALSE(map1 == 0))
 	    {
 	      error1 = NSH_NODE_ERROR_NO_MAPPING;
 	      goto trace1;
 	    }
 
+	  /* Police the service path before doing any work on the packet */
+	  if (PREDICT_FALSE(map1->policer_index != ~0))
+	    {
+	      mark1 = nsh_map_police (vm, t, map1, b1, thread_index, now,
+	                               &n_marked);
+	      if (PREDICT_FALSE(mark1 == ~0))
+	        {
+	          error1 = NSH_NODE_ERROR_POLICER_DROP;
+	          goto trace1;
+	        }
+	    }
+
 	  /* set up things for next node to transmit ie which node to handle it and where */
 	  next1 = map1->next_node;
 	  vnet_buffer(b1)->sw_if_index[VLIB_TX] = map1->sw_if_index;
 	  vnet_buffer(b1)->ip.adj_index[VLIB_TX] = map1->adj_index;
+	  if (PREDICT_FALSE(map1->sf_pool_index != ~0))
+	    nsh_sf_pool_select (b1, map1, hdr1, header_len1, node_type,
+	                        &next1);
+
+	  /* Fused VXLAN-GPE maps need neither the entry nor vxlan-gpe-encap */
+	  if (map1->fused_rewrite && map1->sf_pool_index == ~0
+	      && (map1->nsh_action == NSH_ACTION_PUSH
+	          || (map1->nsh_action == NSH_ACTION_SWAP
+	              && hdr1->md_type == 1)))
+	    {
+	      nsh_base_header_t * fused_hdr1;
+
+	      if (map1->nsh_action == NSH_ACTION_SWAP)
+	        vlib_buffer_advance(b1, (word)header_len1);
+
+	      fused_hdr1 = nsh_vxlan_gpe_fused_push (vm, map1, &b1, &bi1,
+	                                              mark1, &next1,
+	                                              &n_chained);
+	      if (PREDICT_FALSE(fused_hdr1 == 0))
+	        {
+	          error1 = NSH_NODE_ERROR_NO_BUFFER;
+	          next1 = NSH_NODE_NEXT_DROP;
+	          goto trace1;
+	        }
+	      to_next[-1] = bi1;
+	      hdr1 = fused_hdr1;
+	      goto trace1;
+	    }
 
 	  if(PREDICT_FALSE(map1->nsh_action == NSH_ACTION_POP))
 	    {
 	      /* Manipulate MD2 */
               if(PREDICT_FALSE(hdr1->md_type == 2))
         	{
-        	  nsh_md2_decap(b1, hdr1, &header_len1, &next1, NSH_NODE_NEXT_DROP);
+        	  nsh_md2_decap(b1, hdr1, map1, &header_len1, &next1, NSH_NODE_NEXT_DROP);
         	  if (PREDICT_FALSE(next1 == NSH_NODE_NEXT_DROP))
         	    {
         	      error1 = NSH_NODE_ERROR_INVALID_OPTIONS;
@@ -1959,14 +3874,14 @@ nsh_input_map (vlib_main_t * vm,
 	      goto trace1;
 	    }
 
-	  entry1 = hash_get_mem(nm->nsh_entry_by_key, &map1->mapped_nsp_nsi);
+	  entry1 = hash_get_mem(t->entry_by_key, &map1->mapped_nsp_nsi);
 	  if (PREDICT_FALSE(entry1 == 0))
 	    {
 	      error1 = NSH_NODE_ERROR_NO_ENTRY;
 	      goto trace1;
 	    }
 
-	  nsh_entry1 = (nsh_entry_t *)pool_elt_at_index(nm->nsh_entries, entry1[0]);
+	  nsh_entry1 = vec_elt_at_index(t->entries, entry1[0]);
 	  encap_hdr1 = (nsh_base_header_t *)(nsh_entry1->rewrite);
 	  /* rewrite_size should equal to (encap_hdr0->length * 4) */
 	  encap_hdr_len1 = nsh_entry1->rewrite_size;
@@ -1991,9 +3906,19 @@ nsh_input_map (vlib_main_t * vm,
               /* After processing, md2's length may be varied */
               encap_hdr_len1 = nsh_entry1->rewrite_size;
 	      /* Push new NSH header */
-	      vlib_buffer_advance(b1, -(word)encap_hdr_len1);
+	      hb1 = nsh_push_header_room (vm, b1, &bi1, encap_hdr_len1,
+	                                     &n_chained);
+	      if (PREDICT_FALSE(hb1 == 0))
+	        {
+	          error1 = NSH_NODE_ERROR_NO_BUFFER;
+	          next1 = NSH_NODE_NEXT_DROP;
+	          goto trace1;
+	        }
+	      b1 = hb1;
+	      to_next[-1] = bi1;
 	      hdr1 = vlib_buffer_get_current(b1);
 	      clib_memcpy(hdr1, encap_hdr1, (word)encap_hdr_len1);
+	      hdr1->ver_o_c |= mark1;
 
 	      goto trace1;
 	    }
@@ -2003,9 +3928,19 @@ nsh_input_map (vlib_main_t * vm,
               /* After processing, md2's length may be varied */
               encap_hdr_len1 = nsh_entry1->rewrite_size;
 	      /* Push new NSH header */
-	      vlib_buffer_advance(b1, -(word)encap_hdr_len1);
+	      hb1 = nsh_push_header_room (vm, b1, &bi1, encap_hdr_len1,
+	                                     &n_chained);
+	      if (PREDICT_FALSE(hb1 == 0))
+	        {
+	          error1 = NSH_NODE_ERROR_NO_BUFFER;
+	          next1 = NSH_NODE_NEXT_DROP;
+	          goto trace1;
+	        }
+	      b1 = hb1;
+	      to_next[-1] = bi1;
 	      hdr1 = vlib_buffer_get_current(b1);
 	      clib_memcpy(hdr1, encap_hdr1, (word)encap_hdr_len1);
+	      hdr1->ver_o_c |= mark1;
 
 	      /* Manipulate MD2 */
               if(PREDICT_FALSE(nsh_entry1->nsh_base.md_type == 2))
@@ -2017,6 +3952,10 @@ nsh_input_map (vlib_main_t * vm,
 
 	trace1: b1->error = error1 ? node->errors[error1] : 0;
 
+	  if (PREDICT_FALSE(nm->path_stats_enabled))
+	    nsh_path_stats_count (vm, t, map1, b1, nsp_nsi1, error1,
+	                          thread_index);
+
 	  if (PREDICT_FALSE(b1->flags & VLIB_BUFFER_IS_TRACED))
 	    {
 	      nsh_input_trace_t *tr = vlib_add_trace(vm, node, b1, sizeof(*tr));
@@ -2032,12 +3971,14 @@ nsh_input_map (vlib_main_t * vm,
 	{
 	  u32 bi0 = 0;
 	  vlib_buffer_t * b0 = NULL;
+	  vlib_buffer_t * hb0;
 	  u32 next0 = NSH_NODE_NEXT_DROP;
 	  uword * entry0;
 	  nsh_base_header_t * hdr0 = 0;
 	  u32 header_len0 = 0;
-	  u32 nsp_nsi0;
+	  u32 nsp_nsi0 = 0;
 	  u32 ttl0;
+	  u32 mark0 = 0;
 	  u32 error0;
 	  nsh_map_t * map0 = 0;
 	  nsh_entry_t * nsh_entry0 = 0;
@@ -2072,6 +4013,11 @@ nsh_input_map (vlib_main_t * vm,
        		  error0 = NSH_NODE_ERROR_INVALID_TTL;
        		  goto trace00;
        		}
+              if (PREDICT_FALSE(header_len0 > b0->current_length))
+                {
+                  error0 = NSH_NODE_ERROR_HEADER_SPANS_BUFFERS;
+                  goto trace00;
+                }
             }
           else if(node_type == NSH_CLASSIFIER_TYPE)
             {
@@ -2114,16 +4060,20 @@ nsh_input_map (vlib_main_t * vm,
 	      nsp_nsi0 = proxy0->nsp_nsi;
 	    }
 
-	  entry0 = hash_get_mem(nm->nsh_mapping_by_key, &nsp_nsi0);
+	  entry0 = hash_get_mem(t->map_by_key, &nsp_nsi0);
 
 	  if (PREDICT_FALSE(entry0 == 0))
 	    {
+	      if (node_type == NSH_INPUT_TYPE
+	          && nsh_nsp_hop_forward (b0, hdr0, &next0,
+	                                  &error0))
+	        goto trace00;
 	      error0 = NSH_NODE_ERROR_NO_MAPPING;
 	      goto trace00;
 	    }
 
 	  /* Entry should point to a mapping ...*/
-	  map0 = pool_elt_at_index(nm->nsh_mappings, entry0[0]);
+	  map0 = vec_elt_at_index(t->maps, entry0[0]);
 
 	  if (PREDICT_FALSE(map0 == 0))
 	    {
@@ -2131,18 +4081,60 @@ nsh_input_map (vlib_main_t * vm,
 	      goto trace00;
 	    }
 
+	  /* Police the service path before doing any work on the packet */
+	  if (PREDICT_FALSE(map0->policer_index != ~0))
+	    {
+	      mark0 = nsh_map_police (vm, t, map0, b0, thread_index, now,
+	                               &n_marked);
+	      if (PREDICT_FALSE(mark0 == ~0))
+	        {
+	          error0 = NSH_NODE_ERROR_POLICER_DROP;
+	          goto trace00;
+	        }
+	    }
+
 	  /* set up things for next node to transmit ie which node to handle it and where */
 	  next0 = map0->next_node;
 	  vnet_buffer(b0)->sw_if_index[VLIB_TX] = map0->sw_if_index;
 	  vnet_buffer(b0)->ip.adj_index[VLIB_TX] = map0->adj_index;
-	  vnet_buffer(b0)->sw_if_index[VLIB_RX] = map0->nsh_sw_if;
+	  if (PREDICT_FALSE(map0->sf_pool_index != ~0))
+	    nsh_sf_pool_select (b0, map0, hdr0, header_len0, node_type,
+	                        &next0);
+
+	  if (PREDICT_TRUE(map0->nsh_sw_if != ~0))
+	    vnet_buffer(b0)->sw_if_index[VLIB_RX] = map0->nsh_sw_if;
+
+	  /* Fused VXLAN-GPE maps need neither the entry nor vxlan-gpe-encap */
+	  if (map0->fused_rewrite && map0->sf_pool_index == ~0
+	      && (map0->nsh_action == NSH_ACTION_PUSH
+	          || (map0->nsh_action == NSH_ACTION_SWAP
+	              && hdr0->md_type == 1)))
+	    {
+	      nsh_base_header_t * fused_hdr0;
+
+	      if (map0->nsh_action == NSH_ACTION_SWAP)
+	        vlib_buffer_advance(b0, (word)header_len0);
+
+	      fused_hdr0 = nsh_vxlan_gpe_fused_push (vm, map0, &b0, &bi0,
+	                                              mark0, &next0,
+	                                              &n_chained);
+	      if (PREDICT_FALSE(fused_hdr0 == 0))
+	        {
+	          error0 = NSH_NODE_ERROR_NO_BUFFER;
+	          next0 = NSH_NODE_NEXT_DROP;
+	          goto trace00;
+	        }
+	      to_next[-1] = bi0;
+	      hdr0 = fused_hdr0;
+	      goto trace00;
+	    }
 
 	  if(PREDICT_FALSE(map0->nsh_action == NSH_ACTION_POP))
 	    {
 	      /* Manipulate MD2 */
               if(PREDICT_FALSE(hdr0->md_type == 2))
         	{
-        	  nsh_md2_decap(b0, hdr0, &header_len0, &next0, NSH_NODE_NEXT_DROP);
+        	  nsh_md2_decap(b0, hdr0, map0, &header_len0, &next0, NSH_NODE_NEXT_DROP);
         	  if (PREDICT_FALSE(next0 == NSH_NODE_NEXT_DROP))
         	    {
         	      error0 = NSH_NODE_ERROR_INVALID_OPTIONS;
@@ -2156,14 +4148,14 @@ nsh_input_map (vlib_main_t * vm,
 	      goto trace00;
 	    }
 
-	  entry0 = hash_get_mem(nm->nsh_entry_by_key, &map0->mapped_nsp_nsi);
+	  entry0 = hash_get_mem(t->entry_by_key, &map0->mapped_nsp_nsi);
 	  if (PREDICT_FALSE(entry0 == 0))
 	    {
 	      error0 = NSH_NODE_ERROR_NO_ENTRY;
 	      goto trace00;
 	    }
 
-	  nsh_entry0 = (nsh_entry_t *)pool_elt_at_index(nm->nsh_entries, entry0[0]);
+	  nsh_entry0 = vec_elt_at_index(t->entries, entry0[0]);
 	  encap_hdr0 = (nsh_base_header_t *)(nsh_entry0->rewrite);
 	  /* rewrite_size should equal to (encap_hdr0->length * 4) */
 	  encap_hdr_len0 = nsh_entry0->rewrite_size;
@@ -2188,9 +4180,19 @@ nsh_input_map (vlib_main_t * vm,
               /* After processing, md2's length may be varied */
               encap_hdr_len0 = nsh_entry0->rewrite_size;
 	      /* Push new NSH header */
-	      vlib_buffer_advance(b0, -(word)encap_hdr_len0);
+	      hb0 = nsh_push_header_room (vm, b0, &bi0, encap_hdr_len0,
+	                                     &n_chained);
+	      if (PREDICT_FALSE(hb0 == 0))
+	        {
+	          error0 = NSH_NODE_ERROR_NO_BUFFER;
+	          next0 = NSH_NODE_NEXT_DROP;
+	          goto trace00;
+	        }
+	      b0 = hb0;
+	      to_next[-1] = bi0;
 	      hdr0 = vlib_buffer_get_current(b0);
 	      clib_memcpy(hdr0, encap_hdr0, (word)encap_hdr_len0);
+	      hdr0->ver_o_c |= mark0;
 
 	      goto trace00;
 	    }
@@ -2200,9 +4202,19 @@ nsh_input_map (vlib_main_t * vm,
               /* After processing, md2's length may be varied */
               encap_hdr_len0 = nsh_entry0->rewrite_size;
 	      /* Push new NSH header */
-	      vlib_buffer_advance(b0, -(word)encap_hdr_len0);
+	      hb0 = nsh_push_header_room (vm, b0, &bi0, encap_hdr_len0,
+	                                     &n_chained);
+	      if (PREDICT_FALSE(hb0 == 0))
+	        {
+	          error0 = NSH_NODE_ERROR_NO_BUFFER;
+	          next0 = NSH_NODE_NEXT_DROP;
+	          goto trace00;
+	        }
+	      b0 = hb0;
+	      to_next[-1] = bi0;
 	      hdr0 = vlib_buffer_get_current(b0);
 	      clib_memcpy(hdr0, encap_hdr0, (word)encap_hdr_len0);
+	      hdr0->ver_o_c |= mark0;
 	      /* Manipulate MD2 */
               if(PREDICT_FALSE(nsh_entry0->nsh_base.md_type == 2))
         	{
@@ -2213,6 +4225,10 @@ nsh_input_map (vlib_main_t * vm,
 
 	  trace00: b0->error = error0 ? node->errors[error0] : 0;
 
+	  if (PREDICT_FALSE(nm->path_stats_enabled))
+	    nsh_path_stats_count (vm, t, map0, b0, nsp_nsi0, error0,
+	                          thread_index);
+
 	  if (PREDICT_FALSE(b0->flags & VLIB_BUFFER_IS_TRACED))
 	    {
 	      nsh_input_trace_t *tr = vlib_add_trace(vm, node, b0, sizeof(*tr));
@@ -2227,6 +4243,11 @@ nsh_input_map (vlib_main_t * vm,
 
     }
 
+  vlib_node_increment_counter (vm, node->node_index,
+                               NSH_NODE_ERROR_CHAINED_HEADER, n_chained);
+  vlib_node_increment_counter (vm, node->node_index,
+                               NSH_NODE_ERROR_POLICER_MARK, n_marked);
+
   return from_frame->n_vectors;
 }
 
@@ -2302,6 +4323,149 @@ nsh_aware_vnf_proxy (vlib_main_t * vm, vlib_node_runtime_t * node,
   return nsh_input_map (vm, node, from_frame, NSH_AWARE_VNF_PROXY_TYPE);
 }
 
+/**
+ * @brief Graph processing dispatch function for VXLAN-GPE + NSH Input
+ *
+ * Decaps IPv4 VXLAN-GPE packets carrying NSH the way vxlan4-gpe-input
+ * would, then runs the NSH map over them within the same dispatch.
+ * Anything else (another protocol, an unknown tunnel, NSH while handoff
+ * is enabled, MD2 when iOAM export has no next here) is passed on
+ * untouched to vxlan4-gpe-input.
+ *
+ * @node vxlan4_gpe_nsh_input
+ * @param *vm
+ * @param *node
+ * @param *from_frame
+ *
+ * @return from_frame->n_vectors
+ *
+ */
+static uword
+vxlan4_gpe_nsh_input (vlib_main_t * vm, vlib_node_runtime_t * node,
+                      vlib_frame_t * from_frame)
+{
+  nsh_main_t * nm = &nsh_main;
+  vxlan_gpe_main_t * ngm = &vxlan_gpe_main;
+  vnet_main_t * vnm = vnet_get_main ();
+  u32 thread_index = vlib_get_thread_index ();
+  u32 n_vectors = from_frame->n_vectors;
+  u32 * from, * to_next, * bypass;
+  u32 n_nsh = 0, n_bypass = 0, n_left_to_next;
+  u32 bypass_buffers[VLIB_FRAME_SIZE];
+  vxlan4_gpe_tunnel_key_t last_key;
+  vxlan_gpe_tunnel_t * t0 = 0;
+  u32 stats_sw_if_index = ~0, stats_n_packets = 0, stats_n_bytes = 0;
+  u32 i;
+
+  memset (&last_key, 0xff, sizeof (last_key));
+  from = vlib_frame_vector_args (from_frame);
+
+  for (i = 0; i < n_vectors; i++)
+    {
+      u32 bi0 = from[i];
+      vlib_buffer_t * b0;
+      ip4_vxlan_gpe_header_t * iuvn4_0;
+      vxlan4_gpe_tunnel_key_t key0;
+      uword * p0;
+      u32 len0;
+
+      if (i + 1 < n_vectors)
+        {
+          vlib_buffer_t * p1 = vlib_get_buffer (vm, from[i + 1]);
+          vlib_prefetch_buffer_header (p1, LOAD);
+          CLIB_PREFETCH (p1->data, 2 * CLIB_CACHE_LINE_BYTES, LOAD);
+        }
+
+      b0 = vlib_get_buffer (vm, bi0);
+
+      /* udp4-input leaves us on the vxlan-gpe header */
+      iuvn4_0 = (ip4_vxlan_gpe_header_t *)
+        ((u8 *) vlib_buffer_get_current (b0)
+         - sizeof (udp_header_t) - sizeof (ip4_header_t));
+
+      if (PREDICT_FALSE (nm->handoff_enabled
+                         || iuvn4_0->vxlan.protocol != VXLAN_GPE_PROTOCOL_NSH
+                         || (nm->vxlan_gpe_nsh_md2_bypass
+                             && ((nsh_base_header_t *) (iuvn4_0 + 1))
+                             ->md_type == 2)))
+        {
+          bypass_buffers[n_bypass++] = bi0;
+          continue;
+        }
+
+      key0.local = iuvn4_0->ip4.dst_address.as_u32;
+      key0.remote = iuvn4_0->ip4.src_address.as_u32;
+      key0.vni = iuvn4_0->vxlan.vni_res;
+      key0.pad = 0;
+
+      if (PREDICT_FALSE (memcmp (&key0, &last_key, sizeof (key0)) != 0))
+        {
+          p0 = hash_get_mem (ngm->vxlan4_gpe_tunnel_by_key, &key0);
+          if (p0 == 0)
+            {
+              bypass_buffers[n_bypass++] = bi0;
+              continue;
+            }
+          last_key = key0;
+          t0 = pool_elt_at_index (ngm->tunnels, p0[0]);
+        }
+
+      vlib_buffer_advance (b0, sizeof (vxlan_gpe_header_t));
+
+      vnet_buffer (b0)->sw_if_index[VLIB_RX] = t0->sw_if_index;
+      vnet_buffer (b0)->sw_if_index[VLIB_TX] = t0->decap_fib_index;
+
+      len0 = vlib_buffer_length_in_chain (vm, b0);
+      if (PREDICT_FALSE (t0->sw_if_index != stats_sw_if_index))
+        {
+          if (stats_n_packets)
+            vlib_increment_combined_counter
+              (vnm->interface_main.combined_sw_if_counters
+               + VNET_INTERFACE_COUNTER_RX, thread_index,
+               stats_sw_if_index, stats_n_packets, stats_n_bytes);
+          stats_sw_if_index = t0->sw_if_index;
+          stats_n_packets = 0;
+          stats_n_bytes = 0;
+        }
+      stats_n_packets++;
+      stats_n_bytes += len0;
+
+      /* n_nsh <= i, compacting in place is safe */
+      from[n_nsh++] = bi0;
+    }
+
+  if (stats_n_packets)
+    vlib_increment_combined_counter
+      (vnm->interface_main.combined_sw_if_counters
+       + VNET_INTERFACE_COUNTER_RX, thread_index,
+       stats_sw_if_index, stats_n_packets, stats_n_bytes);
+
+  bypass = bypass_buffers;
+  while (n_bypass > 0)
+    {
+      u32 n_copy;
+
+      vlib_get_next_frame (vm, node, NSH_NODE_NEXT_VXLAN4_GPE_INPUT,
+                           to_next, n_left_to_next);
+      n_copy = clib_min (n_bypass, n_left_to_next);
+      clib_memcpy (to_next, bypass, n_copy * sizeof (u32));
+      bypass += n_copy;
+      n_bypass -= n_copy;
+      vlib_put_next_frame (vm, node, NSH_NODE_NEXT_VXLAN4_GPE_INPUT,
+                           n_left_to_next - n_copy);
+    }
+
+  /* Map the decapped packets as nsh-input would */
+  if (n_nsh)
+    {
+      from_frame->n_vectors = n_nsh;
+      nsh_input_map (vm, node, from_frame, NSH_INPUT_TYPE);
+      from_frame->n_vectors = n_vectors;
+    }
+
+  return n_vectors;
+}
+
 static char * nsh_node_error_strings[] = {
 #define _(sym,string) string,
   foreach_nsh_node_error
@@ -2400,6 +4564,29 @@ VLIB_REGISTER_NODE (nsh_aware_vnf_proxy_node) = {
 
 VLIB_NODE_FUNCTION_MULTIARCH (nsh_aware_vnf_proxy_node, nsh_aware_vnf_proxy);
 
+/* register vxlan4-gpe-nsh-input node */
+VLIB_REGISTER_NODE (vxlan4_gpe_nsh_input_node) = {
+  .function = vxlan4_gpe_nsh_input,
+  .name = "vxlan4-gpe-nsh-input",
+  .vector_size = sizeof (u32),
+  .format_trace = format_nsh_node_map_trace,
+  .format_buffer = format_nsh_header,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(nsh_node_error_strings),
+  .error_strings = nsh_node_error_strings,
+
+  .n_next_nodes = NSH_NODE_N_NEXT,
+
+  .next_nodes = {
+#define _(s,n) [NSH_NODE_NEXT_##s] = n,
+    foreach_nsh_node_next
+#undef _
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (vxlan4_gpe_nsh_input_node, vxlan4_gpe_nsh_input);
+
 void
 nsh_md2_set_next_ioam_export_override (uword next)
 {
@@ -2408,6 +4595,57 @@ nsh_md2_set_next_ioam_export_override (uword next)
   return;
 }
 
+/**
+ * Action function to attach the iOAM export next node to one mapping,
+ * so that only its service path takes the export branch on decap.
+ * A next of 0 detaches it. Returns -2 if the mapping does not exist.
+ */
+int
+nsh_md2_set_map_ioam_export_override (u32 nsp_nsi, uword next)
+{
+  nsh_main_t *nm = &nsh_main;
+  nsh_map_t *map;
+  uword *entry;
+  u32 key;
+
+  key = clib_host_to_net_u32 (nsp_nsi);
+  entry = hash_get_mem (nm->nsh_mapping_by_key, &key);
+  if (entry == 0)
+    return -2;
+
+  map = pool_elt_at_index (nm->nsh_mappings, entry[0]);
+  map->export_next = next;
+
+  nsh_event_post (NSH_EVENT_MAP_MODIFY, nsp_nsi, entry[0]);
+
+  return 0;
+}
+
+/**
+ * Action function to set the iOAM export sampling rate.
+ * A rate of 0 or 1 exports every packet. Returns -1 when flow based
+ * sampling is asked for without a rate.
+ */
+int
+nsh_md2_set_ioam_export_sampling (u32 rate, u8 by_flow)
+{
+  nsh_main_t *nm = &nsh_main;
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  u32 *countdown;
+
+  if (by_flow && rate <= 1)
+    return -1;
+
+  vec_validate (nm->export_sample_countdown, tm->n_vlib_mains - 1);
+  vec_foreach (countdown, nm->export_sample_countdown)
+    countdown[0] = clib_max (rate, 1);
+
+  nm->export_sample_by_flow = by_flow;
+  nm->export_sample_rate = rate;
+
+  return 0;
+}
+
 
 clib_error_t *nsh_init (vlib_main_t *vm)
 {
@@ -2415,10 +4653,16 @@ clib_error_t *nsh_init (vlib_main_t *vm)
   clib_error_t * error = 0;
   u8 * name;
   uword next_node;
+  int i;
 
   /* Init the main structures from VPP */
   nm->vlib_main = vm;
   nm->vnet_main = vnet_get_main();
+  nm->handoff_fq_index = ~0;
+  nm->vxlan_gpe_fused = 1;
+
+  for (i = 0; i < NSH_EXPORT_N_SAMPLE; i++)
+    vlib_validate_simple_counter (&nm->export_sample_counters[i], 0);
 
   /* Various state maintenance mappings */
   nm->nsh_mapping_by_key
@@ -2436,6 +4680,13 @@ clib_error_t *nsh_init (vlib_main_t *vm)
   nm->nsh_option_map_by_key
     = hash_create_mem (0, sizeof(nsh_option_map_by_key_t), sizeof (uword));
 
+  nm->nsp_path_by_nsp = hash_create (0, sizeof (uword));
+  nm->sf_pool_by_id = hash_create (0, sizeof (uword));
+
+  nm->event_registration_by_client = hash_create (0, sizeof (uword));
+
+  nm->map_fib_node_type = fib_node_register_new_type (&nsh_map_fib_node_vft);
+
   name = format (0, "nsh_%08x%c", api_version, 0);
 
   /* Set up the API */
@@ -2484,3 +4735,150 @@ clib_error_t *nsh_init (vlib_main_t *vm)
 }
 
 VLIB_INIT_FUNCTION(nsh_init);
+
+/*
+ * Bytes held by a pool, preallocated room included.
+ */
+static u8 *
+format_nsh_memory_pool (u8 * s, va_list * args)
+{
+  void * pool = va_arg (*args, void *);
+  uword * hash = va_arg (*args, uword *);
+
+  s = format (s, "%d used, %U", pool ? pool_elts (pool) : 0,
+              format_memory_size,
+              pool ? clib_mem_size (pool_header (pool)) : 0);
+  if (hash)
+    s = format (s, ", hash %d elts %U", hash_elts (hash),
+                format_memory_size, hash_bytes (hash));
+  return s;
+}
+
+static clib_error_t *
+show_nsh_memory_command_fn (vlib_main_t * vm,
+                            unformat_input_t * input,
+                            vlib_cli_command_t * cmd)
+{
+  nsh_main_t * nm = &nsh_main;
+
+  vlib_cli_output (vm, "startup config: max-entries %d max-maps %d "
+                   "max-paths %d max-proxy-sessions %d",
+                   nm->max_entries, nm->max_maps, nm->max_paths,
+                   nm->max_proxy_sessions);
+  vlib_cli_output (vm, "entries:         %U", format_nsh_memory_pool,
+                   nm->nsh_entries, nm->nsh_entry_by_key);
+  vlib_cli_output (vm, "maps:            %U", format_nsh_memory_pool,
+                   nm->nsh_mappings, nm->nsh_mapping_by_key);
+  vlib_cli_output (vm, "proxy sessions:  %U", format_nsh_memory_pool,
+                   nm->nsh_proxy_sessions, nm->nsh_proxy_session_by_key);
+  vlib_cli_output (vm, "nsp paths:       %U", format_nsh_memory_pool,
+                   nm->nsp_paths, nm->nsp_path_by_nsp);
+  vlib_cli_output (vm, "sf pools:        %U", format_nsh_memory_pool,
+                   nm->sf_pools, nm->sf_pool_by_id);
+  vlib_cli_output (vm, "symmetric flows: %U", format_nsh_sf_flow_memory);
+  vlib_cli_output (vm, "numa replicas:   %U", format_nsh_numa_memory);
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (show_nsh_memory_command, static) = {
+  .path = "show nsh memory",
+  .short_help = "show nsh memory",
+  .function = show_nsh_memory_command_fn,
+};
+
+/*
+ * Startup config, e.g.
+ *   nsh { max-entries 10000 max-paths 1000 max-proxy-sessions 1000 }
+ * Pools, their hashes and the per-map counters are sized up front, so
+ * that loading that many neither reallocates nor rehashes under the
+ * workers' feet. max-maps defaults to max-entries. numa-replicas gives
+ * each NUMA node a copy of the maps and entries, see nsh_numa.c.
+ */
+static clib_error_t *
+nsh_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  nsh_main_t * nm = &nsh_main;
+  clib_error_t * error;
+  u32 max_symmetric_flows = 0;
+  u32 i;
+
+  if ((error = vlib_call_init_function (vm, nsh_init)))
+    return error;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "max-entries %d", &nm->max_entries))
+        ;
+      else if (unformat (input, "max-maps %d", &nm->max_maps))
+        ;
+      else if (unformat (input, "max-paths %d", &nm->max_paths))
+        ;
+      else if (unformat (input, "max-proxy-sessions %d",
+                         &nm->max_proxy_sessions))
+        ;
+      else if (unformat (input, "max-symmetric-flows %d",
+                         &max_symmetric_flows))
+        ;
+      else if (unformat (input, "numa-replicas"))
+        nsh_numa_main.enabled = 1;
+      else if (unformat (input, "numa-heap-size %U", unformat_memory_size,
+                         &nsh_numa_main.heap_size))
+        ;
+      else
+        return clib_error_return (0, "unknown input '%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (nm->max_maps == 0)
+    nm->max_maps = nm->max_entries;
+
+  if (nm->max_entries)
+    {
+      pool_alloc_aligned (nm->nsh_entries, nm->max_entries,
+                          CLIB_CACHE_LINE_BYTES);
+      nm->nsh_entry_by_key = hash_resize (nm->nsh_entry_by_key,
+                                          nm->max_entries);
+    }
+
+  if (nm->max_maps)
+    {
+      pool_alloc_aligned (nm->nsh_mappings, nm->max_maps,
+                          CLIB_CACHE_LINE_BYTES);
+      nm->nsh_mapping_by_key = hash_resize (nm->nsh_mapping_by_key,
+                                            nm->max_maps);
+      nm->nsh_mapping_by_mapped_key =
+        hash_resize (nm->nsh_mapping_by_mapped_key, nm->max_maps);
+
+      /* Per-map counters are per thread vectors, grow them now too */
+      vlib_validate_combined_counter (&nm->path_counters, nm->max_maps - 1);
+      for (i = 0; i < NSH_POLICER_N_RESULT; i++)
+        vlib_validate_combined_counter (&nm->policer_counters[i],
+                                        nm->max_maps - 1);
+    }
+
+  if (nm->max_paths)
+    {
+      pool_alloc (nm->nsp_paths, nm->max_paths);
+      nm->nsp_path_by_nsp = hash_resize (nm->nsp_path_by_nsp,
+                                         nm->max_paths);
+    }
+
+  if (nm->max_proxy_sessions)
+    {
+      pool_alloc_aligned (nm->nsh_proxy_sessions, nm->max_proxy_sessions,
+                          CLIB_CACHE_LINE_BYTES);
+      nm->nsh_proxy_session_by_key =
+        hash_resize (nm->nsh_proxy_session_by_key, nm->max_proxy_sessions);
+    }
+
+  if (max_symmetric_flows)
+    nsh_sf_pool_flow_prealloc (max_symmetric_flows);
+
+  if (nsh_numa_main.heap_size == 0)
+    nsh_numa_main.heap_size = NSH_NUMA_DEFAULT_HEAP_SIZE;
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (nsh_config, "nsh");
@@ -16,7 +16,12 @@
 #define included_nsh_h
 
 #include <vnet/vnet.h>
+#include <vnet/fib/fib_node.h>
+#include <vnet/dpo/dpo.h>
 #include <nsh/nsh_packet.h>
+#include <nsh/nsh_policer.h>
+#include <nsh/nsh_sf_pool.h>
+#include <nsh/nsh_classify.h>
 #include <vnet/ip/ip4_packet.h>
 
 typedef struct {
@@ -60,6 +65,9 @@ typedef struct {
   /* Required for pool_get_aligned  */
   CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
 
+  /* Linkage into the FIB graph, child of adj_index */
+  fib_node_t node;
+
   /** Key for nsh_header_t entry: 24bit NSP 8bit NSI */
   u32 nsp_nsi;
   /** Key for nsh_header_t entry to map to. : 24bit NSP 8bit NSI
@@ -73,9 +81,9 @@ typedef struct {
   /* NSH Header action: swap, push and pop */
   u32 nsh_action;
 
-  /** vnet intfc hw_if_index */
+  /** vnet intfc hw_if_index, ~0 until the map has an interface */
   u32 nsh_hw_if;
-  /* vnet intfc sw_if_index */
+  /* vnet intfc sw_if_index, ~0 until the map has an interface */
   u32 nsh_sw_if;
 
   /* encap if index */
@@ -83,6 +91,26 @@ typedef struct {
   u32 rx_sw_if_index;
   u32 next_node;
   u32 adj_index;
+  u32 adj_sibling;
+
+  /* rate limiter for this service path, ~0 if none */
+  u32 policer_index;
+
+  /* SF pool picking the next hop per flow, ~0 to use the one above */
+  u32 sf_pool_index;
+
+  /* VXLAN-GPE maps only: the tunnel's outer headers followed by the
+   * mapped entry's NSH header, pushed in one copy. 0 if not fused. */
+  u8 * fused_rewrite;
+  u8 fused_outer_size;
+  u8 fused_is_ip6;
+  /* load balance towards the tunnel's remote, and our link to it */
+  dpo_id_t fused_dpo;
+  fib_node_index_t fused_fib_entry;
+  u32 fused_sibling;
+
+  /* nsh-input next taken on MD2 decap for iOAM export, 0 if none */
+  u32 export_next;
 } nsh_map_t;
 
 typedef struct {
@@ -100,8 +128,98 @@ typedef struct {
   u32 nsp_nsi;
 } nsh_proxy_session_t;
 
+/** Note:
+ * An NSP path forwards packets which have no map of their own: the
+ * header is kept with NSI decremented, and the packet leaves through
+ * the hop configured for the NSI it arrived with. One path replaces a
+ * map and an entry per NSI of an SFF chain.
+ */
+typedef struct {
+  /* next_node ~0 when the NSI has no hop */
+  u32 next_node;
+  u32 sw_if_index;
+  u32 adj_index;
+} nsh_nsp_hop_t;
+
+typedef struct {
+  u32 nsp;
+  u32 n_hops;
+  /* indexed by NSI, up to the highest configured one */
+  nsh_nsp_hop_t * hops;
+} nsh_nsp_path_t;
+
+typedef struct {
+  u8 is_add;
+  u32 nsp;
+  u8 nsi;
+  nsh_nsp_hop_t hop;
+} nsh_add_del_nsp_hop_args_t;
+
 #define MAX_MD2_OPTIONS 256
 
+/* Per service path drop reasons, exported with the path statistics */
+#define foreach_nsh_path_drop                   \
+_(TTL_EXPIRED, "ttl expired")                   \
+_(NO_ENTRY, "no entry")                         \
+_(INVALID_OPTIONS, "invalid options")           \
+_(POLICER, "policer")                           \
+_(NO_BUFFER, "no buffer")
+
+typedef enum {
+#define _(sym,str) NSH_PATH_DROP_##sym,
+  foreach_nsh_path_drop
+#undef _
+  NSH_PATH_N_DROP,
+} nsh_path_drop_t;
+
+/* Outcome of the iOAM export sampler, counted while export is enabled */
+#define foreach_nsh_export_sample               \
+_(SAMPLED, "sampled")                           \
+_(SKIPPED, "skipped")
+
+typedef enum {
+#define _(sym,str) NSH_EXPORT_SAMPLE_##sym,
+  foreach_nsh_export_sample
+#undef _
+  NSH_EXPORT_N_SAMPLE,
+} nsh_export_sample_t;
+
+/* Configuration changes reported to want_nsh_events registrants */
+#define foreach_nsh_event_type                  \
+_(MAP_ADD, "map-add")                           \
+_(MAP_DEL, "map-del")                           \
+_(MAP_MODIFY, "map-modify")                     \
+_(ENTRY_ADD, "entry-add")                       \
+_(ENTRY_DEL, "entry-del")                       \
+_(PROXY_ADD, "proxy-add")                       \
+_(PROXY_DEL, "proxy-del")                       \
+_(ADJ_RESTACK, "adj-restack")                   \
+_(RESYNC, "resync")                             \
+_(NSP_HOP_ADD, "nsp-hop-add")                   \
+_(NSP_HOP_DEL, "nsp-hop-del")
+
+typedef enum {
+#define _(sym,str) NSH_EVENT_##sym,
+  foreach_nsh_event_type
+#undef _
+  NSH_N_EVENT_TYPE,
+} nsh_event_type_t;
+
+typedef struct {
+  u8 type;
+  /* 24bit NSP 8bit NSI, host order */
+  u32 nsp_nsi;
+  /* entry, map or proxy session pool index, NSP path's for its hops */
+  u32 index;
+} nsh_event_t;
+
+typedef struct {
+  u32 client_index;
+  u32 client_pid;
+  /* events dropped on a full client queue, reported as NSH_EVENT_RESYNC */
+  u32 n_lost;
+} nsh_event_registration_t;
+
 typedef struct {
   /* API message ID base */
   u16 msg_id_base;
@@ -125,6 +243,31 @@ typedef struct {
   /* hash lookup nsh_proxy by key */
   uword * nsh_proxy_session_by_key;
 
+  /* NSP paths, and their hash lookup by host order NSP */
+  nsh_nsp_path_t * nsp_paths;
+  uword * nsp_path_by_nsp;
+
+  /* Maps get their nsh_tunnel interface only once asked for it */
+  u8 map_interface_on_demand;
+
+  /* VXLAN-GPE maps push their outer headers themselves */
+  u8 vxlan_gpe_fused;
+  /* fused rewrites replaced since workers last went through a barrier */
+  u8 ** fused_rewrites_to_free;
+  /* interfaces come up whose maps are to be fused again */
+  u32 * fused_sw_if_pending;
+
+  /* udp vxlan-gpe port is taken by vxlan4-gpe-nsh-input */
+  u8 vxlan_gpe_nsh_input;
+  /* iOAM export has no next of its own there: MD2 goes to nsh-input */
+  u8 vxlan_gpe_nsh_md2_bypass;
+
+  /* Preallocated from the startup config, 0 when not configured */
+  u32 max_entries;
+  u32 max_maps;
+  u32 max_paths;
+  u32 max_proxy_sessions;
+
   /** Free vlib hw_if_indices */
   u32 * free_nsh_tunnel_hw_if_indices;
   /** Mapping from sw_if_index to tunnel index */
@@ -153,8 +296,46 @@ typedef struct {
   int (*pop_options[MAX_MD2_OPTIONS]) (vlib_buffer_t * b,
 				       nsh_tlv_header_t * opt);
   u8 *(*trace[MAX_MD2_OPTIONS]) (u8 * s, nsh_tlv_header_t * opt);
+  /* iOAM export next for every path, maps may set their own */
   uword decap_v4_next_override;
 
+  /* iOAM export sampling, 1 in export_sample_rate MD2 decaps (0: all) */
+  u32 export_sample_rate;
+  u8 export_sample_by_flow;
+  u32 * export_sample_countdown;  /* per thread, for 1-in-N */
+  vlib_simple_counter_main_t export_sample_counters[NSH_EXPORT_N_SAMPLE];
+
+  /* Per-adjacency counters of packets punted to nsh-too-big */
+  vlib_combined_counter_main_t too_big_counters;
+
+  /* SF pools, and their hash lookup by user given id */
+  nsh_sf_pool_t * sf_pools;
+  uword * sf_pool_by_id;
+
+  /* Per-map policers and their per-map result counters */
+  nsh_policer_t * policers;
+  vlib_combined_counter_main_t policer_counters[NSH_POLICER_N_RESULT];
+
+  /* Per-map path statistics, counted only while being exported */
+  u8 path_stats_enabled;
+  vlib_combined_counter_main_t path_counters;
+  vlib_simple_counter_main_t path_drop_counters[NSH_PATH_N_DROP];
+
+  /* Worker handoff, steered by nsp_nsi */
+  u8 handoff_enabled;
+  u32 handoff_fq_index;
+  u32 first_worker_index;
+  u32 num_workers;
+
+  /* want_nsh_events registrants, and the changes of this main loop
+   * iteration that are still to be sent to them */
+  nsh_event_registration_t * event_registrations;
+  uword * event_registration_by_client;
+  nsh_event_t * pending_events;
+
+  /* FIB node type of nsh maps, to hear about adjacency restacks */
+  fib_node_type_t map_fib_node_type;
+
   /* Feature arc indices */
   u8 input_feature_arc_index;
   u8 output_feature_arc_index;
@@ -168,6 +349,8 @@ nsh_main_t nsh_main;
 
 extern vlib_node_registration_t nsh_aware_vnf_proxy_node;
 extern vlib_node_registration_t nsh_eth_output_node;
+extern vlib_node_registration_t nsh_input_node;
+extern vlib_node_registration_t vxlan4_gpe_nsh_input_node;
 
 typedef struct {
    u8 trace_data[256];
@@ -175,6 +358,31 @@ typedef struct {
 
 u8 * format_nsh_input_map_trace (u8 * s, va_list * args);
 u8 * format_nsh_header_with_length (u8 * s, va_list * args);
+u8 * format_nsh_header (u8 * s, va_list * args);
+
+int nsh_handoff_enable_disable (int is_enable);
+int nsh_md2_set_ioam_export_sampling (u32 rate, u8 by_flow);
+int nsh_md2_set_map_ioam_export_override (u32 nsp_nsi, uword next);
+int nsh_map_interface_get (u32 nsp_nsi, u32 * sw_if_indexp);
+int nsh_add_del_entry (nsh_add_del_entry_args_t * a, u32 * entry_indexp);
+int nsh_add_del_map (nsh_add_del_map_args_t * a, u32 * map_indexp);
+int nsh_add_del_proxy_session (nsh_add_del_map_args_t * a);
+int nsh_add_del_nsp_hop (nsh_add_del_nsp_hop_args_t * a);
+u32 nsh_get_adj_by_sw_if_index (u32 sw_if_index);
+void nsh_event_post (nsh_event_type_t type, u32 nsp_nsi, u32 index);
+
+/* Filters of the paged nsh_entry/nsh_map dumps, see nsh.api */
+#define NSH_DUMP_FILTER_NSP             (1 << 0)
+#define NSH_DUMP_FILTER_ACTION          (1 << 1)
+#define NSH_DUMP_FILTER_NEXT_NODE       (1 << 2)
+#define NSH_DUMP_FILTER_MD_TYPE         (1 << 3)
+
+/* Records returned by a paged dump when the client does not say */
+#define NSH_DUMP_DEFAULT_PAGE 1024
+/* Most records, and pool slots looked at, in one call of a paged dump,
+ * so that no page holds up the main thread for long */
+#define NSH_DUMP_MAX_PAGE 4096
+#define NSH_DUMP_MAX_SCAN (16 * NSH_DUMP_MAX_PAGE)
 
 /* Helper macros used in nsh.c and nsh_test.c */
 #define foreach_copy_nsh_base_hdr_field         \
@@ -193,6 +401,11 @@ _(NO_PROXY, "no proxy for transport key") \
 _(INVALID_NEXT_PROTOCOL, "invalid next protocol") \
 _(INVALID_OPTIONS, "invalid md2 options") \
 _(INVALID_TTL, "ttl equals zero") \
+_(HEADER_SPANS_BUFFERS, "nsh header not in first buffer") \
+_(NO_BUFFER, "no buffer for nsh header") \
+_(CHAINED_HEADER, "nsh header pushed into chained buffer") \
+_(POLICER_DROP, "dropped by service path policer") \
+_(POLICER_MARK, "marked by service path policer") \
 
 typedef enum {
 #define _(sym,str) NSH_NODE_ERROR_##sym,
@@ -212,6 +425,9 @@ typedef enum {
   _(DECAP_ETH_INPUT, "ethernet-input" ) \
   _(ENCAP_LISP_GPE, "interface-output" )  \
   _(ENCAP_ETHERNET, "nsh-eth-output")   \
+  _(IP4_LOAD_BALANCE, "ip4-load-balance") \
+  _(IP6_LOAD_BALANCE, "ip6-load-balance") \
+  _(VXLAN4_GPE_INPUT, "vxlan4-gpe-input") \
 /*   _(DECAP_IP4_INPUT,  "ip4-input") \ */
 /*   _(DECAP_IP6_INPUT,  "ip6-input" ) \  */
 
@@ -0,0 +1,1219 @@
+/*
+ * nsh_classify.c - exact match classification of IP flows onto NSH maps
+ *
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/ip/ip.h>
+#include <vnet/feature/feature.h>
+#include <nsh/nsh.h>
+
+#include <vppinfra/bihash_16_8.h>
+#include <vppinfra/bihash_template.h>
+#include <vppinfra/bihash_template.c>
+
+#include <vppinfra/bihash_48_8.h>
+#include <vppinfra/bihash_template.h>
+#include <vppinfra/bihash_template.c>
+
+#include <vppinfra/tw_timer_2t_1w_2048sl.h>
+
+#define NSH_CLASSIFY_HASH_BUCKETS (64 << 10)
+#define NSH_CLASSIFY_HASH_MEMORY (256 << 20)
+
+#define NSH_CLASSIFY_FLOW_HASH_BUCKETS (16 << 10)
+#define NSH_CLASSIFY_FLOW_HASH_MEMORY (32 << 20)
+#define NSH_CLASSIFY_FLOW_DEFAULT_MAX (64 << 10)
+/* What the flow hash memory holds with ip6 keys, leaving it three
+ * quarters spare for bucket splits */
+#define NSH_CLASSIFY_FLOW_MAX_FLOWS \
+  ((u32) (NSH_CLASSIFY_FLOW_HASH_MEMORY / \
+          (4 * sizeof (clib_bihash_kv_48_8_t))))
+#define NSH_CLASSIFY_FLOW_DEFAULT_TIMEOUT 60
+/* one second ticks on a 2048 slot wheel */
+#define NSH_CLASSIFY_FLOW_MAX_TIMEOUT 2047
+
+/** Note:
+ * Sessions of one mask share the key layout below, with the mask index
+ * folded in so that equal masked keys of two masks never collide:
+ *
+ *   ip4 (16_8): src & mask, dst & mask | ports, protocol, mask index
+ *   ip6 (48_8): src & mask (2), dst & mask (2) | ports, protocol, mask
+ *               index | 0
+ *
+ * Ports are the upper 32 bits, the 32 bits following the IP header in
+ * network order, protocol the next 8 and the mask index the low 24.
+ * Ports and protocol are zero unless the mask matches them.
+ */
+#define NSH_CLASSIFY_MASK_INDEX_BITS 24
+#define NSH_CLASSIFY_MAX_MASKS (1 << NSH_CLASSIFY_MASK_INDEX_BITS)
+
+typedef struct {
+  u8 src_len;
+  u8 dst_len;
+  u8 match_ports;
+  u32 n_sessions;
+  ip46_address_t src_mask;
+  ip46_address_t dst_mask;
+} nsh_classify_mask_t;
+
+/** Note:
+ * A flow is the exact 5-tuple a session lookup looked at, keyed as
+ *
+ *   ip4 (16_8): src, dst | ports, protocol
+ *   ip6 (48_8): src (2), dst (2) | ports, protocol | 0
+ *
+ * with the value the flow's index in the per-thread pool.
+ */
+typedef struct {
+  union {
+    clib_bihash_kv_16_8_t kv4;
+    clib_bihash_kv_48_8_t kv6;
+  };
+  /* host order nsp_nsi the flow was classified onto */
+  u32 nsp_nsi;
+  u32 timer_handle;
+  f64 last_active;
+  u8 is_ip6;
+} nsh_classify_flow_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  clib_bihash_16_8_t cache4;
+  clib_bihash_48_8_t cache6;
+  u8 cache_initialized[2];
+
+  nsh_classify_flow_t * flows;
+
+  /* idle aging, the wheel only runs from the classify nodes */
+  tw_timer_wheel_2t_1w_2048sl_t wheel;
+  f64 now;
+  u32 n_evicted;
+
+  /* flushes everything when behind nsh_classify_main.flow_cache_epoch */
+  u32 epoch;
+} nsh_classify_flow_cache_t;
+
+typedef struct {
+  clib_bihash_16_8_t table4;
+  clib_bihash_48_8_t table6;
+  u8 table_initialized[2];
+
+  /* masks in use, per family, and their lookup order, most specific first */
+  nsh_classify_mask_t * masks[2];
+  u32 * mask_order[2];
+
+  /* per thread flow caches in front of the session lookup */
+  nsh_classify_flow_cache_t * flow_caches;
+  u8 flow_cache_enable;
+  u32 flow_cache_max;
+  u32 flow_idle_timeout;
+  volatile u32 flow_cache_epoch;
+} nsh_classify_main_t;
+
+nsh_classify_main_t nsh_classify_main;
+
+typedef struct {
+  u32 nsp_nsi;
+  u32 next_index;
+} nsh_classify_trace_t;
+
+#define foreach_nsh_classify_error                      \
+_(HIT, "flows classified onto an nsh map")              \
+_(MISS, "flows without a session")                      \
+_(CACHE_HIT, "flow cache hits")                         \
+_(CACHE_MISS, "flow cache misses")                      \
+_(CACHE_EVICT, "idle flows evicted from the flow cache") \
+_(CACHE_FULL, "flows not cached, flow cache full")
+
+typedef enum {
+#define _(sym,str) NSH_CLASSIFY_ERROR_##sym,
+  foreach_nsh_classify_error
+#undef _
+  NSH_CLASSIFY_N_ERROR,
+} nsh_classify_error_t;
+
+static char * nsh_classify_error_strings[] = {
+#define _(sym,string) string,
+  foreach_nsh_classify_error
+#undef _
+};
+
+#define foreach_nsh_classify_next               \
+_(DROP, "error-drop")                           \
+_(NSH_CLASSIFIER, "nsh-classifier")
+
+typedef enum {
+#define _(s,n) NSH_CLASSIFY_NEXT_##s,
+  foreach_nsh_classify_next
+#undef _
+  NSH_CLASSIFY_N_NEXT,
+} nsh_classify_next_t;
+
+static u8 *
+format_nsh_classify_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  nsh_classify_trace_t * t = va_arg (*args, nsh_classify_trace_t *);
+
+  if (t->nsp_nsi == ~0)
+    return format (s, "no session, next %d", t->next_index);
+
+  return format (s, "nsp %d nsi %d next %d",
+                 (t->nsp_nsi >> NSH_NSP_SHIFT) & NSH_NSP_MASK,
+                 t->nsp_nsi & NSH_NSI_MASK, t->next_index);
+}
+
+always_inline void
+nsh_classify_make_key4 (clib_bihash_kv_16_8_t * kv, nsh_classify_mask_t * m,
+                        u32 mask_index, ip4_address_t * src,
+                        ip4_address_t * dst, u8 protocol, u32 ports)
+{
+  kv->key[0] = ((u64) (src->as_u32 & m->src_mask.ip4.as_u32) << 32)
+    | (dst->as_u32 & m->dst_mask.ip4.as_u32);
+  kv->key[1] = m->match_ports ?
+    ((u64) ports << 32) | ((u64) protocol << NSH_CLASSIFY_MASK_INDEX_BITS)
+    | mask_index : mask_index;
+  kv->value = ~0ULL;
+}
+
+always_inline void
+nsh_classify_make_key6 (clib_bihash_kv_48_8_t * kv, nsh_classify_mask_t * m,
+                        u32 mask_index, ip6_address_t * src,
+                        ip6_address_t * dst, u8 protocol, u32 ports)
+{
+  kv->key[0] = src->as_u64[0] & m->src_mask.ip6.as_u64[0];
+  kv->key[1] = src->as_u64[1] & m->src_mask.ip6.as_u64[1];
+  kv->key[2] = dst->as_u64[0] & m->dst_mask.ip6.as_u64[0];
+  kv->key[3] = dst->as_u64[1] & m->dst_mask.ip6.as_u64[1];
+  kv->key[4] = m->match_ports ?
+    ((u64) ports << 32) | ((u64) protocol << NSH_CLASSIFY_MASK_INDEX_BITS)
+    | mask_index : mask_index;
+  kv->key[5] = 0;
+  kv->value = ~0ULL;
+}
+
+/* Pull the bucket a key hashes to, ahead of the search */
+always_inline void
+nsh_classify_prefetch4 (clib_bihash_16_8_t * h, clib_bihash_kv_16_8_t * kv)
+{
+  u64 hash = clib_bihash_hash_16_8 (kv);
+  CLIB_PREFETCH (&h->buckets[hash & (h->nbuckets - 1)],
+                 CLIB_CACHE_LINE_BYTES, LOAD);
+}
+
+always_inline void
+nsh_classify_prefetch6 (clib_bihash_48_8_t * h, clib_bihash_kv_48_8_t * kv)
+{
+  u64 hash = clib_bihash_hash_48_8 (kv);
+  CLIB_PREFETCH (&h->buckets[hash & (h->nbuckets - 1)],
+                 CLIB_CACHE_LINE_BYTES, LOAD);
+}
+
+/* L4 ports of TCP and UDP first fragments, 0 for anything else */
+always_inline u32
+nsh_classify_ports (u8 protocol, void * l4, u8 is_fragment)
+{
+  if (PREDICT_FALSE (is_fragment))
+    return 0;
+
+  if (protocol == IP_PROTOCOL_TCP || protocol == IP_PROTOCOL_UDP)
+    return clib_mem_unaligned (l4, u32);
+
+  return 0;
+}
+
+always_inline void
+nsh_classify_flow_key4 (clib_bihash_kv_16_8_t * kv, ip4_header_t * ip4,
+                        u8 protocol, u32 ports)
+{
+  kv->key[0] = ((u64) ip4->src_address.as_u32 << 32)
+    | ip4->dst_address.as_u32;
+  kv->key[1] = ((u64) ports << 32) | protocol;
+  kv->value = ~0ULL;
+}
+
+always_inline void
+nsh_classify_flow_key6 (clib_bihash_kv_48_8_t * kv, ip6_header_t * ip6,
+                        u8 protocol, u32 ports)
+{
+  kv->key[0] = ip6->src_address.as_u64[0];
+  kv->key[1] = ip6->src_address.as_u64[1];
+  kv->key[2] = ip6->dst_address.as_u64[0];
+  kv->key[3] = ip6->dst_address.as_u64[1];
+  kv->key[4] = ((u64) ports << 32) | protocol;
+  kv->key[5] = 0;
+  kv->value = ~0ULL;
+}
+
+static void
+nsh_classify_flow_free (nsh_classify_flow_cache_t * fc,
+                        nsh_classify_flow_t * f)
+{
+  if (f->is_ip6)
+    clib_bihash_add_del_48_8 (&fc->cache6, &f->kv6, 0 /* is_add */);
+  else
+    clib_bihash_add_del_16_8 (&fc->cache4, &f->kv4, 0 /* is_add */);
+
+  pool_put (fc->flows, f);
+}
+
+/* Timer wheel callback, runs on the thread owning the wheel */
+static void
+nsh_classify_flow_expired (u32 * expired_timer_handles)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  nsh_classify_flow_cache_t * fc;
+  nsh_classify_flow_t * f;
+  u32 * handle, flow_index;
+  f64 idle;
+
+  fc = vec_elt_at_index (cm->flow_caches, vlib_get_thread_index ());
+
+  vec_foreach (handle, expired_timer_handles)
+    {
+      /* the top bit is the timer id */
+      flow_index = handle[0] & 0x7FFFFFFF;
+      f = pool_elt_at_index (fc->flows, flow_index);
+
+      /* Hits only touch last_active, re-arm for what is left */
+      idle = fc->now - f->last_active;
+      if (idle < cm->flow_idle_timeout)
+        {
+          f->timer_handle = tw_timer_start_2t_1w_2048sl
+            (&fc->wheel, flow_index, 0,
+             (u32) (cm->flow_idle_timeout - idle) + 1);
+          continue;
+        }
+
+      nsh_classify_flow_free (fc, f);
+      fc->n_evicted++;
+    }
+}
+
+static void
+nsh_classify_flow_flush (nsh_classify_flow_cache_t * fc)
+{
+  nsh_classify_flow_t * f;
+  u32 * indices = 0, * index;
+
+  pool_foreach (f, fc->flows,
+  ({
+    vec_add1 (indices, f - fc->flows);
+  }));
+
+  vec_foreach (index, indices)
+    {
+      f = pool_elt_at_index (fc->flows, index[0]);
+      tw_timer_stop_2t_1w_2048sl (&fc->wheel, f->timer_handle);
+      nsh_classify_flow_free (fc, f);
+    }
+
+  vec_free (indices);
+}
+
+/*
+ * Cache the result of a session lookup. The key is the flow key the
+ * packet was looked up with in the cache. Returns -1 when the cache
+ * is full.
+ */
+always_inline int
+nsh_classify_flow_add (nsh_classify_flow_cache_t * fc, u8 is_ip6,
+                       clib_bihash_kv_16_8_t * kv4,
+                       clib_bihash_kv_48_8_t * kv6, u32 nsp_nsi)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  nsh_classify_flow_t * f;
+  u32 flow_index;
+
+  if (PREDICT_FALSE (pool_elts (fc->flows) >= cm->flow_cache_max))
+    return -1;
+
+  pool_get (fc->flows, f);
+  flow_index = f - fc->flows;
+  f->nsp_nsi = nsp_nsi;
+  f->last_active = fc->now;
+  f->is_ip6 = is_ip6;
+  if (is_ip6)
+    {
+      f->kv6 = *kv6;
+      f->kv6.value = flow_index;
+      clib_bihash_add_del_48_8 (&fc->cache6, &f->kv6, 1 /* is_add */);
+    }
+  else
+    {
+      f->kv4 = *kv4;
+      f->kv4.value = flow_index;
+      clib_bihash_add_del_16_8 (&fc->cache4, &f->kv4, 1 /* is_add */);
+    }
+  f->timer_handle = tw_timer_start_2t_1w_2048sl (&fc->wheel, flow_index, 0,
+                                                 cm->flow_idle_timeout);
+  return 0;
+}
+
+/**
+ * @brief ip4/ip6 unicast feature classifying flows onto NSH maps
+ *
+ * The frame is walked twice: the first pass builds every packet's key
+ * for the most specific mask and prefetches its hash bucket, the second
+ * searches, falling back to the less specific masks on a miss. Hits go
+ * to nsh-classifier with the nsp_nsi in l2_classify.opaque_index, as
+ * ip4-classify would leave it, misses carry on along the feature arc.
+ *
+ * With the flow cache on, pass 1 builds the exact flow key instead and
+ * the session masks are only walked on a flow cache miss. A flow keeps
+ * its nsp_nsi until it idles out, whatever sessions are added since.
+ */
+always_inline uword
+nsh_classify_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
+                     vlib_frame_t * frame, int is_ip6)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  clib_bihash_kv_16_8_t kv4[VLIB_FRAME_SIZE], result4;
+  clib_bihash_kv_48_8_t kv6[VLIB_FRAME_SIZE], result6;
+  u8 protocols[VLIB_FRAME_SIZE];
+  u32 ports[VLIB_FRAME_SIZE];
+  void * ips[VLIB_FRAME_SIZE];
+  u32 n_left_from, next_index, * from, * to_next;
+  u32 n_hit = 0, n_miss = 0;
+  u32 n_cache_hit = 0, n_cache_miss = 0, n_cache_full = 0;
+  u32 * order = cm->mask_order[is_ip6];
+  nsh_classify_flow_cache_t * fc = 0;
+  nsh_classify_mask_t * m;
+  int use_cache = 0;
+  u32 i, j;
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+
+  if (cm->flow_cache_enable)
+    {
+      fc = vec_elt_at_index (cm->flow_caches, vlib_get_thread_index ());
+      use_cache = fc->cache_initialized[is_ip6];
+    }
+
+  if (use_cache)
+    {
+      fc->now = vlib_time_now (vm);
+      if (PREDICT_FALSE (fc->epoch != cm->flow_cache_epoch))
+        {
+          fc->epoch = cm->flow_cache_epoch;
+          nsh_classify_flow_flush (fc);
+        }
+      tw_timer_expire_timers_2t_1w_2048sl (&fc->wheel, fc->now);
+    }
+
+  /* Pass 1: keys for the first mask, buckets on their way in */
+  for (i = 0; i < n_left_from; i++)
+    {
+      vlib_buffer_t * b0 = vlib_get_buffer (vm, from[i]);
+
+      if (i + 2 < n_left_from)
+        {
+          vlib_buffer_t * p2 = vlib_get_buffer (vm, from[i + 2]);
+          vlib_prefetch_buffer_header (p2, LOAD);
+          CLIB_PREFETCH (p2->data, CLIB_CACHE_LINE_BYTES, LOAD);
+        }
+
+      ips[i] = vlib_buffer_get_current (b0);
+      if (vec_len (order) == 0)
+        continue;
+
+      m = vec_elt_at_index (cm->masks[is_ip6], order[0]);
+      if (is_ip6)
+        {
+          ip6_header_t * ip6 = ips[i];
+          protocols[i] = ip6->protocol;
+          ports[i] = nsh_classify_ports (ip6->protocol, ip6 + 1, 0);
+          if (use_cache)
+            {
+              nsh_classify_flow_key6 (&kv6[i], ip6, protocols[i], ports[i]);
+              nsh_classify_prefetch6 (&fc->cache6, &kv6[i]);
+              continue;
+            }
+          nsh_classify_make_key6 (&kv6[i], m, order[0], &ip6->src_address,
+                                  &ip6->dst_address, protocols[i], ports[i]);
+          nsh_classify_prefetch6 (&cm->table6, &kv6[i]);
+        }
+      else
+        {
+          ip4_header_t * ip4 = ips[i];
+          protocols[i] = ip4->protocol;
+          ports[i] = nsh_classify_ports
+            (ip4->protocol, (u8 *) ip4 + ip4_header_bytes (ip4),
+             ip4_get_fragment_offset (ip4) != 0);
+          if (use_cache)
+            {
+              nsh_classify_flow_key4 (&kv4[i], ip4, protocols[i], ports[i]);
+              nsh_classify_prefetch4 (&fc->cache4, &kv4[i]);
+              continue;
+            }
+          nsh_classify_make_key4 (&kv4[i], m, order[0], &ip4->src_address,
+                                  &ip4->dst_address, protocols[i], ports[i]);
+          nsh_classify_prefetch4 (&cm->table4, &kv4[i]);
+        }
+    }
+
+  /* Pass 2: search and enqueue */
+  next_index = node->cached_next_index;
+  i = 0;
+
+  while (n_left_from > 0)
+    {
+      u32 n_left_to_next;
+
+      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+      while (n_left_from > 0 && n_left_to_next > 0)
+        {
+          u32 bi0, next0, nsp_nsi0 = ~0;
+          clib_bihash_kv_16_8_t flow_kv4;
+          clib_bihash_kv_48_8_t flow_kv6;
+          vlib_buffer_t * b0;
+          int hit0 = 0, cached0 = 0;
+
+          bi0 = from[0];
+          to_next[0] = bi0;
+          from += 1;
+          to_next += 1;
+          n_left_from -= 1;
+          n_left_to_next -= 1;
+
+          b0 = vlib_get_buffer (vm, bi0);
+
+          if (use_cache && vec_len (order))
+            {
+              nsh_classify_flow_t * f;
+              u64 flow_index = ~0ULL;
+
+              if (is_ip6)
+                {
+                  if (!clib_bihash_search_48_8 (&fc->cache6, &kv6[i],
+                                                &result6))
+                    flow_index = result6.value;
+                  else
+                    flow_kv6 = kv6[i];
+                }
+              else
+                {
+                  if (!clib_bihash_search_16_8 (&fc->cache4, &kv4[i],
+                                                &result4))
+                    flow_index = result4.value;
+                  else
+                    flow_kv4 = kv4[i];
+                }
+
+              if (flow_index != ~0ULL)
+                {
+                  f = pool_elt_at_index (fc->flows, flow_index);
+                  f->last_active = fc->now;
+                  nsp_nsi0 = f->nsp_nsi;
+                  hit0 = cached0 = 1;
+                  n_cache_hit++;
+                }
+              else
+                n_cache_miss++;
+            }
+
+          for (j = 0; !cached0 && j < vec_len (order); j++)
+            {
+              m = vec_elt_at_index (cm->masks[is_ip6], order[j]);
+              if (is_ip6)
+                {
+                  ip6_header_t * ip6 = ips[i];
+                  if (j || use_cache)
+                    nsh_classify_make_key6 (&kv6[i], m, order[j],
+                                            &ip6->src_address,
+                                            &ip6->dst_address,
+                                            protocols[i], ports[i]);
+                  hit0 = !clib_bihash_search_48_8 (&cm->table6, &kv6[i],
+                                                   &result6);
+                  if (hit0)
+                    nsp_nsi0 = result6.value;
+                }
+              else
+                {
+                  ip4_header_t * ip4 = ips[i];
+                  if (j || use_cache)
+                    nsh_classify_make_key4 (&kv4[i], m, order[j],
+                                            &ip4->src_address,
+                                            &ip4->dst_address,
+                                            protocols[i], ports[i]);
+                  hit0 = !clib_bihash_search_16_8 (&cm->table4, &kv4[i],
+                                                   &result4);
+                  if (hit0)
+                    nsp_nsi0 = result4.value;
+                }
+              if (hit0)
+                break;
+            }
+
+          if (hit0 && use_cache && !cached0)
+            {
+              if (nsh_classify_flow_add (fc, is_ip6, &flow_kv4, &flow_kv6,
+                                         nsp_nsi0))
+                n_cache_full++;
+            }
+
+          if (hit0)
+            {
+              vnet_buffer (b0)->l2_classify.opaque_index = nsp_nsi0;
+              next0 = NSH_CLASSIFY_NEXT_NSH_CLASSIFIER;
+              n_hit++;
+            }
+          else
+            {
+              vnet_feature_next (vnet_buffer (b0)->sw_if_index[VLIB_RX],
+                                 &next0, b0);
+              n_miss++;
+            }
+
+          if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+            {
+              nsh_classify_trace_t * t =
+                vlib_add_trace (vm, node, b0, sizeof (*t));
+              t->nsp_nsi = nsp_nsi0;
+              t->next_index = next0;
+            }
+
+          i++;
+
+          vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+                                           to_next, n_left_to_next,
+                                           bi0, next0);
+        }
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+
+  vlib_node_increment_counter (vm, node->node_index,
+                               NSH_CLASSIFY_ERROR_HIT, n_hit);
+  vlib_node_increment_counter (vm, node->node_index,
+                               NSH_CLASSIFY_ERROR_MISS, n_miss);
+
+  if (use_cache)
+    {
+      vlib_node_increment_counter (vm, node->node_index,
+                                   NSH_CLASSIFY_ERROR_CACHE_HIT, n_cache_hit);
+      vlib_node_increment_counter (vm, node->node_index,
+                                   NSH_CLASSIFY_ERROR_CACHE_MISS,
+                                   n_cache_miss);
+      vlib_node_increment_counter (vm, node->node_index,
+                                   NSH_CLASSIFY_ERROR_CACHE_FULL,
+                                   n_cache_full);
+      vlib_node_increment_counter (vm, node->node_index,
+                                   NSH_CLASSIFY_ERROR_CACHE_EVICT,
+                                   fc->n_evicted);
+      fc->n_evicted = 0;
+    }
+
+  return frame->n_vectors;
+}
+
+static uword
+nsh_classify_ip4 (vlib_main_t * vm, vlib_node_runtime_t * node,
+                  vlib_frame_t * frame)
+{
+  return nsh_classify_inline (vm, node, frame, /* is_ip6 */ 0);
+}
+
+static uword
+nsh_classify_ip6 (vlib_main_t * vm, vlib_node_runtime_t * node,
+                  vlib_frame_t * frame)
+{
+  return nsh_classify_inline (vm, node, frame, /* is_ip6 */ 1);
+}
+
+VLIB_REGISTER_NODE (nsh_classify_ip4_node) = {
+  .function = nsh_classify_ip4,
+  .name = "nsh-classify-ip4",
+  .vector_size = sizeof (u32),
+  .format_trace = format_nsh_classify_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(nsh_classify_error_strings),
+  .error_strings = nsh_classify_error_strings,
+
+  .n_next_nodes = NSH_CLASSIFY_N_NEXT,
+  .next_nodes = {
+#define _(s,n) [NSH_CLASSIFY_NEXT_##s] = n,
+    foreach_nsh_classify_next
+#undef _
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (nsh_classify_ip4_node, nsh_classify_ip4)
+
+VLIB_REGISTER_NODE (nsh_classify_ip6_node) = {
+  .function = nsh_classify_ip6,
+  .name = "nsh-classify-ip6",
+  .vector_size = sizeof (u32),
+  .format_trace = format_nsh_classify_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(nsh_classify_error_strings),
+  .error_strings = nsh_classify_error_strings,
+
+  .n_next_nodes = NSH_CLASSIFY_N_NEXT,
+  .next_nodes = {
+#define _(s,n) [NSH_CLASSIFY_NEXT_##s] = n,
+    foreach_nsh_classify_next
+#undef _
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (nsh_classify_ip6_node, nsh_classify_ip6)
+
+/* *INDENT-OFF* */
+VNET_FEATURE_INIT (nsh_classify_ip4_feature, static) =
+{
+  .arc_name = "ip4-unicast",
+  .node_name = "nsh-classify-ip4",
+  .runs_before = VNET_FEATURES ("ip4-lookup"),
+};
+
+VNET_FEATURE_INIT (nsh_classify_ip6_feature, static) =
+{
+  .arc_name = "ip6-unicast",
+  .node_name = "nsh-classify-ip6",
+  .runs_before = VNET_FEATURES ("ip6-lookup"),
+};
+/* *INDENT-ON* */
+
+/*
+ * Find the mask of a session, or add it, keeping the lookup order most
+ * specific first: port matches, then longer prefixes.
+ */
+static u32
+nsh_classify_mask_find (nsh_classify_session_args_t * a, int create)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  nsh_classify_mask_t * m;
+  u32 * order, mask_index, i;
+
+  pool_foreach (m, cm->masks[a->is_ip6],
+  ({
+    if (m->src_len == a->src_len && m->dst_len == a->dst_len
+        && m->match_ports == a->match_ports)
+      return m - cm->masks[a->is_ip6];
+  }));
+
+  /* the key has room for that many mask indices, no more */
+  if (!create || pool_elts (cm->masks[a->is_ip6]) >= NSH_CLASSIFY_MAX_MASKS)
+    return ~0;
+
+  pool_get (cm->masks[a->is_ip6], m);
+  memset (m, 0, sizeof (*m));
+  m->src_len = a->src_len;
+  m->dst_len = a->dst_len;
+  m->match_ports = a->match_ports;
+  if (a->is_ip6)
+    {
+      m->src_mask.ip6 = ip6_main.fib_masks[a->src_len];
+      m->dst_mask.ip6 = ip6_main.fib_masks[a->dst_len];
+    }
+  else
+    {
+      m->src_mask.ip4.as_u32 = ip4_main.fib_masks[a->src_len];
+      m->dst_mask.ip4.as_u32 = ip4_main.fib_masks[a->dst_len];
+    }
+  mask_index = m - cm->masks[a->is_ip6];
+
+  order = cm->mask_order[a->is_ip6];
+  for (i = 0; i < vec_len (order); i++)
+    {
+      nsh_classify_mask_t * o =
+        pool_elt_at_index (cm->masks[a->is_ip6], order[i]);
+      if (m->match_ports > o->match_ports
+          || (m->match_ports == o->match_ports
+              && m->src_len + m->dst_len > o->src_len + o->dst_len))
+        break;
+    }
+  vec_insert_elts (order, &mask_index, 1, i);
+  cm->mask_order[a->is_ip6] = order;
+
+  return mask_index;
+}
+
+static void
+nsh_classify_mask_unlock (u8 is_ip6, u32 mask_index)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  nsh_classify_mask_t * m;
+  u32 i;
+
+  m = pool_elt_at_index (cm->masks[is_ip6], mask_index);
+  if (--m->n_sessions)
+    return;
+
+  for (i = 0; i < vec_len (cm->mask_order[is_ip6]); i++)
+    if (cm->mask_order[is_ip6][i] == mask_index)
+      {
+        vec_delete (cm->mask_order[is_ip6], 1, i);
+        break;
+      }
+
+  pool_put (cm->masks[is_ip6], m);
+}
+
+static void
+nsh_classify_table_init (u8 is_ip6)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  nsh_classify_flow_cache_t * fc;
+
+  if (cm->table_initialized[is_ip6])
+    return;
+
+  if (is_ip6)
+    clib_bihash_init_48_8 (&cm->table6, "nsh classify ip6",
+                           NSH_CLASSIFY_HASH_BUCKETS,
+                           NSH_CLASSIFY_HASH_MEMORY);
+  else
+    clib_bihash_init_16_8 (&cm->table4, "nsh classify ip4",
+                           NSH_CLASSIFY_HASH_BUCKETS,
+                           NSH_CLASSIFY_HASH_MEMORY);
+
+  /* The flow caches of the family come with it, built here on main */
+  vec_foreach (fc, cm->flow_caches)
+    {
+      if (is_ip6)
+        clib_bihash_init_48_8 (&fc->cache6, "nsh classify flows ip6",
+                               NSH_CLASSIFY_FLOW_HASH_BUCKETS,
+                               NSH_CLASSIFY_FLOW_HASH_MEMORY);
+      else
+        clib_bihash_init_16_8 (&fc->cache4, "nsh classify flows ip4",
+                               NSH_CLASSIFY_FLOW_HASH_BUCKETS,
+                               NSH_CLASSIFY_FLOW_HASH_MEMORY);
+      CLIB_MEMORY_BARRIER ();
+      fc->cache_initialized[is_ip6] = 1;
+    }
+
+  cm->table_initialized[is_ip6] = 1;
+}
+
+/**
+ * Action function to add, replace or del a classify session.
+ * Shared by both CLI and binary API.
+ * Returns -1 for an invalid prefix length,
+ * -2 when the session to delete does not exist,
+ * -3 when a new mask is needed and none is left.
+ */
+int
+nsh_classify_add_del_session (nsh_classify_session_args_t * a)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  clib_bihash_kv_16_8_t kv4, result4;
+  clib_bihash_kv_48_8_t kv6, result6;
+  nsh_classify_mask_t * m;
+  u16 port_pair[2];
+  u32 mask_index, ports = 0;
+  int exists;
+
+  if (a->src_len > (a->is_ip6 ? 128 : 32)
+      || a->dst_len > (a->is_ip6 ? 128 : 32))
+    return -1;
+
+  nsh_classify_table_init (a->is_ip6);
+
+  mask_index = nsh_classify_mask_find (a, a->is_add);
+  if (mask_index == ~0)
+    return a->is_add ? -3 : -2;
+  m = pool_elt_at_index (cm->masks[a->is_ip6], mask_index);
+
+  /* Laid out as on the wire, see nsh_classify_ports */
+  port_pair[0] = clib_host_to_net_u16 (a->src_port);
+  port_pair[1] = clib_host_to_net_u16 (a->dst_port);
+  if (a->match_ports)
+    ports = clib_mem_unaligned (port_pair, u32);
+
+  if (a->is_ip6)
+    {
+      nsh_classify_make_key6 (&kv6, m, mask_index, &a->src.ip6, &a->dst.ip6,
+                              a->protocol, ports);
+      exists = !clib_bihash_search_48_8 (&cm->table6, &kv6, &result6);
+      kv6.value = a->nsp_nsi;
+    }
+  else
+    {
+      nsh_classify_make_key4 (&kv4, m, mask_index, &a->src.ip4, &a->dst.ip4,
+                              a->protocol, ports);
+      exists = !clib_bihash_search_16_8 (&cm->table4, &kv4, &result4);
+      kv4.value = a->nsp_nsi;
+    }
+
+  if (!a->is_add && !exists)
+    return -2;
+
+  if (a->is_ip6)
+    clib_bihash_add_del_48_8 (&cm->table6, &kv6, a->is_add);
+  else
+    clib_bihash_add_del_16_8 (&cm->table4, &kv4, a->is_add);
+
+  if (!a->is_add)
+    {
+      nsh_classify_mask_unlock (a->is_ip6, mask_index);
+      /* Flows of a withdrawn session must not outlive it */
+      cm->flow_cache_epoch++;
+    }
+  else if (!exists)
+    m->n_sessions++;
+
+  return 0;
+}
+
+/**
+ * Action function to configure the per thread flow caches.
+ * A timeout or max_flows of 0 leaves that setting alone.
+ * Returns -1 for a timeout the timer wheel cannot hold,
+ * -2 for more flows than the flow hash has memory for.
+ */
+int
+nsh_classify_flow_cache_config (u8 enable, u32 timeout, u32 max_flows)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+
+  if (timeout > NSH_CLASSIFY_FLOW_MAX_TIMEOUT)
+    return -1;
+  if (max_flows > NSH_CLASSIFY_FLOW_MAX_FLOWS)
+    return -2;
+
+  if (timeout)
+    cm->flow_idle_timeout = timeout;
+  if (max_flows)
+    cm->flow_cache_max = max_flows;
+
+  /* Whatever was cached while on is stale once turned back on */
+  if (enable && !cm->flow_cache_enable)
+    cm->flow_cache_epoch++;
+  cm->flow_cache_enable = enable;
+
+  return 0;
+}
+
+/**
+ * Action function to enable or disable classification on an interface.
+ */
+int
+nsh_classify_enable_disable (u32 sw_if_index, u8 is_ip6, int is_enable)
+{
+  vnet_feature_enable_disable (is_ip6 ? "ip6-unicast" : "ip4-unicast",
+                               is_ip6 ? "nsh-classify-ip6" :
+                               "nsh-classify-ip4",
+                               sw_if_index, is_enable, 0, 0);
+  return 0;
+}
+
+static clib_error_t *
+nsh_classify_session_command_fn (vlib_main_t * vm,
+                                 unformat_input_t * input,
+                                 vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, * line_input = &_line_input;
+  nsh_classify_session_args_t _a, * a = &_a;
+  u32 nsp, nsi, protocol = 0, src_port = 0, dst_port = 0;
+  u32 src_len = ~0, dst_len = ~0;
+  int nsp_set = 0, nsi_set = 0, src_set = 0, dst_set = 0;
+  int rv;
+
+  memset (a, 0, sizeof (*a));
+  a->is_add = 1;
+
+  /* Get a line of input. */
+  if (! unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+    if (unformat (line_input, "del"))
+      a->is_add = 0;
+    else if (unformat (line_input, "src %U/%d", unformat_ip4_address,
+                       &a->src.ip4, &src_len))
+      src_set = 1;
+    else if (unformat (line_input, "src %U", unformat_ip4_address,
+                       &a->src.ip4))
+      src_set = 1;
+    else if (unformat (line_input, "dst %U/%d", unformat_ip4_address,
+                       &a->dst.ip4, &dst_len))
+      dst_set = 1;
+    else if (unformat (line_input, "dst %U", unformat_ip4_address,
+                       &a->dst.ip4))
+      dst_set = 1;
+    else if (unformat (line_input, "src %U/%d", unformat_ip6_address,
+                       &a->src.ip6, &src_len))
+      src_set = a->is_ip6 = 1;
+    else if (unformat (line_input, "src %U", unformat_ip6_address,
+                       &a->src.ip6))
+      src_set = a->is_ip6 = 1;
+    else if (unformat (line_input, "dst %U/%d", unformat_ip6_address,
+                       &a->dst.ip6, &dst_len))
+      dst_set = a->is_ip6 = 1;
+    else if (unformat (line_input, "dst %U", unformat_ip6_address,
+                       &a->dst.ip6))
+      dst_set = a->is_ip6 = 1;
+    else if (unformat (line_input, "proto %d", &protocol))
+      a->match_ports = 1;
+    else if (unformat (line_input, "sport %d", &src_port))
+      ;
+    else if (unformat (line_input, "dport %d", &dst_port))
+      ;
+    else if (unformat (line_input, "nsp %d", &nsp))
+      nsp_set = 1;
+    else if (unformat (line_input, "nsi %d", &nsi))
+      nsi_set = 1;
+    else
+      return clib_error_return (0, "parse error: '%U'",
+                                format_unformat_error, line_input);
+  }
+
+  unformat_free (line_input);
+
+  if (src_set == 0 || dst_set == 0)
+    return clib_error_return (0, "src and dst required");
+
+  if (a->is_add && (nsp_set == 0 || nsi_set == 0))
+    return clib_error_return (0, "nsp nsi pair required. Key: for NSH map");
+
+  a->src_len = src_len == ~0 ? (a->is_ip6 ? 128 : 32) : src_len;
+  a->dst_len = dst_len == ~0 ? (a->is_ip6 ? 128 : 32) : dst_len;
+  a->protocol = protocol;
+  a->src_port = src_port;
+  a->dst_port = dst_port;
+  if (a->is_add)
+    a->nsp_nsi = (nsp<< NSH_NSP_SHIFT) | nsi;
+
+  rv = nsh_classify_add_del_session (a);
+
+  switch (rv)
+    {
+    case 0:
+      break;
+    case -1:
+      return clib_error_return (0, "invalid prefix length");
+    case -2:
+      return clib_error_return (0, "session does not exist.");
+    case -3:
+      return clib_error_return (0, "too many masks, at most %d",
+                                NSH_CLASSIFY_MAX_MASKS);
+    default:
+      return clib_error_return
+        (0, "nsh_classify_add_del_session returned %d", rv);
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (nsh_classify_session_command, static) = {
+  .path = "nsh classify session",
+  .short_help =
+  "nsh classify session [del] src <ip>[/<len>] dst <ip>[/<len>] "
+  "[proto <nn> sport <nn> dport <nn>] nsp <nn> nsi <nn>",
+  .function = nsh_classify_session_command_fn,
+};
+
+static clib_error_t *
+set_interface_nsh_classify_command_fn (vlib_main_t * vm,
+                                       unformat_input_t * input,
+                                       vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = vnet_get_main ();
+  u32 sw_if_index = ~0;
+  int is_enable = 1;
+  u8 is_ip6 = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface, vnm,
+                    &sw_if_index))
+        ;
+      else if (unformat (input, "ip6"))
+        is_ip6 = 1;
+      else if (unformat (input, "ip4"))
+        is_ip6 = 0;
+      else if (unformat (input, "disable"))
+        is_enable = 0;
+      else
+        return clib_error_return (0, "parse error: '%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "interface required");
+
+  nsh_classify_enable_disable (sw_if_index, is_ip6, is_enable);
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (set_interface_nsh_classify_command, static) = {
+  .path = "set interface nsh classify",
+  .short_help = "set interface nsh classify <interface> [ip4 | ip6] [disable]",
+  .function = set_interface_nsh_classify_command_fn,
+};
+
+static clib_error_t *
+set_nsh_classify_flow_cache_command_fn (vlib_main_t * vm,
+                                        unformat_input_t * input,
+                                        vlib_cli_command_t * cmd)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  u32 timeout = 0, max_flows = 0;
+  u8 enable = cm->flow_cache_enable;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "enable"))
+        enable = 1;
+      else if (unformat (input, "disable"))
+        enable = 0;
+      else if (unformat (input, "timeout %d", &timeout))
+        ;
+      else if (unformat (input, "max-flows %d", &max_flows))
+        ;
+      else
+        return clib_error_return (0, "parse error: '%U'",
+                                  format_unformat_error, input);
+    }
+
+  rv = nsh_classify_flow_cache_config (enable, timeout, max_flows);
+
+  switch (rv)
+    {
+    case 0:
+      break;
+    case -1:
+      return clib_error_return (0, "timeout must be at most %d seconds",
+                                NSH_CLASSIFY_FLOW_MAX_TIMEOUT);
+    case -2:
+      return clib_error_return (0, "max-flows must be at most %d",
+                                NSH_CLASSIFY_FLOW_MAX_FLOWS);
+    default:
+      return clib_error_return
+        (0, "nsh_classify_flow_cache_config returned %d", rv);
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (set_nsh_classify_flow_cache_command, static) = {
+  .path = "set nsh classify flow-cache",
+  .short_help = "set nsh classify flow-cache [enable | disable] "
+  "[timeout <seconds>] [max-flows <nn>]",
+  .function = set_nsh_classify_flow_cache_command_fn,
+};
+
+static clib_error_t *
+clear_nsh_classify_flows_command_fn (vlib_main_t * vm,
+                                     unformat_input_t * input,
+                                     vlib_cli_command_t * cmd)
+{
+  /* Each thread flushes its own cache on its next frame */
+  nsh_classify_main.flow_cache_epoch++;
+  return 0;
+}
+
+VLIB_CLI_COMMAND (clear_nsh_classify_flows_command, static) = {
+  .path = "clear nsh classify flows",
+  .short_help = "clear nsh classify flows",
+  .function = clear_nsh_classify_flows_command_fn,
+};
+
+static clib_error_t *
+show_nsh_classify_command_fn (vlib_main_t * vm,
+                              unformat_input_t * input,
+                              vlib_cli_command_t * cmd)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  nsh_classify_flow_cache_t * fc;
+  nsh_classify_mask_t * m;
+  int verbose = 0;
+  u32 * mask_index;
+  u8 is_ip6;
+
+  if (unformat (input, "verbose"))
+    verbose = 1;
+
+  for (is_ip6 = 0; is_ip6 < 2; is_ip6++)
+    {
+      vlib_cli_output (vm, "%s masks, in lookup order:",
+                       is_ip6 ? "ip6" : "ip4");
+      vec_foreach (mask_index, cm->mask_order[is_ip6])
+        {
+          m = pool_elt_at_index (cm->masks[is_ip6], mask_index[0]);
+          vlib_cli_output (vm, "  src /%d dst /%d%s: %d sessions",
+                           m->src_len, m->dst_len,
+                           m->match_ports ? " proto ports" : "",
+                           m->n_sessions);
+        }
+
+      if (verbose && cm->table_initialized[is_ip6])
+        vlib_cli_output (vm, "%U", is_ip6 ? format_bihash_48_8 :
+                         format_bihash_16_8,
+                         is_ip6 ? (void *) &cm->table6 :
+                         (void *) &cm->table4, 0);
+    }
+
+  vlib_cli_output (vm, "flow cache %s, idle timeout %ds, max %d flows "
+                   "per thread", cm->flow_cache_enable ? "on" : "off",
+                   cm->flow_idle_timeout, cm->flow_cache_max);
+  vec_foreach (fc, cm->flow_caches)
+    vlib_cli_output (vm, "  thread %d: %d flows", fc - cm->flow_caches,
+                     pool_elts (fc->flows));
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (show_nsh_classify_command, static) = {
+  .path = "show nsh classify",
+  .short_help = "show nsh classify [verbose]",
+  .function = show_nsh_classify_command_fn,
+};
+
+static clib_error_t *
+nsh_classify_init (vlib_main_t * vm)
+{
+  nsh_classify_main_t * cm = &nsh_classify_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  nsh_classify_flow_cache_t * fc;
+
+  cm->flow_cache_enable = 1;
+  cm->flow_cache_max = NSH_CLASSIFY_FLOW_DEFAULT_MAX;
+  cm->flow_idle_timeout = NSH_CLASSIFY_FLOW_DEFAULT_TIMEOUT;
+
+  vec_validate_aligned (cm->flow_caches, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_foreach (fc, cm->flow_caches)
+    {
+      /* Sized for the default up front, workers only grow it past that */
+      pool_alloc (fc->flows, cm->flow_cache_max);
+      tw_timer_wheel_init_2t_1w_2048sl (&fc->wheel,
+                                        nsh_classify_flow_expired,
+                                        1.0 /* timer interval */, ~0);
+      fc->wheel.last_run_time = vlib_time_now (vm);
+    }
+
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (nsh_classify_init);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef included_nsh_classify_h
+#define included_nsh_classify_h
+
+#include <vnet/vnet.h>
+#include <vnet/ip/ip.h>
+
+/** Note:
+ * A session matches a source and a destination prefix and, when
+ * match_ports is set, the protocol and the L4 ports as well. Host
+ * prefixes with match_ports make the classic exact 5-tuple.
+ */
+typedef struct {
+  u8 is_add;
+  u8 is_ip6;
+  ip46_address_t src;
+  ip46_address_t dst;
+  u8 src_len;
+  u8 dst_len;
+  u8 match_ports;
+  u8 protocol;
+  u16 src_port;
+  u16 dst_port;
+  /* 24bit NSP 8bit NSI of the map to push with, host order */
+  u32 nsp_nsi;
+} nsh_classify_session_args_t;
+
+int nsh_classify_add_del_session (nsh_classify_session_args_t * a);
+int nsh_classify_enable_disable (u32 sw_if_index, u8 is_ip6, int is_enable);
+int nsh_classify_flow_cache_config (u8 enable, u32 timeout, u32 max_flows);
+
+#endif /* included_nsh_classify_h */
@@ -0,0 +1,327 @@
+/*
+ * nsh_handoff.c - hand NSH packets off to a worker chosen by service path
+ *
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <vlib/threads.h>
+#include <vnet/vnet.h>
+#include <vnet/ethernet/ethernet.h>
+#include <vnet/vxlan-gpe/vxlan_gpe.h>
+#include <vppinfra/xxhash.h>
+#include <nsh/nsh.h>
+
+/* Frame queue depth, and the fill level at which a worker counts as congested */
+#define NSH_HANDOFF_FQ_NELTS 64
+#define NSH_HANDOFF_FQ_HI_THRESH (NSH_HANDOFF_FQ_NELTS - 2)
+
+typedef struct {
+  u32 next_worker_index;
+  u32 nsp_nsi;
+} nsh_handoff_trace_t;
+
+#define foreach_nsh_handoff_error                       \
+_(HANDED_OFF, "packets handed off to another worker")   \
+_(LOCAL, "packets processed on this worker")            \
+_(CONGESTION_DROP, "congestion drop")
+
+typedef enum {
+#define _(sym,str) NSH_HANDOFF_ERROR_##sym,
+  foreach_nsh_handoff_error
+#undef _
+  NSH_HANDOFF_N_ERROR,
+} nsh_handoff_error_t;
+
+static char * nsh_handoff_error_strings[] = {
+#define _(sym,string) string,
+  foreach_nsh_handoff_error
+#undef _
+};
+
+#define foreach_nsh_handoff_next        \
+_(DROP, "error-drop")                   \
+_(NSH_INPUT, "nsh-input")
+
+typedef enum {
+#define _(s,n) NSH_HANDOFF_NEXT_##s,
+  foreach_nsh_handoff_next
+#undef _
+  NSH_HANDOFF_N_NEXT,
+} nsh_handoff_next_t;
+
+/* Per-thread handoff state, as used by the other VPP handoff nodes */
+static __thread vlib_frame_queue_elt_t ** handoff_queue_elt_by_worker_index;
+static __thread vlib_frame_queue_t ** congested_handoff_queue_by_worker_index;
+
+static u8 *
+format_nsh_handoff_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  nsh_handoff_trace_t * t = va_arg (*args, nsh_handoff_trace_t *);
+  u32 nsp_nsi = clib_net_to_host_u32 (t->nsp_nsi);
+
+  s = format (s, "nsp %d nsi %d next worker %d",
+              (nsp_nsi >> NSH_NSP_SHIFT) & NSH_NSP_MASK,
+              nsp_nsi & NSH_NSI_MASK, t->next_worker_index);
+  return s;
+}
+
+/**
+ * @brief Graph node steering NSH packets to a worker by service path
+ *
+ * Hashing the nsp_nsi keeps every packet of a service path on one worker,
+ * so the per-path state touched by nsh-input stays in that worker's cache.
+ * Packets for the current thread go straight to nsh-input, the rest are
+ * batched into frame queue elements per destination worker.
+ */
+static uword
+nsh_handoff_node_fn (vlib_main_t * vm,
+                     vlib_node_runtime_t * node,
+                     vlib_frame_t * frame)
+{
+  nsh_main_t * nm = &nsh_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  u32 n_left_from, * from;
+  vlib_frame_queue_elt_t * hf = 0;
+  u32 n_left_to_next_worker = 0, * to_next_worker = 0;
+  u32 next_worker_index, current_worker_index = ~0;
+  u32 thread_index = vlib_get_thread_index ();
+  u32 counts[NSH_HANDOFF_N_ERROR] = { 0 };
+  int i;
+
+  if (PREDICT_FALSE (handoff_queue_elt_by_worker_index == 0))
+    {
+      vec_validate (handoff_queue_elt_by_worker_index, tm->n_vlib_mains - 1);
+
+      vec_validate_init_empty (congested_handoff_queue_by_worker_index,
+                               nm->first_worker_index + nm->num_workers - 1,
+                               (vlib_frame_queue_t *) (~0));
+    }
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+
+  while (n_left_from > 0)
+    {
+      u32 bi0;
+      vlib_buffer_t * b0;
+      nsh_base_header_t * hdr0;
+      u32 hash0;
+
+      bi0 = from[0];
+      from += 1;
+      n_left_from -= 1;
+
+      b0 = vlib_get_buffer (vm, bi0);
+      hdr0 = vlib_buffer_get_current (b0);
+
+      hash0 = clib_xxhash (hdr0->nsp_nsi);
+      if (PREDICT_TRUE (is_pow2 (nm->num_workers)))
+        hash0 &= nm->num_workers - 1;
+      else
+        hash0 %= nm->num_workers;
+      next_worker_index = nm->first_worker_index + hash0;
+
+      if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+        {
+          nsh_handoff_trace_t * t =
+            vlib_add_trace (vm, node, b0, sizeof (*t));
+          t->next_worker_index = next_worker_index;
+          t->nsp_nsi = hdr0->nsp_nsi;
+        }
+
+      if (next_worker_index == thread_index)
+        {
+          vlib_set_next_frame_buffer (vm, node, NSH_HANDOFF_NEXT_NSH_INPUT,
+                                      bi0);
+          counts[NSH_HANDOFF_ERROR_LOCAL] += 1;
+          continue;
+        }
+
+      if (PREDICT_FALSE
+          (is_vlib_frame_queue_congested
+           (nm->handoff_fq_index, next_worker_index, NSH_HANDOFF_FQ_HI_THRESH,
+            congested_handoff_queue_by_worker_index)))
+        {
+          b0->error = node->errors[NSH_HANDOFF_ERROR_CONGESTION_DROP];
+          vlib_set_next_frame_buffer (vm, node, NSH_HANDOFF_NEXT_DROP, bi0);
+          counts[NSH_HANDOFF_ERROR_CONGESTION_DROP] += 1;
+          continue;
+        }
+
+      if (next_worker_index != current_worker_index)
+        {
+          if (hf)
+            hf->n_vectors = VLIB_FRAME_SIZE - n_left_to_next_worker;
+
+          hf = vlib_get_worker_handoff_queue_elt (nm->handoff_fq_index,
+                                                  next_worker_index,
+                                                  handoff_queue_elt_by_worker_index);
+
+          n_left_to_next_worker = VLIB_FRAME_SIZE - hf->n_vectors;
+          to_next_worker = &hf->buffer_index[hf->n_vectors];
+          current_worker_index = next_worker_index;
+        }
+
+      to_next_worker[0] = bi0;
+      to_next_worker++;
+      n_left_to_next_worker--;
+      counts[NSH_HANDOFF_ERROR_HANDED_OFF] += 1;
+
+      if (n_left_to_next_worker == 0)
+        {
+          hf->n_vectors = VLIB_FRAME_SIZE;
+          vlib_put_frame_queue_elt (hf);
+          current_worker_index = ~0;
+          handoff_queue_elt_by_worker_index[next_worker_index] = 0;
+          hf = 0;
+        }
+    }
+
+  if (hf)
+    hf->n_vectors = VLIB_FRAME_SIZE - n_left_to_next_worker;
+
+  /* Ship frames to the worker nodes */
+  for (i = 0; i < vec_len (handoff_queue_elt_by_worker_index); i++)
+    {
+      if (handoff_queue_elt_by_worker_index[i])
+        {
+          hf = handoff_queue_elt_by_worker_index[i];
+          vlib_put_frame_queue_elt (hf);
+          handoff_queue_elt_by_worker_index[i] = 0;
+        }
+    }
+  for (i = 0; i < vec_len (congested_handoff_queue_by_worker_index); i++)
+    congested_handoff_queue_by_worker_index[i] = (vlib_frame_queue_t *) (~0);
+
+  for (i = 0; i < NSH_HANDOFF_N_ERROR; i++)
+    if (counts[i])
+      vlib_node_increment_counter (vm, node->node_index, i, counts[i]);
+
+  return frame->n_vectors;
+}
+
+VLIB_REGISTER_NODE (nsh_handoff_node) = {
+  .function = nsh_handoff_node_fn,
+  .name = "nsh-handoff",
+  .vector_size = sizeof (u32),
+  .format_trace = format_nsh_handoff_trace,
+  .format_buffer = format_nsh_header,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(nsh_handoff_error_strings),
+  .error_strings = nsh_handoff_error_strings,
+
+  .n_next_nodes = NSH_HANDOFF_N_NEXT,
+  .next_nodes = {
+#define _(s,n) [NSH_HANDOFF_NEXT_##s] = n,
+    foreach_nsh_handoff_next
+#undef _
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (nsh_handoff_node, nsh_handoff_node_fn)
+
+/**
+ * Action function to steer NSH traffic from vxlan-gpe and Ethernet
+ * through nsh-handoff, or back directly to nsh-input.
+ * Returns -1 when there are no worker threads to hand off to.
+ */
+int
+nsh_handoff_enable_disable (int is_enable)
+{
+  nsh_main_t * nm = &nsh_main;
+  vlib_main_t * vm = nm->vlib_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  vlib_thread_registration_t * tr;
+  uword * p;
+  u32 node_index;
+  uword next_node;
+
+  if (is_enable)
+    {
+      p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+      if (p == 0)
+        return -1;
+
+      tr = (vlib_thread_registration_t *) p[0];
+      if (tr->count == 0)
+        return -1;
+
+      nm->first_worker_index = tr->first_index;
+      nm->num_workers = tr->count;
+
+      if (nm->handoff_fq_index == ~0)
+        nm->handoff_fq_index =
+          vlib_frame_queue_main_init (nsh_input_node.index,
+                                      NSH_HANDOFF_FQ_NELTS);
+      node_index = nsh_handoff_node.index;
+    }
+  else
+    node_index = nsh_input_node.index;
+
+  next_node = vlib_node_add_next (vm, vxlan4_gpe_input_node.index, node_index);
+  vlib_node_add_next (vm, vxlan6_gpe_input_node.index, node_index);
+  vxlan_gpe_register_decap_protocol (VXLAN_GPE_PROTOCOL_NSH, next_node);
+
+  ethernet_register_input_type (vm, ETHERNET_TYPE_NSH, node_index);
+
+  nm->handoff_enabled = is_enable ? 1 : 0;
+
+  /* Policers no longer split their rate over the workers, or must again */
+  nsh_policer_update_rates ();
+
+  return 0;
+}
+
+static clib_error_t *
+nsh_handoff_command_fn (vlib_main_t * vm,
+                        unformat_input_t * input,
+                        vlib_cli_command_t * cmd)
+{
+  int is_enable = 1;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "disable"))
+        is_enable = 0;
+      else
+        return clib_error_return (0, "parse error: '%U'",
+                                  format_unformat_error, input);
+    }
+
+  rv = nsh_handoff_enable_disable (is_enable);
+
+  switch (rv)
+    {
+    case 0:
+      break;
+    case -1:
+      return clib_error_return (0, "no worker threads to hand off to");
+    default:
+      return clib_error_return
+        (0, "nsh_handoff_enable_disable returned %d", rv);
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (nsh_handoff_command, static) = {
+  .path = "set nsh handoff",
+  .short_help = "set nsh handoff [disable]",
+  .function = nsh_handoff_command_fn,
+};
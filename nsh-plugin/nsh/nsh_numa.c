@@ -0,0 +1,398 @@
+/*
+ * nsh_numa.c - NUMA local replicas of the NSH forwarding tables
+ *
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vnet/vnet.h>
+#include <vlib/threads.h>
+#include <nsh/nsh.h>
+#include <nsh/nsh_numa.h>
+
+/** Note:
+ * With "numa-replicas" in the nsh startup section, every NUMA node
+ * running a thread gets a copy of the maps, the entries, their lookup
+ * hashes and the rewrites, allocated from a heap bound to that node.
+ * Each thread then reads the copy of its own node. Configuration keeps
+ * changing nsh_main's tables only; the first change of a main loop
+ * iteration schedules nsh-numa-process, which rebuilds every replica
+ * and swaps them in, so a burst of API calls costs one rebuild. The old
+ * replicas go once the workers have been through a barrier. The heaps do
+ * not grow: a node whose heap cannot hold the tables next to the replica
+ * being replaced has its threads read nsh_main's tables instead.
+ */
+
+nsh_numa_main_t nsh_numa_main;
+
+static vlib_node_registration_t nsh_numa_process_node;
+
+static void *
+nsh_numa_heap_create (u32 numa_node, uword size)
+{
+  clib_mem_vm_alloc_t alloc = { 0 };
+  clib_error_t * error;
+  void * heap;
+
+  alloc.name = "nsh numa replica";
+  alloc.size = size;
+  alloc.numa_node = numa_node;
+  alloc.flags = CLIB_MEM_VM_F_NUMA_PREFER;
+
+  if ((error = clib_mem_vm_ext_alloc (&alloc)))
+    {
+      clib_error_report (error);
+      return 0;
+    }
+
+#if USE_DLMALLOC == 0
+  heap = mheap_alloc (alloc.addr, size);
+#else
+  heap = create_mspace_with_base (alloc.addr, size, 1 /* locked */);
+  mspace_disable_expand (heap);
+#endif
+
+  return heap;
+}
+
+/* Bytes a hash_create_mem hash of n u32 keys takes, generously */
+#define nsh_numa_hash_size(n) \
+  ((n) * (sizeof (u32) + 4 * sizeof (uword)) + 2 * CLIB_CACHE_LINE_BYTES)
+
+/*
+ * What a replica of the current tables takes from its heap, with a
+ * margin for allocator overhead. The heap cannot grow, so a rebuild
+ * only goes ahead when this fits.
+ */
+static uword
+nsh_numa_replica_size (void)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_map_t * map;
+  nsh_entry_t * entry;
+  uword size;
+
+  size = sizeof (nsh_numa_replica_t)
+    + vec_len (nm->nsh_mappings) * sizeof (nsh_map_t)
+    + vec_len (nm->nsh_entries) * sizeof (nsh_entry_t)
+    + nsh_numa_hash_size (hash_elts (nm->nsh_mapping_by_key))
+    + nsh_numa_hash_size (hash_elts (nm->nsh_entry_by_key));
+
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    if (map->fused_rewrite)
+      size += vec_len (map->fused_rewrite) + 2 * CLIB_CACHE_LINE_BYTES;
+  }));
+  pool_foreach (entry, nm->nsh_entries,
+  ({
+    size += vec_len (entry->rewrite) + vec_len (entry->tlvs_data)
+      + 4 * CLIB_CACHE_LINE_BYTES;
+  }));
+
+  return size + size / 4;
+}
+
+static nsh_numa_replica_t *
+nsh_numa_replica_build (u32 numa_node, uword size)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_numa_main_t * nnm = &nsh_numa_main;
+  nsh_numa_replica_t * r;
+  nsh_map_t * map, * rm;
+  nsh_entry_t * entry, * re;
+  void * oldheap;
+  u32 * key, i;
+  uword value;
+
+  oldheap = clib_mem_set_heap (nnm->heaps[numa_node]);
+
+  r = clib_mem_alloc_aligned (sizeof (*r), CLIB_CACHE_LINE_BYTES);
+  memset (r, 0, sizeof (*r));
+  r->numa_node = numa_node;
+  r->size = size;
+
+  /* Same indices as the pools, the free ones left zero */
+  vec_resize_aligned (r->tables.maps, vec_len (nm->nsh_mappings),
+                      CLIB_CACHE_LINE_BYTES);
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    rm = &r->tables.maps[map - nm->nsh_mappings];
+    *rm = *map;
+    rm->fused_rewrite = vec_dup (map->fused_rewrite);
+    memset (&rm->fused_dpo, 0, sizeof (rm->fused_dpo));
+  }));
+
+  vec_resize_aligned (r->tables.entries, vec_len (nm->nsh_entries),
+                      CLIB_CACHE_LINE_BYTES);
+  pool_foreach (entry, nm->nsh_entries,
+  ({
+    re = &r->tables.entries[entry - nm->nsh_entries];
+    *re = *entry;
+    re->rewrite = vec_dup (entry->rewrite);
+    re->tlvs_data = vec_dup (entry->tlvs_data);
+  }));
+
+  r->tables.map_by_key =
+    hash_create_mem (hash_elts (nm->nsh_mapping_by_key), sizeof (u32),
+                     sizeof (uword));
+  vec_resize (r->map_keys, hash_elts (nm->nsh_mapping_by_key));
+  i = 0;
+  hash_foreach_mem (key, value, nm->nsh_mapping_by_key,
+  ({
+    r->map_keys[i] = key[0];
+    hash_set_mem (r->tables.map_by_key, &r->map_keys[i], value);
+    i++;
+  }));
+
+  r->tables.entry_by_key =
+    hash_create_mem (hash_elts (nm->nsh_entry_by_key), sizeof (u32),
+                     sizeof (uword));
+  vec_resize (r->entry_keys, hash_elts (nm->nsh_entry_by_key));
+  i = 0;
+  hash_foreach_mem (key, value, nm->nsh_entry_by_key,
+  ({
+    r->entry_keys[i] = key[0];
+    hash_set_mem (r->tables.entry_by_key, &r->entry_keys[i], value);
+    i++;
+  }));
+
+  clib_mem_set_heap (oldheap);
+
+  /* The replica holds its own lock on the fused load balances, so that
+   * a restack does not free one it still points at */
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    if (dpo_id_is_valid (&map->fused_dpo))
+      dpo_copy (&r->tables.maps[map - nm->nsh_mappings].fused_dpo,
+                &map->fused_dpo);
+  }));
+
+  return r;
+}
+
+static void
+nsh_numa_replica_free (nsh_numa_replica_t * r)
+{
+  nsh_numa_main_t * nnm = &nsh_numa_main;
+  nsh_map_t * rm;
+  nsh_entry_t * re;
+  void * oldheap;
+
+  vec_foreach (rm, r->tables.maps)
+    dpo_reset (&rm->fused_dpo);
+
+  oldheap = clib_mem_set_heap (nnm->heaps[r->numa_node]);
+
+  vec_foreach (rm, r->tables.maps)
+    vec_free (rm->fused_rewrite);
+  vec_foreach (re, r->tables.entries)
+    {
+      vec_free (re->rewrite);
+      vec_free (re->tlvs_data);
+    }
+
+  vec_free (r->tables.maps);
+  vec_free (r->tables.entries);
+  hash_free (r->tables.map_by_key);
+  hash_free (r->tables.entry_by_key);
+  vec_free (r->map_keys);
+  vec_free (r->entry_keys);
+  clib_mem_free (r);
+
+  clib_mem_set_heap (oldheap);
+}
+
+/*
+ * Build a replica per NUMA node a thread runs on, point the threads at
+ * theirs, then free the replicas they read until now.
+ */
+static void
+nsh_numa_replicas_rebuild (void)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_numa_main_t * nnm = &nsh_numa_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  nsh_numa_replica_t ** by_node = 0, ** old = 0, * r;
+  nsh_numa_replica_t ** by_thread;
+  uword size, * in_use = 0;
+  u32 i, numa_node;
+
+  nnm->dirty = 0;
+  size = nsh_numa_replica_size ();
+
+  /* The current replicas stay in their heaps until the new ones are in */
+  for (i = 0; i < vec_len (nnm->replica_by_thread); i++)
+    {
+      r = nnm->replica_by_thread[i];
+      if (r == 0 || vec_search (old, r) != ~0)
+        continue;
+      vec_add1 (old, r);
+      vec_validate (in_use, r->numa_node);
+      in_use[r->numa_node] += r->size;
+    }
+  vec_reset_length (old);
+
+  for (i = 0; i < tm->n_vlib_mains; i++)
+    {
+      numa_node = vlib_mains[i]->numa_node;
+      vec_validate (nnm->heaps, numa_node);
+      vec_validate (by_node, numa_node);
+      vec_validate (in_use, numa_node);
+
+      if (nnm->heaps[numa_node] == 0)
+        nnm->heaps[numa_node] = nsh_numa_heap_create (numa_node,
+                                                      nnm->heap_size);
+      /* Threads of a node without heap, or without room in it for the
+       * tables, read nsh_main's tables */
+      if (nnm->heaps[numa_node] == 0 || by_node[numa_node])
+        continue;
+      if (in_use[numa_node] + size > nnm->heap_size)
+        {
+          nnm->n_too_big++;
+          continue;
+        }
+      by_node[numa_node] = nsh_numa_replica_build (numa_node, size);
+      in_use[numa_node] += size;
+    }
+
+  by_thread = nnm->replica_by_thread;
+  if (by_thread == 0)
+    {
+      vec_validate (by_thread, tm->n_vlib_mains - 1);
+      CLIB_MEMORY_BARRIER ();
+      nnm->replica_by_thread = by_thread;
+    }
+
+  for (i = 0; i < tm->n_vlib_mains; i++)
+    {
+      r = by_thread[i];
+      if (r && vec_search (old, r) == ~0)
+        vec_add1 (old, r);
+      by_thread[i] = by_node[vlib_mains[i]->numa_node];
+    }
+
+  if (vec_len (old))
+    {
+      vlib_worker_thread_barrier_sync (nm->vlib_main);
+      vlib_worker_thread_barrier_release (nm->vlib_main);
+    }
+
+  for (i = 0; i < vec_len (old); i++)
+    nsh_numa_replica_free (old[i]);
+
+  nnm->n_rebuilds++;
+  vec_free (by_node);
+  vec_free (in_use);
+  vec_free (old);
+}
+
+/**
+ * Have the replicas catch up with a change of nsh_main's maps or entries,
+ * once the current main loop iteration is done changing them.
+ */
+void
+nsh_numa_replicas_update (void)
+{
+  nsh_numa_main_t * nnm = &nsh_numa_main;
+
+  if (!nnm->enabled || nnm->dirty)
+    return;
+
+  nnm->dirty = 1;
+  vlib_process_signal_event (nsh_main.vlib_main, nsh_numa_process_node.index,
+                             0, 0);
+}
+
+/**
+ * Rebuild the replicas now, for changes that are about to free something
+ * the current ones may point at.
+ */
+void
+nsh_numa_replicas_sync (void)
+{
+  nsh_numa_main_t * nnm = &nsh_numa_main;
+
+  if (nnm->replica_by_thread)
+    nsh_numa_replicas_rebuild ();
+}
+
+static uword
+nsh_numa_process (vlib_main_t * vm,
+                  vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  nsh_numa_main_t * nnm = &nsh_numa_main;
+  uword * event_data = 0;
+
+  /* Workers are up by now, their NUMA nodes are known */
+  if (nnm->enabled)
+    nsh_numa_replicas_rebuild ();
+
+  while (1)
+    {
+      vlib_process_wait_for_event (vm);
+      vlib_process_get_events (vm, &event_data);
+      vec_reset_length (event_data);
+
+      if (nnm->dirty)
+        nsh_numa_replicas_rebuild ();
+    }
+
+  return 0;			/* not so much */
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (nsh_numa_process_node, static) =
+{
+ .function = nsh_numa_process,
+ .type = VLIB_NODE_TYPE_PROCESS,
+ .name = "nsh-numa-process",
+};
+/* *INDENT-ON* */
+
+u8 *
+format_nsh_numa_memory (u8 * s, va_list * args)
+{
+  nsh_numa_main_t * nnm = &nsh_numa_main;
+  nsh_numa_replica_t ** seen = 0, * r;
+  u32 i;
+
+  if (!nnm->enabled)
+    return format (s, "disabled");
+
+  s = format (s, "%U heap per node, %d rebuilds, %d too big for the heap",
+              format_memory_size, nnm->heap_size, nnm->n_rebuilds,
+              nnm->n_too_big);
+
+  for (i = 0; i < vec_len (nnm->replica_by_thread); i++)
+    {
+      r = nnm->replica_by_thread[i];
+      if (r == 0 || vec_search (seen, r) != ~0)
+        continue;
+      vec_add1 (seen, r);
+      s = format (s, "\n  numa %d: %d maps, %d entries, about %U",
+                  r->numa_node, hash_elts (r->tables.map_by_key),
+                  hash_elts (r->tables.entry_by_key),
+                  format_memory_size, r->size);
+    }
+
+  vec_free (seen);
+  return s;
+}
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef included_nsh_numa_h
+#define included_nsh_numa_h
+
+#include <nsh/nsh.h>
+
+/** Note:
+ * The map and entry tables the data plane reads: nsh_main's own, or the
+ * replica of the worker's NUMA node. Maps and entries keep their pool
+ * index in a replica, so indices are the same whichever is read.
+ */
+typedef struct {
+  nsh_map_t * maps;
+  nsh_entry_t * entries;
+  uword * map_by_key;
+  uword * entry_by_key;
+} nsh_fwd_tables_t;
+
+typedef struct {
+  nsh_fwd_tables_t tables;
+
+  /* hash keys, sized once so the hashes may point into them */
+  u32 * map_keys;
+  u32 * entry_keys;
+
+  u32 numa_node;
+  /* estimated bytes taken from the node's heap */
+  uword size;
+} nsh_numa_replica_t;
+
+typedef struct {
+  /* replicate the tables, from the startup config */
+  u8 enabled;
+  uword heap_size;
+
+  /* per NUMA node, 0 where no thread runs */
+  void ** heaps;
+
+  /* replicas read by each thread, 0 to read nsh_main's tables. The
+   * whole set is rebuilt on change and swapped one thread at a time. */
+  nsh_numa_replica_t ** replica_by_thread;
+
+  /* a rebuild is pending */
+  u8 dirty;
+  u32 n_rebuilds;
+  /* rebuilds a node read nsh_main's tables, its heap being too small */
+  u32 n_too_big;
+} nsh_numa_main_t;
+
+extern nsh_numa_main_t nsh_numa_main;
+
+#define NSH_NUMA_DEFAULT_HEAP_SIZE (64 << 20)
+
+void nsh_numa_replicas_update (void);
+void nsh_numa_replicas_sync (void);
+u8 * format_nsh_numa_memory (u8 * s, va_list * args);
+
+/*
+ * Tables for the thread to read; a frame sticks to what it got, the
+ * replica it may point at is only freed past a worker barrier.
+ */
+always_inline nsh_fwd_tables_t *
+nsh_fwd_tables_get (u32 thread_index, nsh_fwd_tables_t * own)
+{
+  nsh_numa_main_t * nnm = &nsh_numa_main;
+  nsh_main_t * nm = &nsh_main;
+  nsh_numa_replica_t * r;
+
+  if (PREDICT_FALSE (nnm->replica_by_thread != 0))
+    {
+      r = nnm->replica_by_thread[thread_index];
+      if (r)
+        return &r->tables;
+    }
+
+  own->maps = nm->nsh_mappings;
+  own->entries = nm->nsh_entries;
+  own->map_by_key = nm->nsh_mapping_by_key;
+  own->entry_by_key = nm->nsh_entry_by_key;
+  return own;
+}
+
+#endif /* included_nsh_numa_h */
@@ -31,7 +31,8 @@ typedef struct {
 
 #define foreach_nsh_output_next        	\
 _(DROP, "error-drop")            \
-_(INTERFACE, "interface-output" )
+_(INTERFACE, "interface-output" ) \
+_(TOO_BIG, "nsh-too-big")
 
 typedef enum {
 #define _(s,n) NSH_OUTPUT_NEXT_##s,
@@ -88,13 +89,13 @@ nsh_output_inline (vlib_main_t * vm,
           nsh_base_header_t *hdr0;
           ethernet_header_t * eth_hdr0;
           vlib_buffer_t * p0;
-          u32 pi0, rw_len0, adj_index0, next0, error0;
+          u32 pi0, rw_len0, adj_index0, next0, error0, len0;
 
           ip_adjacency_t * adj1;
           nsh_base_header_t *hdr1;
           ethernet_header_t * eth_hdr1;
           vlib_buffer_t * p1;
-          u32 pi1, rw_len1, adj_index1, next1, error1;
+          u32 pi1, rw_len1, adj_index1, next1, error1, len1;
 
           /* Prefetch next iteration. */
           {
@@ -142,23 +143,26 @@ nsh_output_inline (vlib_main_t * vm,
           rw_len0 = adj0[0].rewrite_header.data_bytes;
           rw_len1 = adj1[0].rewrite_header.data_bytes;
 
+          /* Walk each chain at most once, the total is cached in the buffer */
+          len0 = vlib_buffer_length_in_chain (vm, p0);
+          len1 = vlib_buffer_length_in_chain (vm, p1);
+
           /* Bump the adj counters for packet and bytes */
           vlib_increment_combined_counter
               (&adjacency_counters,
                thread_index,
                adj_index0,
                1,
-               vlib_buffer_length_in_chain (vm, p0) + rw_len0);
+               len0 + rw_len0);
           vlib_increment_combined_counter
               (&adjacency_counters,
                thread_index,
                adj_index1,
                1,
-               vlib_buffer_length_in_chain (vm, p1) + rw_len1);
+               len1 + rw_len1);
 
           /* Check MTU of outgoing interface. */
-          if (PREDICT_TRUE(vlib_buffer_length_in_chain (vm, p0) <=
-                           adj0[0].rewrite_header.max_l3_packet_bytes))
+          if (PREDICT_TRUE(len0 <= adj0[0].rewrite_header.max_l3_packet_bytes))
             {
               p0->current_data -= rw_len0;
               p0->current_length += rw_len0;
@@ -175,11 +179,10 @@ nsh_output_inline (vlib_main_t * vm,
             }
           else
             {
-              error0 = IP4_ERROR_MTU_EXCEEDED;
-              next0 = NSH_OUTPUT_NEXT_DROP;
+              error0 = IP4_ERROR_NONE;
+              next0 = NSH_OUTPUT_NEXT_TOO_BIG;
             }
-          if (PREDICT_TRUE(vlib_buffer_length_in_chain (vm, p1) <=
-                           adj1[0].rewrite_header.max_l3_packet_bytes))
+          if (PREDICT_TRUE(len1 <= adj1[0].rewrite_header.max_l3_packet_bytes))
             {
               p1->current_data -= rw_len1;
               p1->current_length += rw_len1;
@@ -196,15 +199,17 @@ nsh_output_inline (vlib_main_t * vm,
             }
           else
             {
-              error1 = IP4_ERROR_MTU_EXCEEDED;
-              next1 = NSH_OUTPUT_NEXT_DROP;
+              error1 = IP4_ERROR_NONE;
+              next1 = NSH_OUTPUT_NEXT_TOO_BIG;
             }
           if (is_midchain)
           {
-              adj0->sub_type.midchain.fixup_func
-                (vm, adj0, p0, adj0->sub_type.midchain.fixup_data);
-              adj1->sub_type.midchain.fixup_func
-                (vm, adj1, p1, adj1->sub_type.midchain.fixup_data);
+              if (PREDICT_TRUE(next0 != NSH_OUTPUT_NEXT_TOO_BIG))
+                adj0->sub_type.midchain.fixup_func
+                  (vm, adj0, p0, adj0->sub_type.midchain.fixup_data);
+              if (PREDICT_TRUE(next1 != NSH_OUTPUT_NEXT_TOO_BIG))
+                adj1->sub_type.midchain.fixup_func
+                  (vm, adj1, p1, adj1->sub_type.midchain.fixup_data);
           }
 
           p0->error = error_node->errors[error0];
@@ -236,7 +241,7 @@ nsh_output_inline (vlib_main_t * vm,
           nsh_base_header_t *hdr0;
           ethernet_header_t * eth_hdr0;
           vlib_buffer_t * p0;
-          u32 pi0, rw_len0, adj_index0, next0, error0;
+          u32 pi0, rw_len0, adj_index0, next0, error0, len0;
 
           pi0 = to_next[0] = from[0];
 
@@ -256,17 +261,17 @@ nsh_output_inline (vlib_main_t * vm,
 
           /* Update packet buffer attributes/set output interface. */
           rw_len0 = adj0[0].rewrite_header.data_bytes;
+          len0 = vlib_buffer_length_in_chain (vm, p0);
 
           vlib_increment_combined_counter
               (&adjacency_counters,
                thread_index,
                adj_index0,
                1,
-               vlib_buffer_length_in_chain (vm, p0) + rw_len0);
+               len0 + rw_len0);
 
           /* Check MTU of outgoing interface. */
-          if (PREDICT_TRUE(vlib_buffer_length_in_chain (vm, p0) <=
-                           adj0[0].rewrite_header.max_l3_packet_bytes))
+          if (PREDICT_TRUE(len0 <= adj0[0].rewrite_header.max_l3_packet_bytes))
             {
               p0->current_data -= rw_len0;
               p0->current_length += rw_len0;
@@ -283,10 +288,10 @@ nsh_output_inline (vlib_main_t * vm,
             }
           else
             {
-              error0 = IP4_ERROR_MTU_EXCEEDED;
-              next0 = NSH_OUTPUT_NEXT_DROP;
+              error0 = IP4_ERROR_NONE;
+              next0 = NSH_OUTPUT_NEXT_TOO_BIG;
             }
-          if (is_midchain)
+          if (is_midchain && PREDICT_TRUE(next0 != NSH_OUTPUT_NEXT_TOO_BIG))
           {
               adj0->sub_type.midchain.fixup_func
                 (vm, adj0, p0, adj0->sub_type.midchain.fixup_data);
@@ -318,11 +323,6 @@ nsh_output_inline (vlib_main_t * vm,
   return from_frame->n_vectors;
 }
 
-typedef enum nsh_midchain_next_t_
-{
-    NSH_MIDCHAIN_NEXT_DROP,
-} nsh_midchain_next_t;
-
 static inline uword
 nsh_eth_output (vlib_main_t * vm,
                 vlib_node_runtime_t * node,
@@ -361,14 +361,226 @@ VLIB_REGISTER_NODE (nsh_midchain_node) = {
   .name = "nsh-midchain",
   .vector_size = sizeof (u32),
   .format_trace = format_nsh_output_trace,
-  .n_next_nodes = 1,
+  /* Shares the next nodes of nsh_output_inline() with nsh-eth-output */
+  .n_next_nodes = NSH_OUTPUT_N_NEXT,
   .next_nodes = {
-      [NSH_MIDCHAIN_NEXT_DROP] = "error-drop",
+#define _(s,n) [NSH_OUTPUT_NEXT_##s] = n,
+    foreach_nsh_output_next
+#undef _
   },
 };
 
 VLIB_NODE_FUNCTION_MULTIARCH (nsh_midchain_node, nsh_midchain)
 
+/**
+ * @brief Next index values from the NSH too-big node
+ */
+#define foreach_nsh_too_big_next        \
+_(DROP, "error-drop")                   \
+_(ICMP4_ERROR, "ip4-icmp-error")        \
+_(ICMP6_ERROR, "ip6-icmp-error")
+
+typedef enum {
+#define _(s,n) NSH_TOO_BIG_NEXT_##s,
+  foreach_nsh_too_big_next
+#undef _
+  NSH_TOO_BIG_N_NEXT,
+} nsh_too_big_next_t;
+
+#define foreach_nsh_too_big_error                               \
+_(ICMP4_SENT, "ICMP4 fragmentation needed sent")                \
+_(ICMP6_SENT, "ICMP6 packet too big sent")                      \
+_(FRAGMENTABLE, "inner IPv4 without DF exceeds MTU, dropped")   \
+_(NOT_IP, "inner payload not IP, dropped")
+
+typedef enum {
+#define _(sym,str) NSH_TOO_BIG_ERROR_##sym,
+  foreach_nsh_too_big_error
+#undef _
+  NSH_TOO_BIG_N_ERROR,
+} nsh_too_big_error_t;
+
+static char * nsh_too_big_error_strings[] = {
+#define _(sym,string) string,
+  foreach_nsh_too_big_error
+#undef _
+};
+
+typedef struct nsh_too_big_trace_t_
+{
+    u32 adj_index;
+    u32 mtu;
+    u32 next;
+} nsh_too_big_trace_t;
+
+static u8 *
+format_nsh_too_big_trace (u8 * s, va_list * args)
+{
+    CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+    CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+    nsh_too_big_trace_t * t = va_arg (*args, nsh_too_big_trace_t *);
+
+    s = format (s, "adj-idx %d inner mtu %d next %d",
+                t->adj_index, t->mtu, t->next);
+    return (s);
+}
+
+/**
+ * @brief Graph node for NSH packets exceeding the adjacency MTU.
+ * The NSH header is stripped and, for an inner IPv4 packet with DF set
+ * or an inner IPv6 packet, an ICMP error carrying the MTU left for the
+ * inner packet is sent back toward its source. Everything else is dropped.
+ * Packets land here only on the exception path, so the per-adjacency and
+ * per-reason counters are accumulated and flushed once per frame.
+ */
+static uword
+nsh_too_big (vlib_main_t * vm,
+             vlib_node_runtime_t * node,
+             vlib_frame_t * from_frame)
+{
+  u32 n_left_from, next_index, * from, * to_next, thread_index;
+  u32 counts[NSH_TOO_BIG_N_ERROR] = { 0 };
+  nsh_main_t *nm = &nsh_main;
+  u32 n_counters;
+  int i;
+
+  thread_index = vlib_get_thread_index();
+  from = vlib_frame_vector_args (from_frame);
+  n_left_from = from_frame->n_vectors;
+  next_index = node->cached_next_index;
+  n_counters = vlib_combined_counter_n_counters (&nm->too_big_counters);
+
+  while (n_left_from > 0)
+    {
+      u32 n_left_to_next;
+
+      vlib_get_next_frame (vm, node, next_index,
+                           to_next, n_left_to_next);
+
+      while (n_left_from > 0 && n_left_to_next > 0)
+        {
+          u32 pi0, next0, adj_index0, mtu0, hdr_len0, error0;
+          nsh_base_header_t * hdr0;
+          ip_adjacency_t * adj0;
+          vlib_buffer_t * p0;
+          u8 * inner0;
+          u8 proto0;
+
+          pi0 = to_next[0] = from[0];
+          p0 = vlib_get_buffer (vm, pi0);
+          from += 1;
+          n_left_from -= 1;
+          to_next += 1;
+          n_left_to_next -= 1;
+
+          adj_index0 = vnet_buffer (p0)->ip.adj_index[VLIB_TX];
+          adj0 = adj_get(adj_index0);
+          hdr0 = vlib_buffer_get_current (p0);
+          hdr_len0 = (hdr0->length & NSH_LEN_MASK) * 4;
+          proto0 = hdr0->next_protocol;
+          inner0 = (u8 *) hdr0 + hdr_len0;
+
+          /* Look through an inner Ethernet header for the IP packet */
+          if (proto0 == NSH_NEXT_PROTOCOL_ETHERNET)
+            {
+              ethernet_header_t * eth0 = (ethernet_header_t *) inner0;
+
+              hdr_len0 += sizeof (ethernet_header_t);
+              inner0 += sizeof (ethernet_header_t);
+              if (eth0->type == clib_host_to_net_u16 (ETHERNET_TYPE_IP4))
+                proto0 = NSH_NEXT_PROTOCOL_IP4;
+              else if (eth0->type == clib_host_to_net_u16 (ETHERNET_TYPE_IP6))
+                proto0 = NSH_NEXT_PROTOCOL_IP6;
+            }
+
+          mtu0 = adj0->rewrite_header.max_l3_packet_bytes;
+          mtu0 = (mtu0 > hdr_len0) ? mtu0 - hdr_len0 : 0;
+
+          if (proto0 == NSH_NEXT_PROTOCOL_IP4 &&
+              (((ip4_header_t *) inner0)->flags_and_fragment_offset &
+               clib_host_to_net_u16 (IP4_HEADER_FLAG_DONT_FRAGMENT)))
+            {
+              vlib_buffer_advance (p0, hdr_len0);
+              icmp4_error_set_vnet_buffer
+                (p0, ICMP4_destination_unreachable,
+                 ICMP4_destination_unreachable_fragmentation_needed_and_dont_fragment_set,
+                 mtu0);
+              next0 = NSH_TOO_BIG_NEXT_ICMP4_ERROR;
+              error0 = NSH_TOO_BIG_ERROR_ICMP4_SENT;
+            }
+          else if (proto0 == NSH_NEXT_PROTOCOL_IP6)
+            {
+              vlib_buffer_advance (p0, hdr_len0);
+              icmp6_error_set_vnet_buffer (p0, ICMP6_packet_too_big, 0, mtu0);
+              next0 = NSH_TOO_BIG_NEXT_ICMP6_ERROR;
+              error0 = NSH_TOO_BIG_ERROR_ICMP6_SENT;
+            }
+          else
+            {
+              /*
+               * Fragmenting the inner IPv4 packet would need the NSH header
+               * pushed back onto every fragment, which ip4-frag cannot do.
+               */
+              next0 = NSH_TOO_BIG_NEXT_DROP;
+              error0 = (proto0 == NSH_NEXT_PROTOCOL_IP4) ?
+                NSH_TOO_BIG_ERROR_FRAGMENTABLE : NSH_TOO_BIG_ERROR_NOT_IP;
+            }
+
+          p0->error = node->errors[error0];
+          counts[error0] += 1;
+
+          if (PREDICT_TRUE(adj_index0 < n_counters))
+            vlib_increment_combined_counter
+                (&nm->too_big_counters,
+                 thread_index,
+                 adj_index0,
+                 1,
+                 vlib_buffer_length_in_chain (vm, p0));
+
+          if (PREDICT_FALSE(p0->flags & VLIB_BUFFER_IS_TRACED))
+          {
+              nsh_too_big_trace_t *tr =
+                 vlib_add_trace (vm, node, p0, sizeof (*tr));
+              tr->adj_index = adj_index0;
+              tr->mtu = mtu0;
+              tr->next = next0;
+          }
+
+          vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+                                           to_next, n_left_to_next,
+                                           pi0, next0);
+        }
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+
+  for (i = 0; i < NSH_TOO_BIG_N_ERROR; i++)
+    if (counts[i])
+      vlib_node_increment_counter (vm, node->node_index, i, counts[i]);
+
+  return from_frame->n_vectors;
+}
+
+VLIB_REGISTER_NODE (nsh_too_big_node) = {
+  .function = nsh_too_big,
+  .name = "nsh-too-big",
+  .format_trace = format_nsh_too_big_trace,
+  /* Takes a vector of packets. */
+  .vector_size = sizeof (u32),
+
+  .n_errors = NSH_TOO_BIG_N_ERROR,
+  .error_strings = nsh_too_big_error_strings,
+
+  .n_next_nodes = NSH_TOO_BIG_N_NEXT,
+  .next_nodes = {
+#define _(s,n) [NSH_TOO_BIG_NEXT_##s] = n,
+    foreach_nsh_too_big_next
+#undef _
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (nsh_too_big_node, nsh_too_big)
+
 /* Built-in nsh tx feature path definition */
 VNET_FEATURE_INIT (nsh_interface_output, static) = {
   .arc_name = "nsh-eth-output",
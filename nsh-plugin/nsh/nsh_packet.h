@@ -104,6 +104,11 @@ typedef CLIB_PACKED(struct {
 #define NSH_O_BIT (1<<5)
 #define NSH_C_BIT (1<<4)
 
+/* Next Protocol values */
+#define NSH_NEXT_PROTOCOL_IP4 0x1
+#define NSH_NEXT_PROTOCOL_IP6 0x2
+#define NSH_NEXT_PROTOCOL_ETHERNET 0x3
+
 #define NSH_TTL_H4_MASK 0xF
 #define NSH_TTL_L2_MASK 0xC0
 #define NSH_LEN_MASK 0x3F
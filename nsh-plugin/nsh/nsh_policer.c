@@ -0,0 +1,319 @@
+/*
+ * nsh_policer.c - per service path token bucket policer
+ *
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vnet/vnet.h>
+#include <vlib/threads.h>
+#include <nsh/nsh.h>
+#include <nsh/nsh_numa.h>
+
+static char * nsh_policer_action_strings[] = {
+#define _(sym,str) str,
+  foreach_nsh_policer_action
+#undef _
+};
+
+static char * nsh_policer_result_strings[] = {
+#define _(sym,str) str,
+  foreach_nsh_policer_result
+#undef _
+};
+
+/*
+ * Number of threads sharing one service path. With handoff every packet
+ * of a path lands on the same worker, otherwise the configured rate is
+ * split evenly over the workers.
+ */
+static u32
+nsh_policer_n_threads (void)
+{
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+
+  if (nsh_main.handoff_enabled || tm->n_vlib_mains == 1)
+    return 1;
+
+  return tm->n_vlib_mains - 1;
+}
+
+static u64
+nsh_policer_clocks_per_unit (u32 rate, u32 n_threads)
+{
+  f64 clocks_per_second = nsh_main.vlib_main->clib_time.clocks_per_second;
+
+  return (u64) ((clocks_per_second * n_threads / rate)
+                * (1 << NSH_POLICER_CLOCK_SHIFT));
+}
+
+static void
+nsh_policer_compute (nsh_policer_t * p)
+{
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  u32 n_threads = nsh_policer_n_threads ();
+  u64 now = clib_cpu_time_now ();
+  nsh_policer_bucket_t * b;
+
+  p->committed_clocks_per_unit = nsh_policer_clocks_per_unit (p->cir,
+                                                              n_threads);
+  p->committed_limit =
+    (p->cb * p->committed_clocks_per_unit) >> NSH_POLICER_CLOCK_SHIFT;
+
+  if (p->type == NSH_POLICER_TYPE_2R3C)
+    {
+      p->peak_clocks_per_unit = nsh_policer_clocks_per_unit (p->pir,
+                                                             n_threads);
+      p->peak_limit =
+        (p->pb * p->peak_clocks_per_unit) >> NSH_POLICER_CLOCK_SHIFT;
+    }
+
+  /* Start every thread with full buckets */
+  vec_validate_aligned (p->buckets, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_foreach (b, p->buckets)
+    {
+      b->last_update = now;
+      b->committed_tokens = p->committed_limit;
+      b->peak_tokens = p->peak_limit;
+    }
+}
+
+/**
+ * Action function to attach or remove the policer of a mapping.
+ * Returns -1 for an invalid type, rate type or rate configuration,
+ * -2 when the mapping (or, on delete, its policer) does not exist.
+ */
+int
+nsh_map_policer_add_del (nsh_map_policer_args_t * a)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_policer_t * p;
+  nsh_map_t * map;
+  u32 key, map_index, policer_index;
+  uword * entry;
+  int i;
+
+  key = clib_host_to_net_u32 (a->nsp_nsi);
+  entry = hash_get_mem (nm->nsh_mapping_by_key, &key);
+  if (entry == 0)
+    return -2;
+
+  map_index = entry[0];
+  map = pool_elt_at_index (nm->nsh_mappings, map_index);
+
+  if (!a->is_add)
+    {
+      if (map->policer_index == ~0)
+        return -2;
+
+      policer_index = map->policer_index;
+      map->policer_index = ~0;
+      nsh_policer_free (policer_index);
+      nsh_event_post (NSH_EVENT_MAP_MODIFY, a->nsp_nsi, map_index);
+      return 0;
+    }
+
+  if (a->type > NSH_POLICER_TYPE_2R3C
+      || a->rate_type > NSH_POLICER_RATE_PACKETS)
+    return -1;
+  if (a->cir == 0 || a->cb == 0)
+    return -1;
+  if (a->type == NSH_POLICER_TYPE_2R3C
+      && (a->pir < a->cir || a->pb == 0))
+    return -1;
+  if (a->exceed_action > NSH_POLICER_ACTION_MARK_C_BIT)
+    return -1;
+
+  /* Reconfiguring replaces the policer in place */
+  if (map->policer_index == ~0)
+    {
+      pool_get (nm->policers, p);
+      memset (p, 0, sizeof (*p));
+    }
+  else
+    p = pool_elt_at_index (nm->policers, map->policer_index);
+
+  p->type = a->type;
+  p->rate_type = a->rate_type;
+  p->exceed_action = a->exceed_action;
+  p->cir = a->cir;
+  p->cb = a->cb;
+  p->pir = a->pir;
+  p->pb = a->pb;
+  nsh_policer_compute (p);
+
+  for (i = 0; i < NSH_POLICER_N_RESULT; i++)
+    {
+      vlib_validate_combined_counter (&nm->policer_counters[i], map_index);
+      vlib_zero_combined_counter (&nm->policer_counters[i], map_index);
+    }
+
+  map->policer_index = p - nm->policers;
+  nsh_event_post (NSH_EVENT_MAP_MODIFY, a->nsp_nsi, map_index);
+
+  return 0;
+}
+
+void
+nsh_policer_free (u32 policer_index)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_policer_t * p = pool_elt_at_index (nm->policers, policer_index);
+
+  /* No replica may still point at it, its maps must have let it go */
+  nsh_numa_replicas_sync ();
+
+  vec_free (p->buckets);
+  pool_put (nm->policers, p);
+}
+
+/* Recompute the per-thread share of every policer, e.g. after handoff */
+void
+nsh_policer_update_rates (void)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_policer_t * p;
+
+  pool_foreach (p, nm->policers,
+  ({
+    nsh_policer_compute (p);
+  }));
+}
+
+u8 *
+format_nsh_policer (u8 * s, va_list * args)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_map_t * map = va_arg (*args, nsh_map_t *);
+  nsh_policer_t * p = pool_elt_at_index (nm->policers, map->policer_index);
+  char * unit = (p->rate_type == NSH_POLICER_RATE_PACKETS) ?
+    "packets" : "bytes";
+  vlib_counter_t c;
+  int i;
+
+  s = format (s, "policer cir %u cb %u", p->cir, p->cb);
+  if (p->type == NSH_POLICER_TYPE_2R3C)
+    s = format (s, " pir %u pb %u", p->pir, p->pb);
+  s = format (s, " (%s) exceed-action %s", unit,
+              nsh_policer_action_strings[p->exceed_action]);
+
+  for (i = 0; i < NSH_POLICER_N_RESULT; i++)
+    {
+      vlib_get_combined_counter (&nm->policer_counters[i],
+                                 map - nm->nsh_mappings, &c);
+      s = format (s, "\n    %s: %lld packets %lld bytes",
+                  nsh_policer_result_strings[i], c.packets, c.bytes);
+    }
+
+  return s;
+}
+
+static uword
+unformat_nsh_policer_action (unformat_input_t * input, va_list * args)
+{
+  u32 * result = va_arg (*args, u32 *);
+
+#define _(sym,str)                              \
+  if (unformat (input, str))                    \
+    {                                           \
+      *result = NSH_POLICER_ACTION_##sym;       \
+      return 1;                                 \
+    }
+  foreach_nsh_policer_action
+#undef _
+
+  return 0;
+}
+
+static clib_error_t *
+nsh_map_policer_command_fn (vlib_main_t * vm,
+                            unformat_input_t * input,
+                            vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, * line_input = &_line_input;
+  nsh_map_policer_args_t _a, * a = &_a;
+  u32 nsp, nsi;
+  int nsp_set = 0, nsi_set = 0;
+  u32 exceed_action = NSH_POLICER_ACTION_DROP;
+  int rv;
+
+  memset (a, 0, sizeof (*a));
+  a->is_add = 1;
+  a->type = NSH_POLICER_TYPE_1R2C;
+  a->rate_type = NSH_POLICER_RATE_BYTES;
+
+  /* Get a line of input. */
+  if (! unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+    if (unformat (line_input, "del"))
+      a->is_add = 0;
+    else if (unformat (line_input, "nsp %d", &nsp))
+      nsp_set = 1;
+    else if (unformat (line_input, "nsi %d", &nsi))
+      nsi_set = 1;
+    else if (unformat (line_input, "cir %u", &a->cir))
+      ;
+    else if (unformat (line_input, "cb %u", &a->cb))
+      ;
+    else if (unformat (line_input, "pir %u", &a->pir))
+      a->type = NSH_POLICER_TYPE_2R3C;
+    else if (unformat (line_input, "pb %u", &a->pb))
+      ;
+    else if (unformat (line_input, "packets"))
+      a->rate_type = NSH_POLICER_RATE_PACKETS;
+    else if (unformat (line_input, "exceed-action %U",
+                       unformat_nsh_policer_action, &exceed_action))
+      ;
+    else
+      return clib_error_return (0, "parse error: '%U'",
+                                format_unformat_error, line_input);
+  }
+
+  unformat_free (line_input);
+
+  if (nsp_set == 0 || nsi_set == 0)
+    return clib_error_return (0, "nsp nsi pair required. Key: for NSH map");
+
+  a->nsp_nsi = (nsp << NSH_NSP_SHIFT) | nsi;
+  a->exceed_action = exceed_action;
+
+  rv = nsh_map_policer_add_del (a);
+
+  switch (rv)
+    {
+    case 0:
+      break;
+    case -1: //TODO API_ERROR_INVALID_VALUE:
+      return clib_error_return (0, "invalid rate: cir and cb are required, "
+                                "pir must not be below cir.");
+    case -2: // TODO API_ERROR_NO_SUCH_ENTRY:
+      return clib_error_return (0, "mapping or policer does not exist.");
+    default:
+      return clib_error_return
+        (0, "nsh_map_policer_add_del returned %d", rv);
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (nsh_map_policer_command, static) = {
+  .path = "set nsh map policer",
+  .short_help =
+  "set nsh map policer nsp <nn> nsi <nn> [del] cir <rate> cb <burst> "
+  "[pir <rate> pb <burst>] [packets] "
+  "[exceed-action drop|mark-o-bit|mark-c-bit]",
+  .function = nsh_map_policer_command_fn,
+};
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef included_nsh_policer_h
+#define included_nsh_policer_h
+
+#include <vnet/vnet.h>
+
+typedef enum {
+  NSH_POLICER_TYPE_1R2C, /* single rate, two colour */
+  NSH_POLICER_TYPE_2R3C, /* two rate, three colour (RFC 2698) */
+} nsh_policer_type_t;
+
+typedef enum {
+  NSH_POLICER_RATE_BYTES,
+  NSH_POLICER_RATE_PACKETS,
+} nsh_policer_rate_type_t;
+
+#define foreach_nsh_policer_action      \
+_(DROP, "drop")                         \
+_(MARK_O_BIT, "mark-o-bit")             \
+_(MARK_C_BIT, "mark-c-bit")
+
+typedef enum {
+#define _(sym,str) NSH_POLICER_ACTION_##sym,
+  foreach_nsh_policer_action
+#undef _
+} nsh_policer_action_t;
+
+#define foreach_nsh_policer_result      \
+_(CONFORM, "conform")                   \
+_(EXCEED, "exceed")                     \
+_(VIOLATE, "violate")
+
+typedef enum {
+#define _(sym,str) NSH_POLICER_##sym,
+  foreach_nsh_policer_result
+#undef _
+  NSH_POLICER_N_RESULT,
+} nsh_policer_result_t;
+
+/* Fixed point shift of the clocks-per-unit costs */
+#define NSH_POLICER_CLOCK_SHIFT 8
+
+/** Note:
+ * Tokens are kept in CPU clocks: a bucket earns one token per clock and a
+ * packet costs (units * clocks_per_unit). Refill is then a subtraction of
+ * two clock readings, with no division in the data plane.
+ */
+typedef struct {
+  /* One cache line per thread, so workers never share a bucket */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  u64 last_update;
+  u64 committed_tokens;
+  u64 peak_tokens;
+} nsh_policer_bucket_t;
+
+typedef struct {
+  /* configuration, units per second and units */
+  u8 type;
+  u8 rate_type;
+  u8 exceed_action;
+  u32 cir;
+  u32 cb;
+  u32 pir;
+  u32 pb;
+
+  /* per-thread costs and bucket depths, in CPU clocks */
+  u64 committed_clocks_per_unit;
+  u64 committed_limit;
+  u64 peak_clocks_per_unit;
+  u64 peak_limit;
+
+  /* per-thread bucket state, indexed by thread index */
+  nsh_policer_bucket_t * buckets;
+} nsh_policer_t;
+
+typedef struct {
+  u8 is_add;
+  u32 nsp_nsi;
+  u8 type;
+  u8 rate_type;
+  u8 exceed_action;
+  u32 cir;
+  u32 cb;
+  u32 pir;
+  u32 pb;
+} nsh_map_policer_args_t;
+
+int nsh_map_policer_add_del (nsh_map_policer_args_t * a);
+void nsh_policer_update_rates (void);
+void nsh_policer_free (u32 policer_index);
+u8 * format_nsh_policer (u8 * s, va_list * args);
+
+always_inline nsh_policer_result_t
+nsh_policer_police (nsh_policer_t * p, u32 thread_index, u64 now, u32 len)
+{
+  nsh_policer_bucket_t * b = vec_elt_at_index (p->buckets, thread_index);
+  u64 units = (p->rate_type == NSH_POLICER_RATE_PACKETS) ? 1 : len;
+  u64 elapsed = now - b->last_update;
+  u64 committed_cost, peak_cost;
+
+  b->last_update = now;
+
+  committed_cost =
+    (units * p->committed_clocks_per_unit) >> NSH_POLICER_CLOCK_SHIFT;
+  b->committed_tokens = clib_min (b->committed_tokens + elapsed,
+                                  p->committed_limit);
+
+  if (p->type == NSH_POLICER_TYPE_1R2C)
+    {
+      if (PREDICT_FALSE (b->committed_tokens < committed_cost))
+        return NSH_POLICER_EXCEED;
+      b->committed_tokens -= committed_cost;
+      return NSH_POLICER_CONFORM;
+    }
+
+  peak_cost = (units * p->peak_clocks_per_unit) >> NSH_POLICER_CLOCK_SHIFT;
+  b->peak_tokens = clib_min (b->peak_tokens + elapsed, p->peak_limit);
+
+  if (PREDICT_FALSE (b->peak_tokens < peak_cost))
+    return NSH_POLICER_VIOLATE;
+  b->peak_tokens -= peak_cost;
+
+  if (PREDICT_FALSE (b->committed_tokens < committed_cost))
+    return NSH_POLICER_EXCEED;
+  b->committed_tokens -= committed_cost;
+
+  return NSH_POLICER_CONFORM;
+}
+
+#endif /* included_nsh_policer_h */
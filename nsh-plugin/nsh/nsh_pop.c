@@ -18,6 +18,7 @@
 #include <vnet/vnet.h>
 #include <vnet/plugin/plugin.h>
 #include <nsh/nsh.h>
+#include <nsh/nsh_numa.h>
 #include <vnet/gre/gre.h>
 #include <vnet/vxlan/vxlan.h>
 #include <vnet/vxlan-gpe/vxlan_gpe.h>
@@ -51,7 +52,8 @@ nsh_pop_inline (vlib_main_t * vm,
                vlib_frame_t * from_frame)
 {
   u32 n_left_from, next_index, *from, *to_next;
-  nsh_main_t * nm = &nsh_main;
+  nsh_fwd_tables_t _t, * t = nsh_fwd_tables_get (vlib_get_thread_index (),
+                                                 &_t);
 
   from = vlib_frame_vector_args(from_frame);
   n_left_from = from_frame->n_vectors;
@@ -113,7 +115,7 @@ nsh_pop_inline (vlib_main_t * vm,
 	  header_len1 = hdr1->length * 4;
 
 	  /* Process packet 0 */
-	  entry0 = hash_get_mem(nm->nsh_mapping_by_key, &nsp_nsi0);
+	  entry0 = hash_get_mem(t->map_by_key, &nsp_nsi0);
 	  if (PREDICT_FALSE(entry0 == 0))
 	    {
 	      error0 = NSH_NODE_ERROR_NO_MAPPING;
@@ -121,7 +123,7 @@ nsh_pop_inline (vlib_main_t * vm,
 	    }
 
 	  /* Entry should point to a mapping ...*/
-	  map0 = pool_elt_at_index(nm->nsh_mappings, entry0[0]);
+	  map0 = vec_elt_at_index(t->maps, entry0[0]);
 	  if (PREDICT_FALSE(map0 == 0))
 	    {
 	      error0 = NSH_NODE_ERROR_NO_MAPPING;
@@ -150,7 +152,7 @@ nsh_pop_inline (vlib_main_t * vm,
 	      goto trace0;
 	    }
 
-	  entry0 = hash_get_mem(nm->nsh_entry_by_key, &map0->mapped_nsp_nsi);
+	  entry0 = hash_get_mem(t->entry_by_key, &map0->mapped_nsp_nsi);
 	  if (PREDICT_FALSE(entry0 == 0))
 	    {
 	      error0 = NSH_NODE_ERROR_NO_ENTRY;
@@ -166,7 +168,7 @@ nsh_pop_inline (vlib_main_t * vm,
             }
 
 	  /* Process packet 1 */
-	  entry1 = hash_get_mem(nm->nsh_mapping_by_key, &nsp_nsi1);
+	  entry1 = hash_get_mem(t->map_by_key, &nsp_nsi1);
 	  if (PREDICT_FALSE(entry1 == 0))
 	    {
 	      error1 = NSH_NODE_ERROR_NO_MAPPING;
@@ -174,7 +176,7 @@ nsh_pop_inline (vlib_main_t * vm,
 	    }
 
 	  /* Entry should point to a mapping ...*/
-	  map1 = pool_elt_at_index(nm->nsh_mappings, entry1[0]);
+	  map1 = vec_elt_at_index(t->maps, entry1[0]);
 	  if (PREDICT_FALSE(map1 == 0))
 	    {
 	      error1 = NSH_NODE_ERROR_NO_MAPPING;
@@ -203,7 +205,7 @@ nsh_pop_inline (vlib_main_t * vm,
 	      goto trace1;
 	    }
 
-	  entry1 = hash_get_mem(nm->nsh_entry_by_key, &map1->mapped_nsp_nsi);
+	  entry1 = hash_get_mem(t->entry_by_key, &map1->mapped_nsp_nsi);
 	  if (PREDICT_FALSE(entry1 == 0))
 	    {
 	      error1 = NSH_NODE_ERROR_NO_ENTRY;
@@ -250,7 +252,7 @@ nsh_pop_inline (vlib_main_t * vm,
           nsp_nsi0 = hdr0->nsp_nsi;
           header_len0 = hdr0->length * 4;
 
-	  entry0 = hash_get_mem(nm->nsh_mapping_by_key, &nsp_nsi0);
+	  entry0 = hash_get_mem(t->map_by_key, &nsp_nsi0);
 
 	  if (PREDICT_FALSE(entry0 == 0))
 	    {
@@ -259,7 +261,7 @@ nsh_pop_inline (vlib_main_t * vm,
 	    }
 
 	  /* Entry should point to a mapping ...*/
-	  map0 = pool_elt_at_index(nm->nsh_mappings, entry0[0]);
+	  map0 = vec_elt_at_index(t->maps, entry0[0]);
 
 	  if (PREDICT_FALSE(map0 == 0))
 	    {
@@ -289,7 +291,7 @@ nsh_pop_inline (vlib_main_t * vm,
 	      goto trace00;
 	    }
 
-	  entry0 = hash_get_mem(nm->nsh_entry_by_key, &map0->mapped_nsp_nsi);
+	  entry0 = hash_get_mem(t->entry_by_key, &map0->mapped_nsp_nsi);
 	  if (PREDICT_FALSE(entry0 == 0))
 	    {
 	      error0 = NSH_NODE_ERROR_NO_ENTRY;
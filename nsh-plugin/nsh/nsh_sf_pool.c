@@ -0,0 +1,870 @@
+/*
+ * nsh_sf_pool.c - consistent hash selection of SF instances
+ *
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vnet/vnet.h>
+#include <vlib/threads.h>
+#include <vnet/ip/ip.h>
+#include <vnet/udp/udp_packet.h>
+#include <nsh/nsh.h>
+#include <nsh/nsh_numa.h>
+
+/* the 48_8 template is instantiated by nsh_classify.c */
+#include <vppinfra/bihash_48_8.h>
+#include <vppinfra/bihash_template.h>
+
+#include <vppinfra/tw_timer_2t_1w_2048sl.h>
+
+#define NSH_SF_POOL_OFFSET_SEED 0x9e3779b97f4a7c15ULL
+#define NSH_SF_POOL_SKIP_SEED 0xc2b2ae3d27d4eb4fULL
+
+#define NSH_SF_FLOW_HASH_BUCKETS (16 << 10)
+#define NSH_SF_FLOW_HASH_MEMORY (32 << 20)
+#define NSH_SF_FLOW_DEFAULT_MAX (64 << 10)
+#define NSH_SF_FLOW_DEFAULT_TIMEOUT 60
+
+static int
+nsh_sf_member_cmp (void * a1, void * a2)
+{
+  nsh_sf_member_t * m1 = a1, * m2 = a2;
+
+  if (m1->next_node != m2->next_node)
+    return m1->next_node < m2->next_node ? -1 : 1;
+  if (m1->sw_if_index != m2->sw_if_index)
+    return m1->sw_if_index < m2->sw_if_index ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Fill a Maglev lookup table: each member walks its own permutation of
+ * the slots, offset + j * skip, and the members take turns claiming the
+ * next free slot of theirs until the table is full. Returns 0 for a pool
+ * without members.
+ */
+static nsh_sf_member_t *
+nsh_sf_pool_build_lookup (nsh_sf_pool_t * pool)
+{
+  u32 n_members = vec_len (pool->members);
+  nsh_sf_member_t * lookup = 0, * m;
+  u32 * offset = 0, * skip = 0, * next = 0, * owner = 0;
+  u32 i, slot, n_filled = 0;
+  u64 key;
+
+  if (n_members == 0)
+    return 0;
+
+  vec_validate (offset, n_members - 1);
+  vec_validate (skip, n_members - 1);
+  vec_validate (next, n_members - 1);
+  vec_validate_init_empty (owner, NSH_SF_POOL_TABLE_SIZE - 1, ~0);
+
+  vec_foreach_index (i, pool->members)
+    {
+      m = &pool->members[i];
+      key = ((u64) m->next_node << 32) | m->sw_if_index;
+      offset[i] = clib_xxhash (key ^ NSH_SF_POOL_OFFSET_SEED)
+        % NSH_SF_POOL_TABLE_SIZE;
+      skip[i] = clib_xxhash (key ^ NSH_SF_POOL_SKIP_SEED)
+        % (NSH_SF_POOL_TABLE_SIZE - 1) + 1;
+    }
+
+  while (1)
+    {
+      for (i = 0; i < n_members; i++)
+        {
+          do
+            {
+              slot = (offset[i] + (u64) next[i] * skip[i])
+                % NSH_SF_POOL_TABLE_SIZE;
+              next[i]++;
+            }
+          while (owner[slot] != ~0);
+
+          owner[slot] = i;
+          if (++n_filled == NSH_SF_POOL_TABLE_SIZE)
+            goto done;
+        }
+    }
+
+done:
+  vec_validate (lookup, NSH_SF_POOL_TABLE_SIZE - 1);
+  for (slot = 0; slot < NSH_SF_POOL_TABLE_SIZE; slot++)
+    lookup[slot] = pool->members[owner[slot]];
+
+  vec_free (offset);
+  vec_free (skip);
+  vec_free (next);
+  vec_free (owner);
+
+  return lookup;
+}
+
+/*
+ * Swap in a freshly built table. Workers read pool->lookup once per
+ * packet, so they see either table whole; the old one is only freed
+ * once they have all been through the barrier.
+ */
+static void
+nsh_sf_pool_rebuild (nsh_sf_pool_t * pool)
+{
+  nsh_sf_member_t * old = pool->lookup, * new;
+
+  new = nsh_sf_pool_build_lookup (pool);
+
+  CLIB_MEMORY_BARRIER ();
+  pool->lookup = new;
+
+  if (old)
+    {
+      vlib_worker_thread_barrier_sync (nsh_main.vlib_main);
+      vlib_worker_thread_barrier_release (nsh_main.vlib_main);
+      vec_free (old);
+    }
+}
+
+static void
+nsh_sf_pool_free_if_unused (nsh_sf_pool_t * pool)
+{
+  nsh_main_t * nm = &nsh_main;
+
+  if (pool->n_maps || vec_len (pool->members))
+    return;
+
+  /* No replica map may still point at it */
+  nsh_numa_replicas_sync ();
+
+  hash_unset (nm->sf_pool_by_id, pool->id);
+  vec_free (pool->members);
+  pool_put (nm->sf_pools, pool);
+}
+
+/** Note:
+ * Symmetric pools record, per thread, the instance each flow was first
+ * steered to, keyed by the flow with its endpoints ordered, so that the
+ * return direction, carried by whichever map uses the same pool on the
+ * reverse path, finds the instance of the forward one. A flow keeps its
+ * instance while members join; it is steered afresh once a member
+ * leaves. Flows missing from the table, e.g. seen first on another
+ * thread, fall back to the Maglev slot of their symmetric flow hash,
+ * which both directions share as long as the pool does not change.
+ */
+typedef struct {
+  clib_bihash_kv_48_8_t kv;
+  nsh_sf_member_t member;
+  u32 epoch;
+  u32 timer_handle;
+  f64 last_active;
+} nsh_sf_flow_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  clib_bihash_48_8_t table;
+  nsh_sf_flow_t * flows;
+  tw_timer_wheel_2t_1w_2048sl_t wheel;
+  f64 now;
+  u32 n_full;
+} nsh_sf_flow_table_t;
+
+typedef struct {
+  /* per thread, allocated with the first symmetric pool */
+  nsh_sf_flow_table_t * tables;
+  u32 max_flows;
+  u32 idle_timeout;
+} nsh_sf_flow_main_t;
+
+static nsh_sf_flow_main_t nsh_sf_flow_main = {
+  .max_flows = NSH_SF_FLOW_DEFAULT_MAX,
+  .idle_timeout = NSH_SF_FLOW_DEFAULT_TIMEOUT,
+};
+
+/* unique across pools, so a recycled pool index never matches */
+static u32 nsh_sf_pool_epoch;
+
+static void
+nsh_sf_flow_free (nsh_sf_flow_table_t * ft, nsh_sf_flow_t * f)
+{
+  clib_bihash_add_del_48_8 (&ft->table, &f->kv, 0 /* is_add */);
+  pool_put (ft->flows, f);
+}
+
+/* Timer wheel callback, runs on the thread owning the wheel */
+static void
+nsh_sf_flow_expired (u32 * expired_timer_handles)
+{
+  nsh_sf_flow_main_t * fm = &nsh_sf_flow_main;
+  nsh_sf_flow_table_t * ft;
+  nsh_sf_flow_t * f;
+  u32 * handle, flow_index;
+  f64 idle;
+
+  ft = vec_elt_at_index (fm->tables, vlib_get_thread_index ());
+
+  vec_foreach (handle, expired_timer_handles)
+    {
+      /* the top bit is the timer id */
+      flow_index = handle[0] & 0x7FFFFFFF;
+      f = pool_elt_at_index (ft->flows, flow_index);
+
+      idle = ft->now - f->last_active;
+      if (idle < fm->idle_timeout)
+        {
+          f->timer_handle = tw_timer_start_2t_1w_2048sl
+            (&ft->wheel, flow_index, 0, (u32) (fm->idle_timeout - idle) + 1);
+          continue;
+        }
+
+      nsh_sf_flow_free (ft, f);
+    }
+}
+
+static void
+nsh_sf_flow_tables_init (void)
+{
+  nsh_sf_flow_main_t * fm = &nsh_sf_flow_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  nsh_sf_flow_table_t * ft;
+
+  if (fm->tables)
+    return;
+
+  vec_validate_aligned (fm->tables, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_foreach (ft, fm->tables)
+    {
+      clib_bihash_init_48_8 (&ft->table, "nsh sf-pool flows",
+                             NSH_SF_FLOW_HASH_BUCKETS,
+                             NSH_SF_FLOW_HASH_MEMORY);
+      tw_timer_wheel_init_2t_1w_2048sl (&ft->wheel, nsh_sf_flow_expired,
+                                        1.0 /* timer interval */, ~0);
+      ft->wheel.last_run_time = vlib_time_now (nsh_main.vlib_main);
+    }
+}
+
+/*
+ * Build the direction free key of a flow: the lower address/port end
+ * first, then the other one, the protocol and the pool.
+ */
+always_inline void
+nsh_sf_flow_key (clib_bihash_kv_48_8_t * kv, u32 pool_index,
+                 void * ip, u8 is_ip6)
+{
+  ip46_address_t lo, hi, tmp;
+  u16 lo_port = 0, hi_port = 0, tmp_port;
+  udp_header_t * udp;
+  u8 protocol;
+
+  memset (&lo, 0, sizeof (lo));
+  memset (&hi, 0, sizeof (hi));
+
+  if (is_ip6)
+    {
+      ip6_header_t * ip6 = ip;
+      lo.ip6 = ip6->src_address;
+      hi.ip6 = ip6->dst_address;
+      protocol = ip6->protocol;
+      udp = (udp_header_t *) (ip6 + 1);
+    }
+  else
+    {
+      ip4_header_t * ip4 = ip;
+      lo.ip4 = ip4->src_address;
+      hi.ip4 = ip4->dst_address;
+      protocol = ip4->protocol;
+      udp = (udp_header_t *) ((u8 *) ip4 + ip4_header_bytes (ip4));
+    }
+
+  /* TCP and UDP ports sit at the same place */
+  if (protocol == IP_PROTOCOL_TCP || protocol == IP_PROTOCOL_UDP)
+    {
+      lo_port = udp->src_port;
+      hi_port = udp->dst_port;
+    }
+
+  if (memcmp (&lo, &hi, sizeof (lo)) > 0
+      || (memcmp (&lo, &hi, sizeof (lo)) == 0 && lo_port > hi_port))
+    {
+      tmp = lo;
+      lo = hi;
+      hi = tmp;
+      tmp_port = lo_port;
+      lo_port = hi_port;
+      hi_port = tmp_port;
+    }
+
+  kv->key[0] = lo.as_u64[0];
+  kv->key[1] = lo.as_u64[1];
+  kv->key[2] = hi.as_u64[0];
+  kv->key[3] = hi.as_u64[1];
+  kv->key[4] = ((u64) lo_port << 48) | ((u64) hi_port << 32)
+    | ((u64) protocol << 8) | is_ip6;
+  kv->key[5] = pool_index;
+  kv->value = ~0ULL;
+}
+
+/*
+ * Pick the instance of a symmetric pool for a packet: the one its flow
+ * recorded on this thread if still valid, else the Maglev slot of the
+ * symmetric flow hash, which the flow then records. Non IP packets only
+ * get the slot of hash 0, as they would from a plain pool.
+ */
+nsh_sf_member_t *
+nsh_sf_pool_symmetric_select (nsh_sf_pool_t * pool,
+                              nsh_sf_member_t * lookup,
+                              void * ip, u8 is_ip6)
+{
+  nsh_sf_flow_main_t * fm = &nsh_sf_flow_main;
+  nsh_sf_flow_table_t * ft;
+  clib_bihash_kv_48_8_t kv, result;
+  nsh_sf_member_t * m;
+  nsh_sf_flow_t * f;
+  u32 flow_index;
+
+  if (PREDICT_FALSE (ip == 0))
+    return &lookup[0];
+
+  ft = vec_elt_at_index (fm->tables, vlib_get_thread_index ());
+  ft->now = vlib_time_now (vlib_get_main ());
+  tw_timer_expire_timers_2t_1w_2048sl (&ft->wheel, ft->now);
+
+  nsh_sf_flow_key (&kv, pool - nsh_main.sf_pools, ip, is_ip6);
+  m = &lookup[clib_bihash_hash_48_8 (&kv) % NSH_SF_POOL_TABLE_SIZE];
+
+  if (clib_bihash_search_48_8 (&ft->table, &kv, &result) == 0)
+    {
+      f = pool_elt_at_index (ft->flows, result.value);
+      f->last_active = ft->now;
+      if (PREDICT_TRUE (f->epoch == pool->epoch))
+        return &f->member;
+
+      /* a member left since, the flow takes its slot's instance */
+      f->member = *m;
+      f->epoch = pool->epoch;
+      return &f->member;
+    }
+
+  if (PREDICT_FALSE (pool_elts (ft->flows) >= fm->max_flows))
+    {
+      ft->n_full++;
+      return m;
+    }
+
+  pool_get (ft->flows, f);
+  flow_index = f - ft->flows;
+  f->kv = kv;
+  f->kv.value = flow_index;
+  f->member = *m;
+  f->epoch = pool->epoch;
+  f->last_active = ft->now;
+  clib_bihash_add_del_48_8 (&ft->table, &f->kv, 1 /* is_add */);
+  f->timer_handle = tw_timer_start_2t_1w_2048sl (&ft->wheel, flow_index, 0,
+                                                 fm->idle_timeout);
+  return &f->member;
+}
+
+/*
+ * Set up the per-thread symmetric flow tables ahead of the first
+ * symmetric pool, with room for max_flows each, e.g. from startup config.
+ */
+void
+nsh_sf_pool_flow_prealloc (u32 max_flows)
+{
+  nsh_sf_flow_main_t * fm = &nsh_sf_flow_main;
+  nsh_sf_flow_table_t * ft;
+
+  fm->max_flows = max_flows;
+  nsh_sf_flow_tables_init ();
+
+  vec_foreach (ft, fm->tables)
+    pool_alloc (ft->flows, max_flows);
+}
+
+u8 *
+format_nsh_sf_flow_memory (u8 * s, va_list * args)
+{
+  nsh_sf_flow_main_t * fm = &nsh_sf_flow_main;
+  nsh_sf_flow_table_t * ft;
+  uword n_flows = 0, bytes = 0;
+
+  if (fm->tables == 0)
+    return format (s, "not allocated, max %d flows per thread",
+                   fm->max_flows);
+
+  vec_foreach (ft, fm->tables)
+    {
+      n_flows += pool_elts (ft->flows);
+      if (ft->flows)
+        bytes += clib_mem_size (pool_header (ft->flows));
+      bytes += NSH_SF_FLOW_HASH_MEMORY;
+    }
+
+  return format (s, "%d threads, %d flows used, max %d per thread, %U",
+                 vec_len (fm->tables), n_flows, fm->max_flows,
+                 format_memory_size, bytes);
+}
+
+/**
+ * Action function to make an SF pool symmetric, or not.
+ * Returns -2 when the pool does not exist.
+ */
+int
+nsh_sf_pool_set_symmetric (u32 id, u8 is_enable)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_sf_pool_t * pool;
+  uword * p;
+
+  p = hash_get (nm->sf_pool_by_id, id);
+  if (p == 0)
+    return -2;
+
+  pool = pool_elt_at_index (nm->sf_pools, p[0]);
+  if (is_enable)
+    nsh_sf_flow_tables_init ();
+
+  /* Flows recorded before the pool was last symmetric are stale */
+  pool->epoch = ++nsh_sf_pool_epoch;
+  CLIB_MEMORY_BARRIER ();
+  pool->symmetric = is_enable ? 1 : 0;
+
+  return 0;
+}
+
+/**
+ * Action function to add or del a member of an SF pool.
+ * The pool is created with its first member, and goes with its last
+ * one once no map uses it.
+ * Returns -1 when the member is already in the pool,
+ * -2 when the pool or the member to delete does not exist.
+ */
+int
+nsh_sf_pool_add_del_member (nsh_sf_pool_member_args_t * a)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_sf_pool_t * pool;
+  nsh_sf_member_t * m;
+  uword * p;
+  u32 i;
+
+  p = hash_get (nm->sf_pool_by_id, a->id);
+  if (p == 0)
+    {
+      if (!a->is_add)
+        return -2;
+
+      pool_get (nm->sf_pools, pool);
+      memset (pool, 0, sizeof (*pool));
+      pool->id = a->id;
+      pool->epoch = ++nsh_sf_pool_epoch;
+      hash_set (nm->sf_pool_by_id, a->id, pool - nm->sf_pools);
+    }
+  else
+    pool = pool_elt_at_index (nm->sf_pools, p[0]);
+
+  vec_foreach_index (i, pool->members)
+    {
+      if (!nsh_sf_member_cmp (&pool->members[i], &a->member))
+        break;
+    }
+
+  if (a->is_add)
+    {
+      if (i < vec_len (pool->members))
+        return -1;
+
+      vec_add1 (pool->members, a->member);
+      vec_sort_with_function (pool->members, nsh_sf_member_cmp);
+    }
+  else
+    {
+      if (i == vec_len (pool->members))
+        return -2;
+
+      vec_delete (pool->members, 1, i);
+    }
+
+  nsh_sf_pool_rebuild (pool);
+
+  /* Flows recorded on the member that left must not outlive it */
+  if (!a->is_add)
+    pool->epoch = ++nsh_sf_pool_epoch;
+
+  /* Each map steering through the pool now forwards differently */
+  if (pool->n_maps)
+    {
+      nsh_map_t * map;
+      u32 pool_index = pool - nm->sf_pools;
+
+      pool_foreach (map, nm->nsh_mappings,
+      ({
+        if (map->sf_pool_index == pool_index)
+          nsh_event_post (NSH_EVENT_MAP_MODIFY, map->nsp_nsi,
+                          map - nm->nsh_mappings);
+      }));
+    }
+
+  nsh_sf_pool_free_if_unused (pool);
+
+  return 0;
+}
+
+/**
+ * Action function to steer a mapping through an SF pool, or back to its
+ * own next hop.
+ * Returns -2 when the mapping, the pool or, on delete, the mapping's
+ * pool does not exist.
+ */
+int
+nsh_map_sf_pool_add_del (nsh_map_sf_pool_args_t * a)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_map_t * map;
+  u32 key, map_index, sf_pool_index;
+  uword * entry, * p;
+
+  key = clib_host_to_net_u32 (a->nsp_nsi);
+  entry = hash_get_mem (nm->nsh_mapping_by_key, &key);
+  if (entry == 0)
+    return -2;
+
+  map_index = entry[0];
+  map = pool_elt_at_index (nm->nsh_mappings, map_index);
+
+  if (!a->is_add)
+    {
+      if (map->sf_pool_index == ~0)
+        return -2;
+
+      /* let go first, so that replicas rebuilt on unlock do too */
+      sf_pool_index = map->sf_pool_index;
+      map->sf_pool_index = ~0;
+      nsh_sf_pool_unlock (sf_pool_index);
+      nsh_event_post (NSH_EVENT_MAP_MODIFY, a->nsp_nsi, map_index);
+      return 0;
+    }
+
+  p = hash_get (nm->sf_pool_by_id, a->id);
+  if (p == 0)
+    return -2;
+
+  if (map->sf_pool_index == p[0])
+    return 0;
+
+  sf_pool_index = map->sf_pool_index;
+  pool_elt_at_index (nm->sf_pools, p[0])->n_maps++;
+  map->sf_pool_index = p[0];
+
+  if (sf_pool_index != ~0)
+    nsh_sf_pool_unlock (sf_pool_index);
+  nsh_event_post (NSH_EVENT_MAP_MODIFY, a->nsp_nsi, map_index);
+
+  return 0;
+}
+
+/* Drop a map's reference, e.g. when the map goes */
+void
+nsh_sf_pool_unlock (u32 sf_pool_index)
+{
+  nsh_sf_pool_t * pool = pool_elt_at_index (nsh_main.sf_pools,
+                                            sf_pool_index);
+
+  pool->n_maps--;
+  nsh_sf_pool_free_if_unused (pool);
+}
+
+static u8 *
+format_nsh_sf_member (u8 * s, va_list * args)
+{
+  nsh_sf_member_t * m = va_arg (*args, nsh_sf_member_t *);
+  vlib_node_t * next = vlib_get_next_node (nsh_main.vlib_main,
+                                           nsh_input_node.index,
+                                           m->next_node);
+
+  return format (s, "%v intf: %d", next->name, m->sw_if_index);
+}
+
+u8 *
+format_nsh_sf_pool (u8 * s, va_list * args)
+{
+  nsh_sf_pool_t * pool = va_arg (*args, nsh_sf_pool_t *);
+  int verbose = va_arg (*args, int);
+  nsh_sf_member_t * m;
+  u32 * n_slots = 0, slot;
+
+  s = format (s, "sf-pool %d: %d members, %d maps", pool->id,
+              vec_len (pool->members), pool->n_maps);
+  if (pool->symmetric)
+    s = format (s, ", symmetric");
+
+  if (!verbose || pool->lookup == 0)
+    return s;
+
+  /* How evenly the table spreads, per member */
+  vec_validate (n_slots, vec_len (pool->members) - 1);
+  for (slot = 0; slot < NSH_SF_POOL_TABLE_SIZE; slot++)
+    vec_foreach (m, pool->members)
+      {
+        if (!nsh_sf_member_cmp (m, &pool->lookup[slot]))
+          {
+            n_slots[m - pool->members]++;
+            break;
+          }
+      }
+
+  vec_foreach (m, pool->members)
+    s = format (s, "\n  %U: %d/%d slots", format_nsh_sf_member, m,
+                n_slots[m - pool->members], NSH_SF_POOL_TABLE_SIZE);
+
+  vec_free (n_slots);
+  return s;
+}
+
+static clib_error_t *
+nsh_sf_pool_member_command_fn (vlib_main_t * vm,
+                               unformat_input_t * input,
+                               vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, * line_input = &_line_input;
+  nsh_sf_pool_member_args_t _a, * a = &_a;
+  int id_set = 0;
+  int rv;
+
+  memset (a, 0, sizeof (*a));
+  a->is_add = 1;
+  a->member.next_node = ~0;
+  a->member.adj_index = ~0;
+
+  /* Get a line of input. */
+  if (! unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+    if (unformat (line_input, "del"))
+      a->is_add = 0;
+    else if (unformat (line_input, "id %d", &a->id))
+      id_set = 1;
+    else if (unformat (line_input, "encap-gre4-intf %d",
+                       &a->member.sw_if_index))
+      a->member.next_node = NSH_NODE_NEXT_ENCAP_GRE4;
+    else if (unformat (line_input, "encap-gre6-intf %d",
+                       &a->member.sw_if_index))
+      a->member.next_node = NSH_NODE_NEXT_ENCAP_GRE6;
+    else if (unformat (line_input, "encap-vxlan-gpe-intf %d",
+                       &a->member.sw_if_index))
+      a->member.next_node = NSH_NODE_NEXT_ENCAP_VXLANGPE;
+    else if (unformat (line_input, "encap-lisp-gpe-intf %d",
+                       &a->member.sw_if_index))
+      a->member.next_node = NSH_NODE_NEXT_ENCAP_LISP_GPE;
+    else if (unformat (line_input, "encap-eth-intf %d",
+                       &a->member.sw_if_index))
+      {
+        a->member.next_node = NSH_NODE_NEXT_ENCAP_ETHERNET;
+        a->member.adj_index =
+          nsh_get_adj_by_sw_if_index (a->member.sw_if_index);
+      }
+    else
+      return clib_error_return (0, "parse error: '%U'",
+                                format_unformat_error, line_input);
+  }
+
+  unformat_free (line_input);
+
+  if (id_set == 0)
+    return clib_error_return (0, "sf-pool id required");
+
+  if (a->member.next_node == ~0)
+    return clib_error_return (0, "must specific action: [encap-gre4-intf <nn> | encap-gre6-intf <nn> | encap-vxlan-gpe-intf <nn> | encap-lisp-gpe-intf <nn> | encap-eth-intf <nn>]");
+
+  rv = nsh_sf_pool_add_del_member (a);
+
+  switch (rv)
+    {
+    case 0:
+      break;
+    case -1: //TODO API_ERROR_INVALID_VALUE:
+      return clib_error_return (0, "member already in the pool.");
+    case -2: // TODO API_ERROR_NO_SUCH_ENTRY:
+      return clib_error_return (0, "sf-pool or member does not exist.");
+    default:
+      return clib_error_return
+        (0, "nsh_sf_pool_add_del_member returned %d", rv);
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (create_nsh_sf_pool_member_command, static) = {
+  .path = "create nsh sf-pool",
+  .short_help =
+  "create nsh sf-pool id <nn> [del] "
+  "[encap-gre4-intf <nn> | encap-gre6-intf <nn> | encap-vxlan-gpe-intf <nn> "
+  "| encap-lisp-gpe-intf <nn> | encap-eth-intf <nn>]",
+  .function = nsh_sf_pool_member_command_fn,
+};
+
+static clib_error_t *
+nsh_map_sf_pool_command_fn (vlib_main_t * vm,
+                            unformat_input_t * input,
+                            vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, * line_input = &_line_input;
+  nsh_map_sf_pool_args_t _a, * a = &_a;
+  u32 nsp, nsi;
+  int nsp_set = 0, nsi_set = 0, id_set = 0;
+  int rv;
+
+  memset (a, 0, sizeof (*a));
+  a->is_add = 1;
+
+  /* Get a line of input. */
+  if (! unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+    if (unformat (line_input, "del"))
+      a->is_add = 0;
+    else if (unformat (line_input, "nsp %d", &nsp))
+      nsp_set = 1;
+    else if (unformat (line_input, "nsi %d", &nsi))
+      nsi_set = 1;
+    else if (unformat (line_input, "id %d", &a->id))
+      id_set = 1;
+    else
+      return clib_error_return (0, "parse error: '%U'",
+                                format_unformat_error, line_input);
+  }
+
+  unformat_free (line_input);
+
+  if (nsp_set == 0 || nsi_set == 0)
+    return clib_error_return (0, "nsp nsi pair required. Key: for NSH map");
+
+  if (a->is_add && id_set == 0)
+    return clib_error_return (0, "sf-pool id required");
+
+  a->nsp_nsi = (nsp << NSH_NSP_SHIFT) | nsi;
+
+  rv = nsh_map_sf_pool_add_del (a);
+
+  switch (rv)
+    {
+    case 0:
+      break;
+    case -2: // TODO API_ERROR_NO_SUCH_ENTRY:
+      return clib_error_return (0, "mapping or sf-pool does not exist.");
+    default:
+      return clib_error_return
+        (0, "nsh_map_sf_pool_add_del returned %d", rv);
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (nsh_map_sf_pool_command, static) = {
+  .path = "set nsh map sf-pool",
+  .short_help = "set nsh map sf-pool nsp <nn> nsi <nn> [del] id <nn>",
+  .function = nsh_map_sf_pool_command_fn,
+};
+
+static clib_error_t *
+nsh_sf_pool_symmetric_command_fn (vlib_main_t * vm,
+                                  unformat_input_t * input,
+                                  vlib_cli_command_t * cmd)
+{
+  u32 id;
+  int id_set = 0;
+  u8 is_enable = 1;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "id %d", &id))
+        id_set = 1;
+      else if (unformat (input, "enable"))
+        is_enable = 1;
+      else if (unformat (input, "disable"))
+        is_enable = 0;
+      else
+        return clib_error_return (0, "parse error: '%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (id_set == 0)
+    return clib_error_return (0, "sf-pool id required");
+
+  rv = nsh_sf_pool_set_symmetric (id, is_enable);
+
+  switch (rv)
+    {
+    case 0:
+      break;
+    case -2: // TODO API_ERROR_NO_SUCH_ENTRY:
+      return clib_error_return (0, "sf-pool does not exist.");
+    default:
+      return clib_error_return
+        (0, "nsh_sf_pool_set_symmetric returned %d", rv);
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (nsh_sf_pool_symmetric_command, static) = {
+  .path = "set nsh sf-pool symmetric",
+  .short_help = "set nsh sf-pool symmetric id <nn> [enable | disable]",
+  .function = nsh_sf_pool_symmetric_command_fn,
+};
+
+static clib_error_t *
+show_nsh_sf_pool_command_fn (vlib_main_t * vm,
+                             unformat_input_t * input,
+                             vlib_cli_command_t * cmd)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_sf_flow_main_t * fm = &nsh_sf_flow_main;
+  nsh_sf_flow_table_t * ft;
+  nsh_sf_pool_t * pool;
+  int verbose = 0;
+
+  if (unformat (input, "verbose"))
+    verbose = 1;
+
+  if (pool_elts (nm->sf_pools) == 0)
+    vlib_cli_output (vm, "No sf-pools configured.");
+
+  pool_foreach (pool, nm->sf_pools,
+  ({
+    vlib_cli_output (vm, "%U", format_nsh_sf_pool, pool, verbose);
+  }));
+
+  vec_foreach (ft, fm->tables)
+    vlib_cli_output (vm, "thread %d: %d symmetric flows, %d not recorded",
+                     ft - fm->tables, pool_elts (ft->flows), ft->n_full);
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (show_nsh_sf_pool_command, static) = {
+  .path = "show nsh sf-pool",
+  .short_help = "show nsh sf-pool [verbose]",
+  .function = show_nsh_sf_pool_command_fn,
+};
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
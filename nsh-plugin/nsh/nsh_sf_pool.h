@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef included_nsh_sf_pool_h
+#define included_nsh_sf_pool_h
+
+#include <vnet/vnet.h>
+
+/* Maglev lookup table length, a prime well above 100x the members */
+#define NSH_SF_POOL_TABLE_SIZE 4093
+
+/** Note:
+ * One SF instance of a pool, reached the way a map reaches its next
+ * hop. Members are known by {next_node, sw_if_index}, which also seeds
+ * their Maglev permutation, so a member keeps its slots whatever else
+ * joins or leaves.
+ */
+typedef struct {
+  u32 next_node;
+  u32 sw_if_index;
+  u32 adj_index;
+} nsh_sf_member_t;
+
+typedef struct {
+  /* user given pool id */
+  u32 id;
+
+  /* members, sorted by {next_node, sw_if_index} */
+  nsh_sf_member_t * members;
+
+  /* NSH_SF_POOL_TABLE_SIZE slots, 0 while the pool has no member.
+   * Rebuilt aside and swapped whole, never written in place. */
+  nsh_sf_member_t * volatile lookup;
+
+  /* maps steering through the pool */
+  u32 n_maps;
+
+  /* both directions of a flow stick to the instance it first took */
+  u8 symmetric;
+
+  /* renewed when a member leaves, invalidating the recorded flows */
+  u32 epoch;
+} nsh_sf_pool_t;
+
+typedef struct {
+  u8 is_add;
+  u32 id;
+  nsh_sf_member_t member;
+} nsh_sf_pool_member_args_t;
+
+typedef struct {
+  u8 is_add;
+  u32 nsp_nsi;
+  u32 id;
+} nsh_map_sf_pool_args_t;
+
+int nsh_sf_pool_add_del_member (nsh_sf_pool_member_args_t * a);
+int nsh_map_sf_pool_add_del (nsh_map_sf_pool_args_t * a);
+void nsh_sf_pool_unlock (u32 sf_pool_index);
+int nsh_sf_pool_set_symmetric (u32 id, u8 is_enable);
+nsh_sf_member_t * nsh_sf_pool_symmetric_select (nsh_sf_pool_t * pool,
+                                                nsh_sf_member_t * lookup,
+                                                void * ip, u8 is_ip6);
+void nsh_sf_pool_flow_prealloc (u32 max_flows);
+u8 * format_nsh_sf_flow_memory (u8 * s, va_list * args);
+u8 * format_nsh_sf_pool (u8 * s, va_list * args);
+
+#endif /* included_nsh_sf_pool_h */
@@ -0,0 +1,815 @@
+/*
+ * nsh_snapshot.c - binary snapshot and restore of the NSH tables
+ *
+ * Copyright (c) 2017 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vnet/vnet.h>
+#include <vnet/adj/adj.h>
+#include <nsh/nsh.h>
+
+/** Note:
+ * Layout of a snapshot file, host byte order:
+ *
+ *   nsh_snapshot_header_t
+ *   n_options  x nsh_snapshot_option_t
+ *   n_entries  x nsh_snapshot_entry_t
+ *   n_maps     x nsh_snapshot_map_t
+ *   n_proxies  x nsh_snapshot_proxy_t
+ *   n_nsp_hops x nsh_snapshot_nsp_hop_t
+ *   n_sf_members x nsh_snapshot_sf_member_t
+ *
+ * Every section starts at the offset given in the header and records
+ * have a fixed stride, so the file is used in place once mmap'ed.
+ * Snapshots are only meant to be restored on the same build and host:
+ * sw_if_index values are stored as they are. A map's iOAM export
+ * override is not saved, its next is only known once export is enabled.
+ */
+#define NSH_SNAPSHOT_MAGIC 0x4e534853	/* "NSHS" */
+#define NSH_SNAPSHOT_VERSION 3
+
+typedef struct {
+  u32 magic;
+  u16 version;
+  u16 header_size;
+  u32 n_options;
+  u32 n_entries;
+  u32 n_maps;
+  u32 n_proxies;
+  u32 n_nsp_hops;
+  u32 n_sf_members;
+  u32 options_offset;
+  u32 entries_offset;
+  u32 maps_offset;
+  u32 proxies_offset;
+  u32 nsp_hops_offset;
+  u32 sf_members_offset;
+} nsh_snapshot_header_t;
+
+/* MD2 option a snapshot depends on, network order as registered */
+typedef struct {
+  u16 class;
+  u8 type;
+  u8 pad;
+} nsh_snapshot_option_t;
+
+typedef struct {
+  nsh_base_header_t nsh_base;	/* host order nsp_nsi, as in nsh_entry_t */
+  nsh_md1_data_t md1_data;
+  u8 tlvs_len;
+  u8 rewrite_size;
+  u8 pad[6];
+  u8 tlvs[MAX_METADATA_LEN << 2];
+  u8 rewrite[MAX_NSH_HEADER_LEN];
+} nsh_snapshot_entry_t;
+
+typedef struct {
+  u32 nsp_nsi;
+  u32 mapped_nsp_nsi;
+  u32 nsh_action;
+  u32 sw_if_index;
+  u32 rx_sw_if_index;
+  u32 next_node;
+  /* SF pool id the map steers through, ~0 if none */
+  u32 sf_pool_id;
+  /* policer config, as in nsh_map_policer_args_t */
+  u8 has_policer;
+  u8 policer_type;
+  u8 rate_type;
+  u8 exceed_action;
+  u32 cir;
+  u32 cb;
+  u32 pir;
+  u32 pb;
+} nsh_snapshot_map_t;
+
+typedef struct {
+  u32 transport_type;
+  u32 transport_index;
+  u32 nsp_nsi;			/* network order, as in nsh_proxy_session_t */
+} nsh_snapshot_proxy_t;
+
+typedef struct {
+  u32 nsp;
+  u32 nsi;
+  u32 next_node;
+  u32 sw_if_index;
+} nsh_snapshot_nsp_hop_t;
+
+/* SF pools are rebuilt from their members */
+typedef struct {
+  u32 id;
+  u32 next_node;
+  u32 sw_if_index;
+  u8 symmetric;
+  u8 pad[3];
+} nsh_snapshot_sf_member_t;
+
+#define nsh_snapshot_section(h,s) \
+  ((void *) (h) + (h)->s##_offset)
+
+static clib_error_t *
+nsh_snapshot_save (char * file)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_snapshot_header_t * h;
+  nsh_snapshot_option_t * o;
+  nsh_snapshot_entry_t * e;
+  nsh_snapshot_map_t * m;
+  nsh_snapshot_proxy_t * p;
+  nsh_snapshot_nsp_hop_t * n;
+  nsh_snapshot_sf_member_t * s;
+  nsh_option_map_by_key_t * key;
+  nsh_entry_t * entry;
+  nsh_map_t * map;
+  nsh_proxy_session_t * proxy;
+  nsh_nsp_path_t * path;
+  nsh_nsp_hop_t * hop;
+  nsh_sf_pool_t * pool;
+  nsh_sf_member_t * member;
+  nsh_policer_t * policer;
+  hash_pair_t * hp;
+  u32 n_nsp_hops = 0, n_sf_members = 0;
+  u8 * buf = 0;
+  clib_error_t * error = 0;
+  int fd;
+
+  pool_foreach (path, nm->nsp_paths,
+  ({
+    n_nsp_hops += path->n_hops;
+  }));
+
+  pool_foreach (pool, nm->sf_pools,
+  ({
+    n_sf_members += vec_len (pool->members);
+  }));
+
+  /* What a snapshot cannot carry is refused rather than dropped */
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    if (map->export_next)
+      return clib_error_return (0, "map nsp_nsi 0x%x: iOAM export "
+                                "override set, disable it first",
+                                map->nsp_nsi);
+    if (map->sf_pool_index != ~0
+        && vec_len (pool_elt_at_index (nm->sf_pools,
+                                       map->sf_pool_index)->members) == 0)
+      return clib_error_return (0, "map nsp_nsi 0x%x: SF pool has "
+                                "no member",
+                                map->nsp_nsi);
+  }));
+
+  vec_validate (buf, sizeof (*h) - 1);
+  h = (nsh_snapshot_header_t *) buf;
+  h->magic = NSH_SNAPSHOT_MAGIC;
+  h->version = NSH_SNAPSHOT_VERSION;
+  h->header_size = sizeof (*h);
+  h->n_options = hash_elts (nm->nsh_option_map_by_key);
+  h->n_entries = pool_elts (nm->nsh_entries);
+  h->n_maps = pool_elts (nm->nsh_mappings);
+  h->n_proxies = pool_elts (nm->nsh_proxy_sessions);
+  h->n_nsp_hops = n_nsp_hops;
+  h->n_sf_members = n_sf_members;
+  h->options_offset = round_pow2 (sizeof (*h), sizeof (u64));
+  h->entries_offset = round_pow2 (h->options_offset +
+                                  h->n_options * sizeof (*o), sizeof (u64));
+  h->maps_offset = h->entries_offset + h->n_entries * sizeof (*e);
+  h->proxies_offset = h->maps_offset + h->n_maps * sizeof (*m);
+  h->nsp_hops_offset = h->proxies_offset + h->n_proxies * sizeof (*p);
+  h->sf_members_offset = h->nsp_hops_offset + h->n_nsp_hops * sizeof (*n);
+
+  vec_validate (buf, h->sf_members_offset +
+                h->n_sf_members * sizeof (*s) - 1);
+  /* vec_validate may have moved it */
+  h = (nsh_snapshot_header_t *) buf;
+
+  o = nsh_snapshot_section (h, options);
+  hash_foreach_pair (hp, nm->nsh_option_map_by_key,
+  ({
+    key = uword_to_pointer (hp->key, nsh_option_map_by_key_t *);
+    o->class = key->class;
+    o->type = key->type;
+    o++;
+  }));
+
+  e = nsh_snapshot_section (h, entries);
+  pool_foreach (entry, nm->nsh_entries,
+  ({
+    e->nsh_base = entry->nsh_base;
+    e->md1_data = entry->md.md1_data;
+    e->tlvs_len = entry->tlvs_len;
+    clib_memcpy (e->tlvs, entry->tlvs_data, entry->tlvs_len);
+    e->rewrite_size = entry->rewrite_size;
+    clib_memcpy (e->rewrite, entry->rewrite, entry->rewrite_size);
+    e++;
+  }));
+
+  m = nsh_snapshot_section (h, maps);
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    m->nsp_nsi = map->nsp_nsi;
+    m->mapped_nsp_nsi = map->mapped_nsp_nsi;
+    m->nsh_action = map->nsh_action;
+    m->sw_if_index = map->sw_if_index;
+    m->rx_sw_if_index = map->rx_sw_if_index;
+    m->next_node = map->next_node;
+    m->sf_pool_id = map->sf_pool_index == ~0 ? ~0 :
+      pool_elt_at_index (nm->sf_pools, map->sf_pool_index)->id;
+    if (map->policer_index != ~0)
+      {
+        policer = pool_elt_at_index (nm->policers, map->policer_index);
+        m->has_policer = 1;
+        m->policer_type = policer->type;
+        m->rate_type = policer->rate_type;
+        m->exceed_action = policer->exceed_action;
+        m->cir = policer->cir;
+        m->cb = policer->cb;
+        m->pir = policer->pir;
+        m->pb = policer->pb;
+      }
+    m++;
+  }));
+
+  p = nsh_snapshot_section (h, proxies);
+  hash_foreach_pair (hp, nm->nsh_proxy_session_by_key,
+  ({
+    nsh_proxy_session_by_key_t * pkey =
+      uword_to_pointer (hp->key, nsh_proxy_session_by_key_t *);
+    proxy = pool_elt_at_index (nm->nsh_proxy_sessions, hp->value[0]);
+    p->transport_type = pkey->transport_type;
+    p->transport_index = pkey->transport_index;
+    p->nsp_nsi = proxy->nsp_nsi;
+    p++;
+  }));
+
+  n = nsh_snapshot_section (h, nsp_hops);
+  pool_foreach (path, nm->nsp_paths,
+  ({
+    vec_foreach (hop, path->hops)
+      {
+        if (hop->next_node == ~0)
+          continue;
+        n->nsp = path->nsp;
+        n->nsi = hop - path->hops;
+        n->next_node = hop->next_node;
+        n->sw_if_index = hop->sw_if_index;
+        n++;
+      }
+  }));
+
+  s = nsh_snapshot_section (h, sf_members);
+  pool_foreach (pool, nm->sf_pools,
+  ({
+    vec_foreach (member, pool->members)
+      {
+        s->id = pool->id;
+        s->next_node = member->next_node;
+        s->sw_if_index = member->sw_if_index;
+        s->symmetric = pool->symmetric;
+        s++;
+      }
+  }));
+
+  fd = open (file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    {
+      error = clib_error_return_unix (0, "open `%s'", file);
+      goto done;
+    }
+
+  if (write (fd, buf, vec_len (buf)) != vec_len (buf))
+    error = clib_error_return_unix (0, "write `%s'", file);
+
+  close (fd);
+
+done:
+  vec_free (buf);
+  return error;
+}
+
+static u8
+nsh_snapshot_header_valid (nsh_snapshot_header_t * h, uword size)
+{
+  if (size < sizeof (*h) || h->magic != NSH_SNAPSHOT_MAGIC
+      || h->version != NSH_SNAPSHOT_VERSION
+      || h->header_size != sizeof (*h))
+    return 0;
+
+  return (h->options_offset + (u64) h->n_options *
+          sizeof (nsh_snapshot_option_t) <= size
+          && h->entries_offset + (u64) h->n_entries *
+          sizeof (nsh_snapshot_entry_t) <= size
+          && h->maps_offset + (u64) h->n_maps *
+          sizeof (nsh_snapshot_map_t) <= size
+          && h->proxies_offset + (u64) h->n_proxies *
+          sizeof (nsh_snapshot_proxy_t) <= size
+          && h->nsp_hops_offset + (u64) h->n_nsp_hops *
+          sizeof (nsh_snapshot_nsp_hop_t) <= size
+          && h->sf_members_offset + (u64) h->n_sf_members *
+          sizeof (nsh_snapshot_sf_member_t) <= size);
+}
+
+/*
+ * Adjacency per sw_if_index, built in one walk of the adjacency pool
+ * rather than one walk per ethernet map. First match wins, as with
+ * nsh_get_adj_by_sw_if_index.
+ */
+static u32 *
+nsh_snapshot_adj_by_sw_if_index (void)
+{
+  u32 * adj_by_sw_if_index = 0;
+  adj_index_t ai;
+  u32 sw_if_index;
+
+  /* *INDENT-OFF* */
+  pool_foreach_index(ai, adj_pool,
+  ({
+    sw_if_index = adj_get_sw_if_index (ai);
+    if (sw_if_index == ~0)
+      continue;
+    vec_validate_init_empty (adj_by_sw_if_index, sw_if_index, ~0);
+    if (adj_by_sw_if_index[sw_if_index] == ~0)
+      adj_by_sw_if_index[sw_if_index] = ai;
+  }));
+  /* *INDENT-ON* */
+
+  return adj_by_sw_if_index;
+}
+
+static u32
+nsh_snapshot_adj_lookup (u32 ** adj_by_sw_if_index, u32 sw_if_index)
+{
+  if (*adj_by_sw_if_index == 0)
+    *adj_by_sw_if_index = nsh_snapshot_adj_by_sw_if_index ();
+
+  if (sw_if_index < vec_len (*adj_by_sw_if_index))
+    return (*adj_by_sw_if_index)[sw_if_index];
+
+  return ~0;
+}
+
+static u8
+nsh_snapshot_entry_valid (nsh_snapshot_entry_t * e)
+{
+  nsh_base_header_t * hdr = (nsh_base_header_t *) e->rewrite;
+  u32 len = (e->nsh_base.length & NSH_LEN_MASK) << 2;
+
+  if (e->tlvs_len > sizeof (e->tlvs))
+    return 0;
+
+  /* the rewrite is the header, as long as its length field says */
+  return len != 0 && e->rewrite_size == len
+    && (hdr->length & NSH_LEN_MASK) == (e->nsh_base.length & NSH_LEN_MASK);
+}
+
+/*
+ * Undo a partial load. The tables were empty when it started, so
+ * everything in them now came from the snapshot.
+ */
+static void
+nsh_snapshot_unload (void)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_add_del_map_args_t _a, * a = &_a;
+  nsh_add_del_nsp_hop_args_t _na, * na = &_na;
+  nsh_add_del_entry_args_t _ea, * ea = &_ea;
+  nsh_sf_pool_member_args_t _sa, * sa = &_sa;
+  nsh_proxy_session_by_key_t * pkey;
+  nsh_proxy_session_t * proxy;
+  nsh_nsp_path_t * path;
+  nsh_sf_pool_t * pool;
+  nsh_sf_member_t * members = 0, * member;
+  nsh_map_t * map;
+  u32 * keys = 0, * key;
+  uword value;
+  u32 i;
+
+  memset (na, 0, sizeof (*na));
+  pool_foreach (path, nm->nsp_paths,
+  ({
+    vec_add1 (keys, path->nsp);
+  }));
+  vec_foreach (key, keys)
+    {
+      path = pool_elt_at_index (nm->nsp_paths,
+                                hash_get (nm->nsp_path_by_nsp, *key)[0]);
+      na->nsp = *key;
+      /* deleting the last hop frees the path */
+      for (i = vec_len (path->hops); i-- > 1; )
+        if (path->hops[i].next_node != ~0)
+          {
+            na->nsi = i;
+            nsh_add_del_nsp_hop (na);
+            if (hash_get (nm->nsp_path_by_nsp, *key) == 0)
+              break;
+          }
+    }
+  vec_reset_length (keys);
+
+  memset (a, 0, sizeof (*a));
+  hash_foreach_mem (pkey, value, nm->nsh_proxy_session_by_key,
+  ({
+    proxy = pool_elt_at_index (nm->nsh_proxy_sessions, value);
+    vec_add1 (keys, pkey->transport_type);
+    vec_add1 (keys, pkey->transport_index);
+    vec_add1 (keys, clib_net_to_host_u32 (proxy->nsp_nsi) + 1);
+  }));
+  for (i = 0; i < vec_len (keys); i += 3)
+    {
+      a->map.next_node = keys[i];
+      a->map.sw_if_index = keys[i + 1];
+      a->map.nsp_nsi = keys[i + 2];
+      nsh_add_del_proxy_session (a);
+    }
+  vec_reset_length (keys);
+
+  pool_foreach (map, nm->nsh_mappings,
+  ({
+    vec_add1 (keys, map->nsp_nsi);
+  }));
+  vec_foreach (key, keys)
+    {
+      a->map.nsp_nsi = *key;
+      nsh_add_del_map (a, 0);
+    }
+  vec_reset_length (keys);
+
+  /* With the maps gone, the last member takes its pool along */
+  memset (sa, 0, sizeof (*sa));
+  pool_foreach (pool, nm->sf_pools,
+  ({
+    vec_foreach (member, pool->members)
+      {
+        vec_add1 (keys, pool->id);
+        vec_add1 (members, *member);
+      }
+  }));
+  vec_foreach_index (i, keys)
+    {
+      sa->id = keys[i];
+      sa->member = members[i];
+      nsh_sf_pool_add_del_member (sa);
+    }
+  vec_free (members);
+  vec_reset_length (keys);
+
+  memset (ea, 0, sizeof (*ea));
+  hash_foreach_mem (key, value, nm->nsh_entry_by_key,
+  ({
+    vec_add1 (keys, *key);
+  }));
+  vec_foreach (key, keys)
+    {
+      ea->nsh_entry.nsh_base.nsp_nsi = *key;
+      nsh_add_del_entry (ea, 0);
+    }
+
+  vec_free (keys);
+}
+
+static clib_error_t *
+nsh_snapshot_load (char * file)
+{
+  nsh_main_t * nm = &nsh_main;
+  nsh_snapshot_header_t * h;
+  nsh_snapshot_option_t * o;
+  nsh_snapshot_entry_t * e;
+  nsh_snapshot_map_t * m;
+  nsh_snapshot_proxy_t * p;
+  nsh_snapshot_nsp_hop_t * n;
+  nsh_snapshot_sf_member_t * s;
+  nsh_add_del_map_args_t _a, * a = &_a;
+  nsh_add_del_nsp_hop_args_t _na, * na = &_na;
+  nsh_sf_pool_member_args_t _sa, * sa = &_sa;
+  nsh_map_policer_args_t _pa, * pa = &_pa;
+  nsh_map_sf_pool_args_t _ma, * ma = &_ma;
+  nsh_entry_t * entry;
+  nsh_proxy_session_t * proxy;
+  nsh_proxy_session_by_key_t * pkey;
+  u32 * adj_by_sw_if_index = 0;
+  u32 * key;
+  clib_error_t * error = 0;
+  struct stat st;
+  void * base;
+  int fd, rv;
+  u32 i;
+
+  if (pool_elts (nm->nsh_entries) || pool_elts (nm->nsh_mappings)
+      || pool_elts (nm->nsh_proxy_sessions) || pool_elts (nm->nsp_paths)
+      || pool_elts (nm->sf_pools))
+    return clib_error_return (0, "nsh tables not empty");
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+    return clib_error_return_unix (0, "open `%s'", file);
+
+  if (fstat (fd, &st) < 0)
+    {
+      close (fd);
+      return clib_error_return_unix (0, "stat `%s'", file);
+    }
+
+  base = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (base == MAP_FAILED)
+    return clib_error_return_unix (0, "mmap `%s'", file);
+
+  h = base;
+  if (!nsh_snapshot_header_valid (h, st.st_size))
+    {
+      error = clib_error_return (0, "`%s' is not an nsh snapshot of "
+                                 "version %d", file, NSH_SNAPSHOT_VERSION);
+      goto done;
+    }
+
+  /* Options are registered by code, they can only be checked for */
+  o = nsh_snapshot_section (h, options);
+  for (i = 0; i < h->n_options; i++, o++)
+    if (nsh_md2_lookup_option (o->class, o->type) == 0)
+      {
+        error = clib_error_return (0, "md2 option class 0x%x type 0x%x "
+                                   "not registered",
+                                   clib_net_to_host_u16 (o->class), o->type);
+        goto done;
+      }
+
+  /* Check the entries before anything is inserted from them */
+  e = nsh_snapshot_section (h, entries);
+  for (i = 0; i < h->n_entries; i++, e++)
+    if (!nsh_snapshot_entry_valid (e))
+      {
+        error = clib_error_return (0, "entry nsp_nsi 0x%x: bad tlvs "
+                                   "length %d or rewrite size %d",
+                                   e->nsh_base.nsp_nsi, e->tlvs_len,
+                                   e->rewrite_size);
+        goto done;
+      }
+
+  /* Size the pools and hashes for the whole snapshot up front */
+  pool_alloc_aligned (nm->nsh_entries, h->n_entries, CLIB_CACHE_LINE_BYTES);
+  pool_alloc_aligned (nm->nsh_mappings, h->n_maps, CLIB_CACHE_LINE_BYTES);
+  pool_alloc_aligned (nm->nsh_proxy_sessions, h->n_proxies,
+                      CLIB_CACHE_LINE_BYTES);
+  hash_free (nm->nsh_entry_by_key);
+  nm->nsh_entry_by_key =
+    hash_create_mem (h->n_entries, sizeof (u32), sizeof (uword));
+  hash_free (nm->nsh_mapping_by_key);
+  nm->nsh_mapping_by_key =
+    hash_create_mem (h->n_maps, sizeof (u32), sizeof (uword));
+  hash_free (nm->nsh_proxy_session_by_key);
+  nm->nsh_proxy_session_by_key =
+    hash_create_mem (h->n_proxies, sizeof (nsh_proxy_session_by_key_t),
+                     sizeof (uword));
+
+  /* Entries carry their rewrite, no need to run nsh_header_rewrite */
+  e = nsh_snapshot_section (h, entries);
+  for (i = 0; i < h->n_entries; i++, e++)
+    {
+      pool_get_aligned (nm->nsh_entries, entry, CLIB_CACHE_LINE_BYTES);
+      memset (entry, 0, sizeof (*entry));
+      entry->nsh_base = e->nsh_base;
+      entry->md.md1_data = e->md1_data;
+      if (e->tlvs_len)
+        {
+          vec_validate_aligned (entry->tlvs_data, e->tlvs_len - 1,
+                                CLIB_CACHE_LINE_BYTES);
+          clib_memcpy (entry->tlvs_data, e->tlvs, e->tlvs_len);
+          entry->tlvs_len = e->tlvs_len;
+        }
+      /* same room as nsh_header_rewrite leaves */
+      vec_validate_aligned (entry->rewrite,
+                            (e->nsh_base.md_type == 2 ?
+                             MAX_NSH_HEADER_LEN : e->rewrite_size) - 1,
+                            CLIB_CACHE_LINE_BYTES);
+      clib_memcpy (entry->rewrite, e->rewrite, e->rewrite_size);
+      entry->rewrite_size = e->rewrite_size;
+
+      if (hash_get_mem (nm->nsh_entry_by_key, &e->nsh_base.nsp_nsi))
+        {
+          vec_free (entry->tlvs_data);
+          vec_free (entry->rewrite);
+          pool_put (nm->nsh_entries, entry);
+          error = clib_error_return (0, "entry nsp_nsi 0x%x: duplicate",
+                                     e->nsh_base.nsp_nsi);
+          goto done;
+        }
+
+      key = clib_mem_alloc (sizeof (*key));
+      *key = entry->nsh_base.nsp_nsi;
+      hash_set_mem (nm->nsh_entry_by_key, key, entry - nm->nsh_entries);
+      nsh_event_post (NSH_EVENT_ENTRY_ADD, *key, entry - nm->nsh_entries);
+    }
+
+  /* SF pools first, maps bind to them by id */
+  s = nsh_snapshot_section (h, sf_members);
+  for (i = 0; i < h->n_sf_members; i++, s++)
+    {
+      memset (sa, 0, sizeof (*sa));
+      sa->is_add = 1;
+      sa->id = s->id;
+      sa->member.next_node = s->next_node;
+      sa->member.sw_if_index = s->sw_if_index;
+      sa->member.adj_index = ~0;
+
+      if (s->next_node == NSH_NODE_NEXT_ENCAP_ETHERNET)
+        sa->member.adj_index =
+          nsh_snapshot_adj_lookup (&adj_by_sw_if_index, s->sw_if_index);
+
+      rv = nsh_sf_pool_add_del_member (sa);
+      if (rv == 0 && s->symmetric)
+        rv = nsh_sf_pool_set_symmetric (s->id, 1);
+      if (rv)
+        {
+          error = clib_error_return (0, "sf-pool %d: member add "
+                                     "returned %d", s->id, rv);
+          goto done;
+        }
+    }
+
+  /* Maps go through the action function, which owns the interfaces */
+  m = nsh_snapshot_section (h, maps);
+  for (i = 0; i < h->n_maps; i++, m++)
+    {
+      memset (a, 0, sizeof (*a));
+      a->is_add = 1;
+      a->map.nsp_nsi = m->nsp_nsi;
+      a->map.mapped_nsp_nsi = m->mapped_nsp_nsi;
+      a->map.nsh_action = m->nsh_action;
+      a->map.sw_if_index = m->sw_if_index;
+      a->map.rx_sw_if_index = m->rx_sw_if_index;
+      a->map.next_node = m->next_node;
+      a->map.adj_index = ~0;
+
+      if (m->next_node == NSH_NODE_NEXT_ENCAP_ETHERNET)
+        {
+          a->map.adj_index =
+            nsh_snapshot_adj_lookup (&adj_by_sw_if_index, m->sw_if_index);
+        }
+
+      rv = nsh_add_del_map (a, 0);
+      if (rv)
+        {
+          error = clib_error_return (0, "map nsp_nsi 0x%x: "
+                                     "nsh_add_del_map returned %d",
+                                     m->nsp_nsi, rv);
+          goto done;
+        }
+
+      if (m->has_policer)
+        {
+          memset (pa, 0, sizeof (*pa));
+          pa->is_add = 1;
+          pa->nsp_nsi = m->nsp_nsi;
+          pa->type = m->policer_type;
+          pa->rate_type = m->rate_type;
+          pa->exceed_action = m->exceed_action;
+          pa->cir = m->cir;
+          pa->cb = m->cb;
+          pa->pir = m->pir;
+          pa->pb = m->pb;
+          rv = nsh_map_policer_add_del (pa);
+          if (rv)
+            {
+              error = clib_error_return (0, "map nsp_nsi 0x%x: "
+                                         "nsh_map_policer_add_del "
+                                         "returned %d", m->nsp_nsi, rv);
+              goto done;
+            }
+        }
+
+      if (m->sf_pool_id != ~0)
+        {
+          memset (ma, 0, sizeof (*ma));
+          ma->is_add = 1;
+          ma->nsp_nsi = m->nsp_nsi;
+          ma->id = m->sf_pool_id;
+          rv = nsh_map_sf_pool_add_del (ma);
+          if (rv)
+            {
+              error = clib_error_return (0, "map nsp_nsi 0x%x: "
+                                         "nsh_map_sf_pool_add_del "
+                                         "returned %d", m->nsp_nsi, rv);
+              goto done;
+            }
+        }
+    }
+
+  p = nsh_snapshot_section (h, proxies);
+  for (i = 0; i < h->n_proxies; i++, p++)
+    {
+      pool_get_aligned (nm->nsh_proxy_sessions, proxy, CLIB_CACHE_LINE_BYTES);
+      memset (proxy, 0, sizeof (*proxy));
+      proxy->nsp_nsi = p->nsp_nsi;
+
+      pkey = clib_mem_alloc (sizeof (*pkey));
+      memset (pkey, 0, sizeof (*pkey));
+      pkey->transport_type = p->transport_type;
+      pkey->transport_index = p->transport_index;
+      hash_set_mem (nm->nsh_proxy_session_by_key, pkey,
+                    proxy - nm->nsh_proxy_sessions);
+      /* the session stores NSI - 1, see nsh_add_del_proxy_session */
+      nsh_event_post (NSH_EVENT_PROXY_ADD,
+                      clib_net_to_host_u32 (proxy->nsp_nsi) + 1,
+                      proxy - nm->nsh_proxy_sessions);
+    }
+
+  n = nsh_snapshot_section (h, nsp_hops);
+  for (i = 0; i < h->n_nsp_hops; i++, n++)
+    {
+      memset (na, 0, sizeof (*na));
+      na->is_add = 1;
+      na->nsp = n->nsp;
+      na->nsi = n->nsi;
+      na->hop.next_node = n->next_node;
+      na->hop.sw_if_index = n->sw_if_index;
+      na->hop.adj_index = ~0;
+
+      if (n->next_node == NSH_NODE_NEXT_ENCAP_ETHERNET)
+        na->hop.adj_index =
+          nsh_snapshot_adj_lookup (&adj_by_sw_if_index, n->sw_if_index);
+
+      rv = nsh_add_del_nsp_hop (na);
+      if (rv)
+        {
+          error = clib_error_return (0, "nsp %d nsi %d: "
+                                     "nsh_add_del_nsp_hop returned %d",
+                                     n->nsp, n->nsi, rv);
+          goto done;
+        }
+    }
+
+done:
+  if (error)
+    nsh_snapshot_unload ();
+  vec_free (adj_by_sw_if_index);
+  munmap (base, st.st_size);
+  return error;
+}
+
+static clib_error_t *
+nsh_snapshot_command_fn (vlib_main_t * vm,
+                         unformat_input_t * input,
+                         vlib_cli_command_t * cmd)
+{
+  u8 * file = 0;
+  clib_error_t * error = 0;
+  int is_save = -1;
+  f64 start = vlib_time_now (vm);
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "save %s", &file))
+        is_save = 1;
+      else if (unformat (input, "load %s", &file))
+        is_save = 0;
+      else
+        return clib_error_return (0, "parse error: '%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (is_save == -1)
+    return clib_error_return (0, "save or load required");
+
+  vec_add1 (file, 0);
+  error = is_save ? nsh_snapshot_save ((char *) file) :
+    nsh_snapshot_load ((char *) file);
+
+  if (error == 0)
+    vlib_cli_output (vm, "%s %s in %.3f seconds",
+                     is_save ? "saved" : "loaded", file,
+                     vlib_time_now (vm) - start);
+
+  vec_free (file);
+  return error;
+}
+
+VLIB_CLI_COMMAND (nsh_snapshot_command, static) = {
+  .path = "nsh snapshot",
+  .short_help = "nsh snapshot {save | load} <file>",
+  .function = nsh_snapshot_command_fn,
+};
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -59,6 +59,14 @@ nsh_test_main_t nsh_test_main;
 #define foreach_standard_reply_retval_handler   \
 _(nsh_add_del_entry_reply)			\
 _(nsh_add_del_map_reply)			\
+_(nsh_map_policer_reply)			\
+_(nsh_sf_pool_add_del_member_reply)		\
+_(nsh_map_sf_pool_reply)			\
+_(nsh_sf_pool_symmetric_reply)			\
+_(want_nsh_events_reply)			\
+_(nsh_add_del_nsp_hop_reply)			\
+_(nsh_classify_add_del_session_reply)		\
+_(nsh_classify_enable_disable_reply)		\
 
 #define _(n)                                            \
     static void vl_api_##n##_t_handler                  \
@@ -84,7 +92,21 @@ foreach_standard_reply_retval_handler;
 _(NSH_ADD_DEL_ENTRY_REPLY, nsh_add_del_entry_reply)			\
 _(NSH_ENTRY_DETAILS, nsh_entry_details)                                 \
 _(NSH_ADD_DEL_MAP_REPLY, nsh_add_del_map_reply)                         \
-_(NSH_MAP_DETAILS, nsh_map_details)
+_(NSH_MAP_DETAILS, nsh_map_details)                                     \
+_(NSH_ENTRY_PAGE_DETAILS, nsh_entry_page_details)                       \
+_(NSH_ENTRY_PAGE_DUMP_REPLY, nsh_entry_page_dump_reply)                 \
+_(NSH_MAP_PAGE_DETAILS, nsh_map_page_details)                           \
+_(NSH_MAP_PAGE_DUMP_REPLY, nsh_map_page_dump_reply)                     \
+_(NSH_MAP_POLICER_REPLY, nsh_map_policer_reply)                         \
+_(NSH_SF_POOL_ADD_DEL_MEMBER_REPLY, nsh_sf_pool_add_del_member_reply)   \
+_(NSH_MAP_SF_POOL_REPLY, nsh_map_sf_pool_reply)                         \
+_(NSH_SF_POOL_SYMMETRIC_REPLY, nsh_sf_pool_symmetric_reply)             \
+_(WANT_NSH_EVENTS_REPLY, want_nsh_events_reply)                         \
+_(NSH_MAP_INTERFACE_REPLY, nsh_map_interface_reply)                     \
+_(NSH_ADD_DEL_NSP_HOP_REPLY, nsh_add_del_nsp_hop_reply)                 \
+_(NSH_CLASSIFY_ADD_DEL_SESSION_REPLY, nsh_classify_add_del_session_reply) \
+_(NSH_CLASSIFY_ENABLE_DISABLE_REPLY, nsh_classify_enable_disable_reply) \
+_(NSH_EVENT, nsh_event)
 
 
 /* M: construct, but don't yet send a message */
@@ -248,6 +270,112 @@ static int api_nsh_entry_dump (vat_main_t * vam)
     W;
 }
 
+/* Records of the paged details and events stay in network order */
+#define foreach_nsh_page_details                \
+_(nsh_entry_page_details)                       \
+_(nsh_map_page_details)                         \
+_(nsh_event)
+
+#define _(n)                                                    \
+    static void vl_api_##n##_t_endian (vl_api_##n##_t * mp)     \
+    {                                                           \
+    }                                                           \
+    static void * vl_api_##n##_t_print                          \
+    (vl_api_##n##_t * mp, void * handle)                        \
+    {                                                           \
+        return handle;                                          \
+    }
+foreach_nsh_page_details;
+#undef _
+
+/* Both page replies print where the next page starts */
+#define foreach_nsh_page_dump_reply             \
+_(nsh_entry_page_dump_reply)                    \
+_(nsh_map_page_dump_reply)
+
+#define _(n)                                                    \
+    static void vl_api_##n##_t_handler                          \
+    (vl_api_##n##_t * mp)                                       \
+    {                                                           \
+        vat_main_t * vam = nsh_test_main.vat_main;              \
+        i32 retval = ntohl(mp->retval);                         \
+        u32 next_cursor = ntohl(mp->next_cursor);               \
+        if (next_cursor != ~0)                                  \
+            fformat(vam->ofp, "next cursor %d\n", next_cursor); \
+        if (vam->async_mode) {                                  \
+            vam->async_errors += (retval < 0);                  \
+        } else {                                                \
+            vam->retval = retval;                               \
+            vam->result_ready = 1;                              \
+        }                                                       \
+    }
+foreach_nsh_page_dump_reply;
+#undef _
+
+static void vl_api_nsh_entry_page_details_t_handler
+(vl_api_nsh_entry_page_details_t * mp)
+{
+    vat_main_t * vam = &vat_main;
+    vl_api_nsh_entry_record_t * r;
+    int i;
+
+    for (i = 0; i < mp->count && i < ARRAY_LEN (mp->records); i++) {
+        r = &mp->records[i];
+        fformat(vam->ofp, "%11d%11d%11d%11d%14d%14d%14d%14d%14d\n",
+                r->ver_o_c,
+                r->length,
+                r->md_type,
+                r->next_protocol,
+                ntohl(r->nsp_nsi),
+                ntohl(r->c1),
+                ntohl(r->c2),
+                ntohl(r->c3),
+                ntohl(r->c4));
+    }
+}
+
+static int api_nsh_entry_page_dump (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_nsh_entry_page_dump_t *mp;
+    f64 timeout;
+    u32 cursor = 0, max_count = 0, nsp = 0, md_type = 0;
+    u8 filter_flags = 0;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "cursor %d", &cursor))
+	;
+      else if (unformat (line_input, "count %d", &max_count))
+	;
+      else if (unformat (line_input, "nsp %d", &nsp))
+	filter_flags |= NSH_DUMP_FILTER_NSP;
+      else if (unformat (line_input, "md-type %d", &md_type))
+	filter_flags |= NSH_DUMP_FILTER_MD_TYPE;
+      else
+	return -99;
+    }
+
+    if (!vam->json_output) {
+        fformat(vam->ofp, "%11s%11s%15s%14s%14s%13s%13s%13s%13s\n",
+                "ver_o_c", "length", "md_type", "next_protocol",
+                "nsp_nsi", "c1", "c2", "c3", "c4");
+    }
+
+    M(NSH_ENTRY_PAGE_DUMP, nsh_entry_page_dump);
+    mp->cursor = htonl (cursor);
+    mp->max_count = htonl (max_count);
+    mp->filter_flags = filter_flags;
+    mp->nsp = htonl (nsp);
+    mp->md_type = md_type;
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
 static int api_nsh_add_del_map (vat_main_t * vam)
 {
     nsh_test_main_t * sm = &nsh_test_main;
@@ -346,6 +474,525 @@ static int api_nsh_map_dump (vat_main_t * vam)
     W;
 }
 
+static void vl_api_nsh_map_page_details_t_handler
+(vl_api_nsh_map_page_details_t * mp)
+{
+    vat_main_t * vam = &vat_main;
+    vl_api_nsh_map_record_t * r;
+    int i;
+
+    for (i = 0; i < mp->count && i < ARRAY_LEN (mp->records); i++) {
+        r = &mp->records[i];
+        fformat(vam->ofp, "%14d%14d%14d%14d\n",
+                ntohl(r->nsp_nsi),
+                ntohl(r->mapped_nsp_nsi),
+                ntohl(r->sw_if_index),
+                ntohl(r->next_node));
+    }
+}
+
+static int api_nsh_map_page_dump (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_nsh_map_page_dump_t *mp;
+    f64 timeout;
+    u32 cursor = 0, max_count = 0, nsp = 0, nsh_action = 0, next_node = 0;
+    u8 filter_flags = 0;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "cursor %d", &cursor))
+	;
+      else if (unformat (line_input, "count %d", &max_count))
+	;
+      else if (unformat (line_input, "nsp %d", &nsp))
+	filter_flags |= NSH_DUMP_FILTER_NSP;
+      else if (unformat (line_input, "action %d", &nsh_action))
+	filter_flags |= NSH_DUMP_FILTER_ACTION;
+      else if (unformat (line_input, "next-node %d", &next_node))
+	filter_flags |= NSH_DUMP_FILTER_NEXT_NODE;
+      else
+	return -99;
+    }
+
+    if (!vam->json_output) {
+        fformat(vam->ofp, "%16s%16s%13s%13s\n",
+                "nsp_nsi", "mapped_nsp_nsi", "sw_if_index", "next_node");
+    }
+
+    M(NSH_MAP_PAGE_DUMP, nsh_map_page_dump);
+    mp->cursor = htonl (cursor);
+    mp->max_count = htonl (max_count);
+    mp->filter_flags = filter_flags;
+    mp->nsp = htonl (nsp);
+    mp->nsh_action = htonl (nsh_action);
+    mp->next_node = htonl (next_node);
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
+static void vl_api_nsh_map_interface_reply_t_handler
+(vl_api_nsh_map_interface_reply_t * mp)
+{
+    vat_main_t * vam = nsh_test_main.vat_main;
+    i32 retval = ntohl(mp->retval);
+
+    if (retval == 0)
+        fformat(vam->ofp, "sw_if_index %d\n", ntohl(mp->sw_if_index));
+
+    if (vam->async_mode) {
+        vam->async_errors += (retval < 0);
+    } else {
+        vam->retval = retval;
+        vam->result_ready = 1;
+    }
+}
+
+static int api_nsh_map_interface (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_nsh_map_interface_t * mp;
+    f64 timeout;
+    u32 nsp, nsi;
+    int nsp_set = 0, nsi_set = 0;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "nsp %d", &nsp))
+	nsp_set = 1;
+      else if (unformat (line_input, "nsi %d", &nsi))
+	nsi_set = 1;
+      else
+	return -99;
+    }
+
+    if (nsp_set == 0 || nsi_set == 0)
+      return -1;
+
+    M(NSH_MAP_INTERFACE, nsh_map_interface);
+    mp->nsp_nsi = htonl ((nsp<< NSH_NSP_SHIFT) | nsi);
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
+static int api_nsh_add_del_nsp_hop (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_nsh_add_del_nsp_hop_t * mp;
+    f64 timeout;
+    u8 is_add = 1;
+    u32 nsp, nsi;
+    int nsp_set = 0, nsi_set = 0;
+    u32 next_node = ~0;
+    u32 sw_if_index = ~0;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "del"))
+	is_add = 0;
+      else if (unformat (line_input, "nsp %d", &nsp))
+	nsp_set = 1;
+      else if (unformat (line_input, "nsi %d", &nsi))
+	nsi_set = 1;
+      else if (unformat (line_input, "encap-gre4-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_GRE4;
+      else if (unformat (line_input, "encap-gre6-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_GRE6;
+      else if (unformat (line_input, "encap-vxlan-gpe-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_VXLANGPE;
+      else if (unformat (line_input, "encap-lisp-gpe-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_LISP_GPE;
+      else if (unformat (line_input, "encap-eth-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_ETHERNET;
+      else
+	return -99;
+    }
+
+    if (nsp_set == 0 || nsi_set == 0)
+      return -1;
+
+    if (is_add && next_node == ~0)
+      return -1;
+
+    M(NSH_ADD_DEL_NSP_HOP, nsh_add_del_nsp_hop);
+    mp->is_add = is_add;
+    mp->nsp = htonl (nsp);
+    mp->nsi = nsi;
+    mp->sw_if_index = htonl (sw_if_index);
+    mp->next_node = htonl (next_node);
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
+static int api_nsh_classify_add_del_session (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_nsh_classify_add_del_session_t * mp;
+    f64 timeout;
+    ip46_address_t src, dst;
+    u32 src_len = ~0, dst_len = ~0;
+    u32 protocol = 0, src_port = 0, dst_port = 0;
+    u32 nsp = 0, nsi = 0;
+    u8 is_add = 1, is_ip6 = 0, match_ports = 0;
+    int src_set = 0, dst_set = 0;
+
+    memset (&src, 0, sizeof (src));
+    memset (&dst, 0, sizeof (dst));
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "del"))
+	is_add = 0;
+      else if (unformat (line_input, "src %U/%d", unformat_ip4_address,
+			 &src.ip4, &src_len))
+	src_set = 1;
+      else if (unformat (line_input, "src %U", unformat_ip4_address,
+			 &src.ip4))
+	src_set = 1;
+      else if (unformat (line_input, "dst %U/%d", unformat_ip4_address,
+			 &dst.ip4, &dst_len))
+	dst_set = 1;
+      else if (unformat (line_input, "dst %U", unformat_ip4_address,
+			 &dst.ip4))
+	dst_set = 1;
+      else if (unformat (line_input, "src %U/%d", unformat_ip6_address,
+			 &src.ip6, &src_len))
+	src_set = is_ip6 = 1;
+      else if (unformat (line_input, "src %U", unformat_ip6_address,
+			 &src.ip6))
+	src_set = is_ip6 = 1;
+      else if (unformat (line_input, "dst %U/%d", unformat_ip6_address,
+			 &dst.ip6, &dst_len))
+	dst_set = is_ip6 = 1;
+      else if (unformat (line_input, "dst %U", unformat_ip6_address,
+			 &dst.ip6))
+	dst_set = is_ip6 = 1;
+      else if (unformat (line_input, "proto %d", &protocol))
+	match_ports = 1;
+      else if (unformat (line_input, "sport %d", &src_port))
+	;
+      else if (unformat (line_input, "dport %d", &dst_port))
+	;
+      else if (unformat (line_input, "nsp %d", &nsp))
+	;
+      else if (unformat (line_input, "nsi %d", &nsi))
+	;
+      else
+	return -99;
+    }
+
+    if (src_set == 0 || dst_set == 0)
+      return -1;
+
+    M(NSH_CLASSIFY_ADD_DEL_SESSION, nsh_classify_add_del_session);
+    mp->is_add = is_add;
+    mp->is_ip6 = is_ip6;
+    if (is_ip6) {
+        clib_memcpy (mp->src_address, &src.ip6, sizeof (src.ip6));
+        clib_memcpy (mp->dst_address, &dst.ip6, sizeof (dst.ip6));
+    } else {
+        clib_memcpy (mp->src_address, &src.ip4, sizeof (src.ip4));
+        clib_memcpy (mp->dst_address, &dst.ip4, sizeof (dst.ip4));
+    }
+    mp->src_len = src_len == ~0 ? (is_ip6 ? 128 : 32) : src_len;
+    mp->dst_len = dst_len == ~0 ? (is_ip6 ? 128 : 32) : dst_len;
+    mp->match_ports = match_ports;
+    mp->protocol = protocol;
+    mp->src_port = htons (src_port);
+    mp->dst_port = htons (dst_port);
+    mp->nsp_nsi = htonl ((nsp<< NSH_NSP_SHIFT) | nsi);
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
+static int api_nsh_classify_enable_disable (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_nsh_classify_enable_disable_t * mp;
+    f64 timeout;
+    u32 sw_if_index = ~0;
+    u8 is_ip6 = 0, enable_disable = 1;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "sw_if_index %d", &sw_if_index))
+	;
+      else if (unformat (line_input, "ip6"))
+	is_ip6 = 1;
+      else if (unformat (line_input, "disable"))
+	enable_disable = 0;
+      else
+	return -99;
+    }
+
+    if (sw_if_index == ~0)
+      return -1;
+
+    M(NSH_CLASSIFY_ENABLE_DISABLE, nsh_classify_enable_disable);
+    mp->sw_if_index = htonl (sw_if_index);
+    mp->is_ip6 = is_ip6;
+    mp->enable_disable = enable_disable;
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
+static int api_nsh_map_policer (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    f64 timeout;
+    u8 is_add = 1;
+    u32 nsp, nsi;
+    int nsp_set = 0, nsi_set = 0;
+    u8 type = NSH_POLICER_TYPE_1R2C;
+    u8 rate_type = NSH_POLICER_RATE_BYTES;
+    u8 exceed_action = NSH_POLICER_ACTION_DROP;
+    u32 cir = 0, cb = 0, pir = 0, pb = 0;
+    vl_api_nsh_map_policer_t * mp;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "del"))
+	is_add = 0;
+      else if (unformat (line_input, "nsp %d", &nsp))
+	nsp_set = 1;
+      else if (unformat (line_input, "nsi %d", &nsi))
+	nsi_set = 1;
+      else if (unformat (line_input, "cir %u", &cir))
+	;
+      else if (unformat (line_input, "cb %u", &cb))
+	;
+      else if (unformat (line_input, "pir %u", &pir))
+	type = NSH_POLICER_TYPE_2R3C;
+      else if (unformat (line_input, "pb %u", &pb))
+	;
+      else if (unformat (line_input, "packets"))
+	rate_type = NSH_POLICER_RATE_PACKETS;
+      else if (unformat (line_input, "exceed-action drop"))
+	exceed_action = NSH_POLICER_ACTION_DROP;
+      else if (unformat (line_input, "exceed-action mark-o-bit"))
+	exceed_action = NSH_POLICER_ACTION_MARK_O_BIT;
+      else if (unformat (line_input, "exceed-action mark-c-bit"))
+	exceed_action = NSH_POLICER_ACTION_MARK_C_BIT;
+      else
+	return -99; //TODO clib_error_return (0, "parse error: '%U'",
+    }
+
+    unformat_free (line_input);
+
+    if (nsp_set == 0 || nsi_set == 0)
+      return -1; // TODO create return value: clib_error_return (0, "nsp nsi pair required. Key: for NSH map");
+
+    M(NSH_MAP_POLICER, nsh_map_policer);
+    /* set args structure */
+    mp->is_add = is_add;
+    mp->nsp_nsi = htonl ((nsp<< NSH_NSP_SHIFT) | nsi);
+    mp->type = type;
+    mp->rate_type = rate_type;
+    mp->exceed_action = exceed_action;
+    mp->cir = htonl (cir);
+    mp->cb = htonl (cb);
+    mp->pir = htonl (pir);
+    mp->pb = htonl (pb);
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
+static int api_nsh_sf_pool_add_del_member (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_nsh_sf_pool_add_del_member_t * mp;
+    f64 timeout;
+    u8 is_add = 1;
+    u32 id;
+    int id_set = 0;
+    u32 next_node = ~0;
+    u32 sw_if_index = ~0;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "del"))
+	is_add = 0;
+      else if (unformat (line_input, "id %d", &id))
+	id_set = 1;
+      else if (unformat (line_input, "encap-gre4-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_GRE4;
+      else if (unformat (line_input, "encap-gre6-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_GRE6;
+      else if (unformat (line_input, "encap-vxlan-gpe-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_VXLANGPE;
+      else if (unformat (line_input, "encap-lisp-gpe-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_LISP_GPE;
+      else if (unformat (line_input, "encap-eth-intf %d", &sw_if_index))
+	next_node = NSH_NODE_NEXT_ENCAP_ETHERNET;
+      else
+	return -99;
+    }
+
+    if (id_set == 0 || next_node == ~0)
+      return -1;
+
+    M(NSH_SF_POOL_ADD_DEL_MEMBER, nsh_sf_pool_add_del_member);
+    mp->is_add = is_add;
+    mp->id = htonl (id);
+    mp->sw_if_index = htonl (sw_if_index);
+    mp->next_node = htonl (next_node);
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
+static int api_nsh_map_sf_pool (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_nsh_map_sf_pool_t * mp;
+    f64 timeout;
+    u8 is_add = 1;
+    u32 nsp, nsi, id = 0;
+    int nsp_set = 0, nsi_set = 0, id_set = 0;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "del"))
+	is_add = 0;
+      else if (unformat (line_input, "nsp %d", &nsp))
+	nsp_set = 1;
+      else if (unformat (line_input, "nsi %d", &nsi))
+	nsi_set = 1;
+      else if (unformat (line_input, "id %d", &id))
+	id_set = 1;
+      else
+	return -99;
+    }
+
+    if (nsp_set == 0 || nsi_set == 0)
+      return -1;
+
+    if (is_add && id_set == 0)
+      return -1;
+
+    M(NSH_MAP_SF_POOL, nsh_map_sf_pool);
+    mp->is_add = is_add;
+    mp->nsp_nsi = htonl ((nsp<< NSH_NSP_SHIFT) | nsi);
+    mp->id = htonl (id);
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
+static int api_nsh_sf_pool_symmetric (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_nsh_sf_pool_symmetric_t * mp;
+    f64 timeout;
+    u8 is_enable = 1;
+    u32 id = 0;
+    int id_set = 0;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "id %d", &id))
+	id_set = 1;
+      else if (unformat (line_input, "enable"))
+	is_enable = 1;
+      else if (unformat (line_input, "disable"))
+	is_enable = 0;
+      else
+	return -99;
+    }
+
+    if (id_set == 0)
+      return -1;
+
+    M(NSH_SF_POOL_SYMMETRIC, nsh_sf_pool_symmetric);
+    mp->id = htonl (id);
+    mp->is_enable = is_enable;
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
+static char * nsh_event_type_strings[] = {
+#define _(sym,str) str,
+  foreach_nsh_event_type
+#undef _
+};
+
+static void vl_api_nsh_event_t_handler
+(vl_api_nsh_event_t * mp)
+{
+    vat_main_t * vam = &vat_main;
+    vl_api_nsh_event_record_t * r;
+    int i;
+
+    for (i = 0; i < mp->count && i < ARRAY_LEN (mp->records); i++) {
+        r = &mp->records[i];
+        fformat(vam->ofp, "nsh event %s nsp_nsi %d index %d\n",
+                r->type < NSH_N_EVENT_TYPE ?
+                nsh_event_type_strings[r->type] : "unknown",
+                ntohl(r->nsp_nsi),
+                ntohl(r->index));
+    }
+}
+
+static int api_want_nsh_events (vat_main_t * vam)
+{
+    nsh_test_main_t * sm = &nsh_test_main;
+    unformat_input_t * line_input = vam->input;
+    vl_api_want_nsh_events_t *mp;
+    f64 timeout;
+    u32 enable_disable = 1;
+
+    while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT) {
+      if (unformat (line_input, "disable"))
+	enable_disable = 0;
+      else
+	return -99;
+    }
+
+    M(WANT_NSH_EVENTS, want_nsh_events);
+    mp->enable_disable = htonl (enable_disable);
+    mp->pid = getpid ();
+
+    /* send it... */
+    S;
+
+    /* Wait for a reply... */
+    W;
+}
+
 /*
  * List of messages that the api test plugin sends,
  * and that the data plane plugin processes
@@ -353,8 +1000,19 @@ static int api_nsh_map_dump (vat_main_t * vam)
 #define foreach_vpe_api_msg \
 _(nsh_add_del_entry, "{nsp <nn> nsi <nn>} c1 <nn> c2 <nn> c3 <nn> c4 <nn> [md-type <nn>] [tlv <xx>] [del]") \
 _(nsh_entry_dump, "")   \
+_(nsh_entry_page_dump, "[cursor <nn>] [count <nn>] [nsp <nn>] [md-type <nn>]") \
 _(nsh_add_del_map, "nsp <nn> nsi <nn> [del] mapped-nsp <nn> mapped-nsi <nn> [encap-gre-intf <nn> | encap-vxlan-gpe-intf <nn> | encap-none]")  \
-_(nsh_map_dump, "")
+_(nsh_map_dump, "")    \
+_(nsh_map_page_dump, "[cursor <nn>] [count <nn>] [nsp <nn>] [action <nn>] [next-node <nn>]") \
+_(nsh_map_policer, "nsp <nn> nsi <nn> [del] cir <rate> cb <burst> [pir <rate> pb <burst>] [packets] [exceed-action drop|mark-o-bit|mark-c-bit]") \
+_(nsh_sf_pool_add_del_member, "id <nn> [del] [encap-gre4-intf <nn> | encap-gre6-intf <nn> | encap-vxlan-gpe-intf <nn> | encap-lisp-gpe-intf <nn> | encap-eth-intf <nn>]") \
+_(nsh_map_sf_pool, "nsp <nn> nsi <nn> [del] id <nn>") \
+_(nsh_sf_pool_symmetric, "id <nn> [enable | disable]") \
+_(nsh_map_interface, "nsp <nn> nsi <nn>") \
+_(nsh_add_del_nsp_hop, "nsp <nn> nsi <nn> [del] [encap-gre4-intf <nn> | encap-gre6-intf <nn> | encap-vxlan-gpe-intf <nn> | encap-lisp-gpe-intf <nn> | encap-eth-intf <nn>]") \
+_(nsh_classify_add_del_session, "[del] src <ip>[/<len>] dst <ip>[/<len>] [proto <nn> sport <nn> dport <nn>] nsp <nn> nsi <nn>") \
+_(nsh_classify_enable_disable, "sw_if_index <nn> [ip6] [disable]") \
+_(want_nsh_events, "[disable]")
 
 void vat_api_hookup (vat_main_t *vam)
 {